@@ -19,7 +19,6 @@ public:
 	{
 		ImGui::Begin("Scene Editor", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
-		bool sceneChanged = false;
 		for(int i = 0; i < renderer->m_sceneObjects.size(); i++)
 		{
 			auto& obj = renderer->m_sceneObjects[i];
@@ -27,14 +26,22 @@ public:
 			{
 				ImGui::Text("Model: %s", obj.modelName.c_str());
 
+				if (renderer->IsSceneObjectMerged(i))
+				{
+					ImGui::Text("Static, merged into a shared mesh");
+					ImGui::TreePop();
+					continue;
+				}
+
+				bool objectChanged = false;
 				if(ImGui::DragFloat3("Position", &obj.position.x, 0.1f))
-					sceneChanged = true;
+					objectChanged = true;
 
 				if (ImGui::DragFloat3("Rotation", &obj.rotation.x, 0.1f))
-					sceneChanged = true;
+					objectChanged = true;
 
 				if (ImGui::DragFloat3("Scale", &obj.scale.x, 0.1f))
-					sceneChanged = true;
+					objectChanged = true;
 
 				if (ImGui::BeginMenu("Material"))
 				{
@@ -44,13 +51,16 @@ public:
 						if (ImGui::MenuItem(("Material " + std::to_string(j) + "##matselect").c_str(), "", obj.materialIndex == j))
 						{
 							obj.materialIndex = j;
-							sceneChanged = true;
+							objectChanged = true;
 						}
 					}
 
 					ImGui::EndMenu();
 				}
 
+				if (objectChanged)
+					renderer->UpdateSceneObject(i);
+
 				ImGui::TreePop();
 			}
 		}
@@ -62,38 +72,35 @@ public:
 			auto& mat = renderer->m_sceneMaterials[i];
 			if (ImGui::TreeNode(("Material " + std::to_string(i) + "##mat").c_str(), "Material %d", i))
 			{
+				bool materialChanged = false;
 				if (ImGui::ColorEdit3("Albedo", &mat.albedo.r))
-					sceneChanged = true;
+					materialChanged = true;
 
 				if (ImGui::DragFloat("Smoothness", &mat.smoothness, 0.01f, 0.0f, 1.0f))
-					sceneChanged = true;
+					materialChanged = true;
 
 				if (ImGui::DragFloat("Fuzziness", &mat.fuzziness, 0.01f, 0.0f, 1.0f))
-					sceneChanged = true;
+					materialChanged = true;
 
 				if(ImGui::DragFloat("Refraction Index", &mat.refractiveIndex, 0.01f, 0.0f, 3.0f))
-					sceneChanged = true;
+					materialChanged = true;
 
 				if(mat.refractiveIndex != 0.0f)
 				{
 					if (ImGui::ColorEdit3("Absorbtion", &mat.absorbtion.r))
-						sceneChanged = true;
+						materialChanged = true;
 				}
 
 				if (ImGui::DragFloat("Emission", &mat.emission, 0.01f, 0.0f, 100.0f))
-					sceneChanged = true;
+					materialChanged = true;
 
+				if (materialChanged)
+					renderer->UpdateSceneMaterial(i);
 
 				ImGui::TreePop();
 			}
 		}
 
 		ImGui::End();
-
-		if (sceneChanged)
-		{
-			renderer->RebufferSceneData();
-			renderer->SetRefreshAccumulation();
-		}
 	}
 };
\ No newline at end of file
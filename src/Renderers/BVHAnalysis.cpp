@@ -0,0 +1,104 @@
+#include "BVHAnalysis.h"
+
+#include <algorithm>
+
+static float GetOverlapArea(const AABB& a, const AABB& b)
+{
+	AABB overlap;
+	overlap.min = glm::max(a.min, b.min);
+	overlap.max = glm::min(a.max, b.max);
+	if (overlap.max.x < overlap.min.x || overlap.max.y < overlap.min.y || overlap.max.z < overlap.min.z)
+		return 0.0f;
+
+	return overlap.GetArea();
+}
+
+BVHQualityStats AnalyseBVH(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings)
+{
+	BVHQualityStats stats;
+
+	struct PendingNode
+	{
+		const BVHNode* node;
+		int depth;
+	};
+
+	float internalArea = 0.0f;
+	float leafCost = 0.0f;
+	float overlapArea = 0.0f;
+
+	std::vector<PendingNode> stack;
+	stack.push_back({ &parentNode.node, 0 });
+	while (!stack.empty())
+	{
+		PendingNode pending = stack.back();
+		stack.pop_back();
+
+		const BVHNode& node = *pending.node;
+		stats.nodeCount++;
+		stats.maxDepth = std::max(stats.maxDepth, pending.depth);
+
+		if (node.leftChild == -1 && node.rightChild == -1)
+		{
+			stats.leafCount++;
+			stats.triangleReferences += node.triangleCount;
+			leafCost += node.aabb.GetArea() * node.triangleCount;
+
+			if (static_cast<int>(stats.depthHistogram.size()) <= pending.depth)
+				stats.depthHistogram.resize(pending.depth + 1, 0);
+			stats.depthHistogram[pending.depth]++;
+
+			if (static_cast<int>(stats.leafSizeHistogram.size()) <= node.triangleCount)
+				stats.leafSizeHistogram.resize(node.triangleCount + 1, 0);
+			stats.leafSizeHistogram[node.triangleCount]++;
+			continue;
+		}
+
+		internalArea += node.aabb.GetArea();
+
+		//Only the parent node's children are offset by currentBVHSize, the builders keep every other index local to the model.
+		int childOffset = pending.node == &parentNode.node ? currentBVHSize : 0;
+		const BVHNode& leftChild = nodes[node.leftChild - childOffset];
+		const BVHNode& rightChild = nodes[node.rightChild - childOffset];
+		overlapArea += GetOverlapArea(leftChild.aabb, rightChild.aabb);
+
+		stack.push_back({ &rightChild, pending.depth + 1 });
+		stack.push_back({ &leftChild, pending.depth + 1 });
+	}
+
+	float rootArea = parentNode.node.aabb.GetArea();
+	if (rootArea > 0.0f)
+	{
+		stats.sahCost = (settings.traversalCost * internalArea + settings.intersectionCost * leafCost) / rootArea;
+		stats.siblingOverlap = overlapArea / rootArea;
+	}
+
+	return stats;
+}
+
+int GetBVHMaxDepth(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize)
+{
+	if (parentNode.node.leftChild == -1)
+		return 0;
+
+	int maxDepth = 0;
+	std::vector<std::pair<int, int>> stack;
+	stack.push_back({ parentNode.node.leftChild - currentBVHSize, 1 });
+	stack.push_back({ parentNode.node.rightChild - currentBVHSize, 1 });
+	while (!stack.empty())
+	{
+		auto [nodeIndex, depth] = stack.back();
+		stack.pop_back();
+
+		maxDepth = std::max(maxDepth, depth);
+
+		const BVHNode& node = nodes[nodeIndex];
+		if (node.leftChild == -1)
+			continue;
+
+		stack.push_back({ node.leftChild, depth + 1 });
+		stack.push_back({ node.rightChild, depth + 1 });
+	}
+
+	return maxDepth;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+struct BVHQualityStats
+{
+	//SAH cost of the whole tree relative to the root's surface area, using the settings' traversal and intersection costs.
+	float sahCost = 0.0f;
+
+	int nodeCount = 0;
+	int leafCount = 0;
+	int maxDepth = 0;
+	int triangleReferences = 0;
+
+	//Summed surface area of the overlap between every pair of siblings, relative to the root's surface area.
+	float siblingOverlap = 0.0f;
+
+	//Number of leaves at each depth, the root is depth 0, and number of leaves holding each triangle count.
+	std::vector<int> depthHistogram;
+	std::vector<int> leafSizeHistogram;
+};
+
+/**
+* Measures the quality of a model's BVH as built by BuildModelBVH. Nodes use the same indexing as the builders, only the parent node's children are offset by currentBVHSize.
+*/
+BVHQualityStats AnalyseBVH(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings);
+
+/**
+* Depth of the deepest leaf, the root is depth 0. Cheaper than AnalyseBVH when only the depth is needed.
+*/
+int GetBVHMaxDepth(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize);
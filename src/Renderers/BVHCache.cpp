@@ -0,0 +1,187 @@
+#include "BVHCache.h"
+
+#include <fstream>
+#include <cstring>
+
+#include "../Useful/MappedFile.h"
+#include "WideBVHBuilder.h"
+
+const char BVH_CACHE_MAGIC[4] = { 'R', 'B', 'V', 'H' };
+const uint32_t BVH_CACHE_VERSION = 4;
+
+struct BVHCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t triangleCount;
+	uint32_t nodeCount;
+	uint32_t sourceVertexCount;
+
+	//Struct sizes the file was written with, the arrays are stored as raw structs.
+	uint32_t triangleSize;
+	uint32_t nodeSize;
+	uint32_t parentNodeSize;
+
+	//Parameters the auto-tuner picked for the model, only valid if tuned is set.
+	uint32_t tuned;
+	int32_t tunedMaxLeafTriangles;
+	int32_t tunedBinCount;
+	float tunedTraversalCost;
+	float tunedIntersectionCost;
+	float tunedNanosecondsPerRay;
+	int32_t tunedCandidateCount;
+};
+
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+	//FNV-1a
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+template<typename T>
+static uint64_t HashValue(uint64_t hash, const T& value)
+{
+	return HashBytes(hash, &value, sizeof(T));
+}
+
+uint64_t HashBVHBuildInputs(const std::string& filePath, const BVHBuildSettings& settings)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	std::ifstream file(filePath, std::ios::binary);
+	char buffer[1 << 16];
+	while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+		hash = HashBytes(hash, buffer, static_cast<size_t>(file.gcount()));
+
+	//Thread counts and cutoffs are left out, every build path produces the same tree regardless of them.
+	hash = HashValue(hash, static_cast<int>(settings.method));
+	hash = HashValue(hash, settings.binCount);
+	hash = HashValue(hash, settings.traversalCost);
+	hash = HashValue(hash, settings.intersectionCost);
+	hash = HashValue(hash, settings.maxLeafTriangles);
+	hash = HashValue(hash, settings.mortonCodeBits);
+	hash = HashValue(hash, settings.plocSearchRadius);
+	hash = HashValue(hash, settings.spatialSplitAlpha);
+	hash = HashValue(hash, settings.spatialSplitBudget);
+	hash = HashValue(hash, settings.optimizeTreelets);
+	hash = HashValue(hash, settings.treeletLeafCount);
+	hash = HashValue(hash, settings.treeletPasses);
+	hash = HashValue(hash, settings.treeletTimeBudget);
+	hash = HashValue(hash, static_cast<int>(settings.nodeLayout));
+	hash = HashValue(hash, settings.preSplitTriangles);
+	hash = HashValue(hash, settings.preSplitThreshold);
+	hash = HashValue(hash, settings.preSplitBudget);
+
+	//A tuned build overrides the leaf size, costs and bin count, but which values win depends on the traversal that is timed.
+	hash = HashValue(hash, settings.autoTuneBVHs);
+	if (settings.autoTuneBVHs)
+	{
+		hash = HashValue(hash, settings.autoTuneRayCount);
+		hash = HashValue(hash, settings.stacklessTraversal);
+		hash = HashValue(hash, GetEffectiveBVHWidth(settings));
+	}
+	return hash;
+}
+
+bool LoadCachedBVH(const std::string& cachePath, uint64_t key, std::vector<Triangle>& outTriangles, std::vector<BVHNode>& outNodes, ParentBVHNode& outParentNode, int& outSourceVertexCount, int currentBVHSize,
+	BVHTuningResult* outTuning)
+{
+	MappedFile file(cachePath);
+	if (file.GetData() == nullptr || file.GetSize() < sizeof(BVHCacheHeader))
+		return false;
+
+	const char* data = static_cast<const char*>(file.GetData());
+
+	BVHCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != BVH_CACHE_VERSION || header.key != key)
+		return false;
+
+	if (header.triangleSize != sizeof(Triangle) || header.nodeSize != sizeof(BVHNode) || header.parentNodeSize != sizeof(ParentBVHNode))
+		return false;
+
+	size_t trianglesOffset = sizeof(BVHCacheHeader);
+	size_t parentOffset = trianglesOffset + sizeof(Triangle) * header.triangleCount;
+	size_t nodesOffset = parentOffset + sizeof(ParentBVHNode);
+	size_t fileSize = nodesOffset + sizeof(BVHNode) * header.nodeCount;
+	if (file.GetSize() != fileSize)
+		return false;
+
+	ParentBVHNode cachedParent;
+	memcpy(&cachedParent, data + parentOffset, sizeof(cachedParent));
+
+	//Child indices are stored relative to the model, the root's children are rebased onto the current scene.
+	if (cachedParent.node.leftChild != -1)
+	{
+		cachedParent.node.leftChild += currentBVHSize;
+		cachedParent.node.rightChild += currentBVHSize;
+	}
+
+	outTriangles.resize(header.triangleCount);
+	memcpy(outTriangles.data(), data + trianglesOffset, sizeof(Triangle) * header.triangleCount);
+
+	outNodes.resize(header.nodeCount);
+	memcpy(outNodes.data(), data + nodesOffset, sizeof(BVHNode) * header.nodeCount);
+
+	outParentNode = cachedParent;
+	outSourceVertexCount = static_cast<int>(header.sourceVertexCount);
+
+	if (outTuning != nullptr && header.tuned != 0)
+	{
+		outTuning->maxLeafTriangles = header.tunedMaxLeafTriangles;
+		outTuning->binCount = header.tunedBinCount;
+		outTuning->traversalCost = header.tunedTraversalCost;
+		outTuning->intersectionCost = header.tunedIntersectionCost;
+		outTuning->nanosecondsPerRay = header.tunedNanosecondsPerRay;
+		outTuning->candidateCount = header.tunedCandidateCount;
+	}
+	return true;
+}
+
+void SaveCachedBVH(const std::string& cachePath, uint64_t key, const std::vector<Triangle>& triangles, const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int sourceVertexCount, int currentBVHSize,
+	const BVHTuningResult* tuning)
+{
+	std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return;
+
+	BVHCacheHeader header;
+	memcpy(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = BVH_CACHE_VERSION;
+	header.key = key;
+	header.triangleCount = static_cast<uint32_t>(triangles.size());
+	header.nodeCount = static_cast<uint32_t>(nodes.size());
+	header.sourceVertexCount = static_cast<uint32_t>(sourceVertexCount);
+	header.triangleSize = sizeof(Triangle);
+	header.nodeSize = sizeof(BVHNode);
+	header.parentNodeSize = sizeof(ParentBVHNode);
+
+	BVHTuningResult tuningResult = tuning != nullptr ? *tuning : BVHTuningResult();
+	header.tuned = tuning != nullptr ? 1 : 0;
+	header.tunedMaxLeafTriangles = tuningResult.maxLeafTriangles;
+	header.tunedBinCount = tuningResult.binCount;
+	header.tunedTraversalCost = tuningResult.traversalCost;
+	header.tunedIntersectionCost = tuningResult.intersectionCost;
+	header.tunedNanosecondsPerRay = tuningResult.nanosecondsPerRay;
+	header.tunedCandidateCount = tuningResult.candidateCount;
+
+	ParentBVHNode localParent = parentNode;
+	if (localParent.node.leftChild != -1)
+	{
+		localParent.node.leftChild -= currentBVHSize;
+		localParent.node.rightChild -= currentBVHSize;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(triangles.data()), sizeof(Triangle) * triangles.size());
+	file.write(reinterpret_cast<const char*>(&localParent), sizeof(localParent));
+	file.write(reinterpret_cast<const char*>(nodes.data()), sizeof(BVHNode) * nodes.size());
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+#include "BVHTuner.h"
+
+/**
+* Hashes the contents of a model file together with every build setting that changes the tree it produces.
+*/
+uint64_t HashBVHBuildInputs(const std::string& filePath, const BVHBuildSettings& settings);
+
+/**
+* Loads a model written by SaveCachedBVH by memory mapping the cache file. Outputs the reordered triangles, the BVH nodes, the root and the
+* vertex count of the source mesh, so the model file does not need to be parsed again.
+* If the model was auto-tuned and outTuning is given, the parameters it was built with are written to it as well.
+* Returns false and leaves the outputs untouched if the file is missing, was written for a different key or is from another format version.
+*/
+bool LoadCachedBVH(const std::string& cachePath, uint64_t key, std::vector<Triangle>& outTriangles, std::vector<BVHNode>& outNodes, ParentBVHNode& outParentNode, int& outSourceVertexCount, int currentBVHSize,
+	BVHTuningResult* outTuning = nullptr);
+
+/**
+* Writes a built model's triangles and BVH to disk, along with the auto-tuner's choice if the model was tuned.
+* Failing to write the cache is not an error, the model is simply rebuilt next time.
+*/
+void SaveCachedBVH(const std::string& cachePath, uint64_t key, const std::vector<Triangle>& triangles, const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int sourceVertexCount, int currentBVHSize,
+	const BVHTuningResult* tuning = nullptr);
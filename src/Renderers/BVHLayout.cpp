@@ -0,0 +1,157 @@
+#include "BVHLayout.h"
+
+#include <algorithm>
+
+struct LayoutTree
+{
+	//Index 0 is the root, node i + 1 is nodes[i]. -1 marks a missing child.
+	std::vector<int> leftChildren;
+	std::vector<int> rightChildren;
+	std::vector<int> heights;
+};
+
+static LayoutTree BuildLayoutTree(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize)
+{
+	LayoutTree tree;
+	tree.leftChildren.resize(nodes.size() + 1);
+	tree.rightChildren.resize(nodes.size() + 1);
+	tree.heights.assign(nodes.size() + 1, 1);
+
+	//Only the parent node's children are offset by currentBVHSize, the rest are local to the model.
+	auto toTree = [](int child, int offset) { return child == -1 ? -1 : child - offset + 1; };
+
+	tree.leftChildren[0] = toTree(parentNode.node.leftChild, currentBVHSize);
+	tree.rightChildren[0] = toTree(parentNode.node.rightChild, currentBVHSize);
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		tree.leftChildren[i + 1] = toTree(nodes[i].leftChild, 0);
+		tree.rightChildren[i + 1] = toTree(nodes[i].rightChild, 0);
+	}
+
+	//Children come after their parent, so walking backwards sees every child's height before its parent's.
+	for (int i = static_cast<int>(tree.heights.size()) - 1; i >= 0; i--)
+	{
+		int leftHeight = tree.leftChildren[i] != -1 ? tree.heights[tree.leftChildren[i]] : 0;
+		int rightHeight = tree.rightChildren[i] != -1 ? tree.heights[tree.rightChildren[i]] : 0;
+		tree.heights[i] = 1 + std::max(leftHeight, rightHeight);
+	}
+
+	return tree;
+}
+
+static void EmitDepthFirst(const LayoutTree& tree, std::vector<int>& outOrder)
+{
+	std::vector<int> stack;
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		int node = stack.back();
+		stack.pop_back();
+		outOrder.push_back(node);
+
+		if (tree.rightChildren[node] != -1)
+			stack.push_back(tree.rightChildren[node]);
+		if (tree.leftChildren[node] != -1)
+			stack.push_back(tree.leftChildren[node]);
+	}
+}
+
+static void CollectNodesAtDepth(const LayoutTree& tree, int node, int depth, std::vector<int>& outNodes)
+{
+	if (node == -1)
+		return;
+
+	if (depth == 0)
+	{
+		outNodes.push_back(node);
+		return;
+	}
+
+	CollectNodesAtDepth(tree, tree.leftChildren[node], depth - 1, outNodes);
+	CollectNodesAtDepth(tree, tree.rightChildren[node], depth - 1, outNodes);
+}
+
+//Emits the first height levels of the subtree below node.
+static void EmitVanEmdeBoas(const LayoutTree& tree, int node, int height, std::vector<int>& outOrder)
+{
+	if (node == -1)
+		return;
+
+	if (height == 1)
+	{
+		outOrder.push_back(node);
+		return;
+	}
+
+	int topHeight = height / 2;
+	int bottomHeight = height - topHeight;
+
+	EmitVanEmdeBoas(tree, node, topHeight, outOrder);
+
+	std::vector<int> bottomRoots;
+	CollectNodesAtDepth(tree, node, topHeight, bottomRoots);
+	for (int bottomRoot : bottomRoots)
+		EmitVanEmdeBoas(tree, bottomRoot, bottomHeight, outOrder);
+}
+
+void ReorderBVHNodes(std::vector<BVHNode>& nodes, ParentBVHNode& parentNode, int currentBVHSize, BVHNodeLayout layout)
+{
+	if (layout == BVHNodeLayout::Build || nodes.empty())
+		return;
+
+	LayoutTree tree = BuildLayoutTree(nodes, parentNode, currentBVHSize);
+
+	std::vector<int> order;
+	order.reserve(nodes.size() + 1);
+	if (layout == BVHNodeLayout::DepthFirst)
+		EmitDepthFirst(tree, order);
+	else
+		EmitVanEmdeBoas(tree, 0, tree.heights[0], order);
+
+	//Both layouts emit the root first, it lives in the parent node rather than the node array.
+	std::vector<int> newIndices(order.size(), -1);
+	for (size_t i = 1; i < order.size(); i++)
+		newIndices[order[i]] = static_cast<int>(i) - 1;
+
+	auto remap = [&newIndices](int child, int offset) { return child == -1 ? -1 : newIndices[child - offset + 1] + offset; };
+
+	std::vector<BVHNode> reordered(nodes.size());
+	for (size_t i = 1; i < order.size(); i++)
+	{
+		BVHNode node = nodes[order[i] - 1];
+		node.leftChild = remap(node.leftChild, 0);
+		node.rightChild = remap(node.rightChild, 0);
+		reordered[i - 1] = node;
+	}
+
+	parentNode.node.leftChild = remap(parentNode.node.leftChild, currentBVHSize);
+	parentNode.node.rightChild = remap(parentNode.node.rightChild, currentBVHSize);
+	nodes.swap(reordered);
+}
+
+PackedBVHNode PackBVHNode(const BVHNode& node)
+{
+	PackedBVHNode packed;
+	packed.min = node.aabb.min;
+	packed.max = node.aabb.max;
+
+	if (node.leftChild == -1)
+	{
+		packed.leftChildOrFirstTriangle = node.triangleStartIndex;
+		packed.rightChildOrTriangleCount = ~node.triangleCount;
+	}
+	else
+	{
+		packed.leftChildOrFirstTriangle = node.leftChild;
+		packed.rightChildOrTriangleCount = node.rightChild;
+	}
+
+	return packed;
+}
+
+void PackBVHNodes(const std::vector<BVHNode>& nodes, std::vector<PackedBVHNode>& outNodes)
+{
+	outNodes.resize(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+		outNodes[i] = PackBVHNode(nodes[i]);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Reorders a model's BVH nodes in memory without changing the tree. Children still come after their parent, so refits and the wide collapse work
+* on the result, but siblings are no longer stored as adjacent pairs.
+* DepthFirst stores each left child directly after its parent. VanEmdeBoas recursively splits the tree in half by height and stores each top
+* half before the subtrees below it, which keeps short paths within a few cache lines for any line size.
+*/
+void ReorderBVHNodes(std::vector<BVHNode>& nodes, ParentBVHNode& parentNode, int currentBVHSize, BVHNodeLayout layout);
+
+/**
+* Converts a node to the packed format the GPU reads. Child indices are copied unchanged, so packed nodes keep the indexing of the input.
+*/
+PackedBVHNode PackBVHNode(const BVHNode& node);
+void PackBVHNodes(const std::vector<BVHNode>& nodes, std::vector<PackedBVHNode>& outNodes);
@@ -0,0 +1,336 @@
+#include "BVHTraversal.h"
+#include "BVHLayout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+static const int TRAVERSAL_STACK_SIZE = 64;
+
+static float IntersectAABB(const AABB& aabb, glm::vec3 origin, glm::vec3 inverseDirection, float tMax)
+{
+	glm::vec3 t0 = (aabb.min - origin) * inverseDirection;
+	glm::vec3 t1 = (aabb.max - origin) * inverseDirection;
+
+	float tNear = std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)), std::min(t0.z, t1.z));
+	float tFar = std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::max(t0.z, t1.z));
+
+	if (tFar < std::max(tNear, 0.0f) || tNear > tMax)
+		return FLT_MAX;
+
+	return tNear;
+}
+
+bool IntersectTriangle(const Triangle& triangle, const BVHRay& ray, float tMax, BVHRayHit& outHit)
+{
+	//Möller-Trumbore, matching the compute shader.
+	glm::vec3 edge1 = triangle.v1 - triangle.v0;
+	glm::vec3 edge2 = triangle.v2 - triangle.v0;
+
+	glm::vec3 p = glm::cross(ray.direction, edge2);
+	float determinant = glm::dot(edge1, p);
+	if (std::abs(determinant) < 1e-8f)
+		return false;
+
+	float inverseDeterminant = 1.0f / determinant;
+	glm::vec3 s = ray.origin - triangle.v0;
+	float u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(ray.direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	float t = glm::dot(edge2, q) * inverseDeterminant;
+	if (t <= 1e-5f || t >= tMax)
+		return false;
+
+	outHit.t = t;
+	outHit.u = u;
+	outHit.v = v;
+	return true;
+}
+
+bool TraceBVH(const std::vector<Triangle>& triangles, const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize,
+	const BVHRay& ray, float tMax, BVHRayHit& outHit)
+{
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	outHit.t = tMax;
+	outHit.triangleIndex = -1;
+
+	if (IntersectAABB(parentNode.node.aabb, ray.origin, inverseDirection, tMax) == FLT_MAX)
+		return false;
+
+	//Node indices on the stack are local to the model, -1 stands for the root which lives in the parent node.
+	auto getNode = [&nodes, &parentNode](int index) -> const BVHNode& { return index == -1 ? parentNode.node : nodes[index]; };
+
+	//Each entry keeps the distance the ray enters the node at, nodes pushed before a closer hit was found are skipped when popped.
+	int stack[TRAVERSAL_STACK_SIZE];
+	float stackEntry[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize] = -1;
+	stackEntry[stackSize++] = 0.0f;
+
+	while (stackSize > 0)
+	{
+		stackSize--;
+		if (stackEntry[stackSize] > outHit.t)
+			continue;
+
+		int nodeIndex = stack[stackSize];
+		BVHNode node = getNode(nodeIndex);
+		if (nodeIndex == -1 && node.leftChild != -1)
+		{
+			node.leftChild -= currentBVHSize;
+			node.rightChild -= currentBVHSize;
+		}
+
+		if (node.leftChild == -1)
+		{
+			for (int i = node.triangleStartIndex; i < node.triangleStartIndex + node.triangleCount; i++)
+			{
+				if (IntersectTriangle(triangles[i], ray, outHit.t, outHit))
+					outHit.triangleIndex = i;
+			}
+			continue;
+		}
+
+		float leftDistance = IntersectAABB(getNode(node.leftChild).aabb, ray.origin, inverseDirection, outHit.t);
+		float rightDistance = IntersectAABB(getNode(node.rightChild).aabb, ray.origin, inverseDirection, outHit.t);
+
+		//Push the further child first so the nearer one is visited next.
+		int nearChild = node.leftChild;
+		int farChild = node.rightChild;
+		if (rightDistance < leftDistance)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(leftDistance, rightDistance);
+		}
+
+		if (rightDistance != FLT_MAX && stackSize < TRAVERSAL_STACK_SIZE)
+		{
+			stack[stackSize] = farChild;
+			stackEntry[stackSize++] = rightDistance;
+		}
+		if (leftDistance != FLT_MAX && stackSize < TRAVERSAL_STACK_SIZE)
+		{
+			stack[stackSize] = nearChild;
+			stackEntry[stackSize++] = leftDistance;
+		}
+	}
+
+	return outHit.triangleIndex != -1;
+}
+
+bool TracePackedBVH(const std::vector<Triangle>& triangles, const std::vector<PackedBVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize,
+	const BVHRay& ray, float tMax, BVHRayHit& outHit)
+{
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	outHit.t = tMax;
+	outHit.triangleIndex = -1;
+
+	if (IntersectAABB(parentNode.node.aabb, ray.origin, inverseDirection, tMax) == FLT_MAX)
+		return false;
+
+	//The root is packed on the fly with its children made local like every other node's.
+	BVHNode rootNode = parentNode.node;
+	if (rootNode.leftChild != -1)
+	{
+		rootNode.leftChild -= currentBVHSize;
+		rootNode.rightChild -= currentBVHSize;
+	}
+	const PackedBVHNode root = PackBVHNode(rootNode);
+
+	auto intersectNode = [&](int index)
+		{
+			AABB aabb;
+			aabb.min = nodes[index].min;
+			aabb.max = nodes[index].max;
+			return IntersectAABB(aabb, ray.origin, inverseDirection, outHit.t);
+		};
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	float stackEntry[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize] = -1;
+	stackEntry[stackSize++] = 0.0f;
+
+	while (stackSize > 0)
+	{
+		stackSize--;
+		if (stackEntry[stackSize] > outHit.t)
+			continue;
+
+		int nodeIndex = stack[stackSize];
+		const PackedBVHNode& node = nodeIndex == -1 ? root : nodes[nodeIndex];
+
+		if (node.IsLeaf())
+		{
+			int first = node.leftChildOrFirstTriangle;
+			for (int i = first; i < first + node.GetTriangleCount(); i++)
+			{
+				if (IntersectTriangle(triangles[i], ray, outHit.t, outHit))
+					outHit.triangleIndex = i;
+			}
+			continue;
+		}
+
+		int nearChild = node.leftChildOrFirstTriangle;
+		int farChild = node.rightChildOrTriangleCount;
+		float nearDistance = intersectNode(nearChild);
+		float farDistance = intersectNode(farChild);
+		if (farDistance < nearDistance)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(nearDistance, farDistance);
+		}
+
+		if (farDistance != FLT_MAX && stackSize < TRAVERSAL_STACK_SIZE)
+		{
+			stack[stackSize] = farChild;
+			stackEntry[stackSize++] = farDistance;
+		}
+		if (nearDistance != FLT_MAX && stackSize < TRAVERSAL_STACK_SIZE)
+		{
+			stack[stackSize] = nearChild;
+			stackEntry[stackSize++] = nearDistance;
+		}
+	}
+
+	return outHit.triangleIndex != -1;
+}
+
+void BuildBVHMissLinks(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize, std::vector<int>& outMissLinks)
+{
+	outMissLinks.assign(nodes.size(), -1);
+	if (parentNode.node.leftChild == -1)
+		return;
+
+	outMissLinks[parentNode.node.leftChild - currentBVHSize] = parentNode.node.rightChild - currentBVHSize;
+
+	//Children come after their parent, so every parent's link is known before its children's are set.
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		const BVHNode& node = nodes[i];
+		if (node.leftChild == -1)
+			continue;
+
+		outMissLinks[node.leftChild] = node.rightChild;
+		outMissLinks[node.rightChild] = outMissLinks[i];
+	}
+}
+
+bool TraceBVHStackless(const std::vector<Triangle>& triangles, const std::vector<BVHNode>& nodes, const std::vector<int>& missLinks,
+	const ParentBVHNode& parentNode, int currentBVHSize, const BVHRay& ray, float tMax, BVHRayHit& outHit)
+{
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	outHit.t = tMax;
+	outHit.triangleIndex = -1;
+
+	if (IntersectAABB(parentNode.node.aabb, ray.origin, inverseDirection, tMax) == FLT_MAX)
+		return false;
+
+	if (parentNode.node.leftChild == -1)
+	{
+		for (int i = parentNode.node.triangleStartIndex; i < parentNode.node.triangleStartIndex + parentNode.node.triangleCount; i++)
+		{
+			if (IntersectTriangle(triangles[i], ray, outHit.t, outHit))
+				outHit.triangleIndex = i;
+		}
+		return outHit.triangleIndex != -1;
+	}
+
+	int nodeIndex = parentNode.node.leftChild - currentBVHSize;
+	while (nodeIndex != -1)
+	{
+		const BVHNode& node = nodes[nodeIndex];
+		if (IntersectAABB(node.aabb, ray.origin, inverseDirection, outHit.t) == FLT_MAX)
+		{
+			nodeIndex = missLinks[nodeIndex];
+			continue;
+		}
+
+		if (node.leftChild != -1)
+		{
+			nodeIndex = node.leftChild;
+			continue;
+		}
+
+		for (int i = node.triangleStartIndex; i < node.triangleStartIndex + node.triangleCount; i++)
+		{
+			if (IntersectTriangle(triangles[i], ray, outHit.t, outHit))
+				outHit.triangleIndex = i;
+		}
+		nodeIndex = missLinks[nodeIndex];
+	}
+
+	return outHit.triangleIndex != -1;
+}
+
+bool TraceWideBVH(const std::vector<Triangle>& triangles, const std::vector<WideBVHChild>& children, int width, int rootIndex, const AABB& rootBounds,
+	const BVHRay& ray, float tMax, BVHRayHit& outHit)
+{
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	outHit.t = tMax;
+	outHit.triangleIndex = -1;
+
+	if (IntersectAABB(rootBounds, ray.origin, inverseDirection, tMax) == FLT_MAX)
+		return false;
+
+	int stack[WIDE_BVH_TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = rootIndex;
+
+	while (stackSize > 0)
+	{
+		const WideBVHChild* node = &children[stack[--stackSize] * width];
+		for (int c = 0; c < width && node[c].index != -1; c++)
+		{
+			AABB childBounds;
+			childBounds.min = node[c].min;
+			childBounds.max = node[c].max;
+			if (IntersectAABB(childBounds, ray.origin, inverseDirection, outHit.t) == FLT_MAX)
+				continue;
+
+			if (node[c].triangleCount == 0)
+			{
+				stack[stackSize++] = node[c].index;
+				continue;
+			}
+
+			for (int i = node[c].index; i < node[c].index + node[c].triangleCount; i++)
+			{
+				if (IntersectTriangle(triangles[i], ray, outHit.t, outHit))
+					outHit.triangleIndex = i;
+			}
+		}
+	}
+
+	return outHit.triangleIndex != -1;
+}
+
+std::vector<BVHRay> GenerateSampleRays(const AABB& bounds, int rayCount, unsigned int seed)
+{
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+
+	glm::vec3 centre = (bounds.min + bounds.max) * 0.5f;
+	glm::vec3 extents = bounds.max - bounds.min;
+	float radius = glm::length(extents);
+
+	std::vector<BVHRay> rays(rayCount);
+	for (BVHRay& ray : rays)
+	{
+		float z = distribution(generator) * 2.0f - 1.0f;
+		float angle = distribution(generator) * 6.2831853f;
+		float ringRadius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		ray.origin = centre + glm::vec3(ringRadius * std::cos(angle), ringRadius * std::sin(angle), z) * radius;
+
+		glm::vec3 target = bounds.min + glm::vec3(distribution(generator), distribution(generator), distribution(generator)) * extents;
+		ray.direction = glm::normalize(target - ray.origin);
+	}
+
+	return rays;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+struct BVHRay
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+};
+
+struct BVHRayHit
+{
+	float t = FLT_MAX;
+	int triangleIndex = -1;
+
+	//Barycentric coordinates of the hit, weights of v1 and v2.
+	float u = 0.0f;
+	float v = 0.0f;
+};
+
+/**
+* Möller-Trumbore test of a single triangle, matching the compute shader. Only fills in outHit if the hit is closer than tMax, the triangle index is left to the caller.
+*/
+bool IntersectTriangle(const Triangle& triangle, const BVHRay& ray, float tMax, BVHRayHit& outHit);
+
+/**
+* Finds the closest triangle a ray hits in a model's binary BVH on the CPU, the same way the compute shader walks it.
+* Nodes use the same indexing as the builders, only the parent node's children are offset by currentBVHSize. Returns false if nothing is hit closer than tMax.
+*/
+bool TraceBVH(const std::vector<Triangle>& triangles, const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize,
+	const BVHRay& ray, float tMax, BVHRayHit& outHit);
+
+/**
+* TraceBVH over nodes converted with PackBVHNodes, reading each node from one 32 byte record the way the compute shader does.
+*/
+bool TracePackedBVH(const std::vector<Triangle>& triangles, const std::vector<PackedBVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize,
+	const BVHRay& ray, float tMax, BVHRayHit& outHit);
+
+/**
+* Escape links for stackless traversal. outMissLinks[i] is the node to continue from once nodes[i] has been missed or its leaf tested,
+* its right sibling if it is a left child and its parent's link otherwise. -1 ends the traversal. Links are local to the model like the
+* nodes' children, and stay valid through refits as they only depend on the topology.
+*/
+void BuildBVHMissLinks(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize, std::vector<int>& outMissLinks);
+
+/**
+* TraceBVH without a stack, following each node's left child on a hit and its escape link on a miss. Children are always visited left
+* first, so it tests more nodes than the stack traversal but needs no per ray storage and has no depth limit.
+*/
+bool TraceBVHStackless(const std::vector<Triangle>& triangles, const std::vector<BVHNode>& nodes, const std::vector<int>& missLinks,
+	const ParentBVHNode& parentNode, int currentBVHSize, const BVHRay& ray, float tMax, BVHRayHit& outHit);
+
+/**
+* Walks a model's wide BVH from CollapseToWideBVH like the compute shader's wide traversal, testing each node's children in slot order and
+* visiting the internal ones last pushed first. Child indices and triangle starts are local to the model. The stack holds
+* WIDE_BVH_TRAVERSAL_STACK_SIZE entries like the shader's, so the tree's GetWideBVHStackSize must not exceed it.
+*/
+bool TraceWideBVH(const std::vector<Triangle>& triangles, const std::vector<WideBVHChild>& children, int width, int rootIndex, const AABB& rootBounds,
+	const BVHRay& ray, float tMax, BVHRayHit& outHit);
+
+/**
+* Rays that start on a sphere around the bounds and aim at random points inside them, so most of them reach the model from every side.
+* The same seed always gives the same rays, which makes timings of different trees over the same model comparable.
+*/
+std::vector<BVHRay> GenerateSampleRays(const AABB& bounds, int rayCount, unsigned int seed);
@@ -0,0 +1,138 @@
+#include "BVHTuner.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "ModelLoader.h"
+#include "BVHTraversal.h"
+#include "BVHAnalysis.h"
+#include "WideBVHBuilder.h"
+
+static const int TUNED_LEAF_SIZES[] = { 1, 2, 4, 8 };
+static const float TUNED_COST_RATIOS[] = { 0.5f, 1.0f, 2.0f, 4.0f };
+static const int TUNED_BIN_COUNTS[] = { 8, 16, 32 };
+
+//Each candidate is timed this many times and keeps its fastest pass, which filters out most scheduling noise.
+static const int TUNING_REPEATS = 3;
+static const unsigned int TUNING_RAY_SEED = 1234;
+
+static bool MethodUsesSAH(BVHBuildMethod method)
+{
+	return method == BVHBuildMethod::SAH || method == BVHBuildMethod::SBVH || method == BVHBuildMethod::IndexedSAH;
+}
+
+static float TimeCandidate(const std::vector<Triangle>& sourceTriangles, const AABB& bounds, const BVHBuildSettings& candidate, const std::vector<BVHRay>& rays)
+{
+	std::vector<Triangle> triangles = sourceTriangles;
+	std::vector<BVHNode> nodes;
+
+	ParentBVHNode parentNode;
+	parentNode.node.aabb = bounds;
+	parentNode.objectIndex = -1;
+	parentNode.node.leftChild = -1;
+	parentNode.node.rightChild = -1;
+	parentNode.node.triangleStartIndex = 0;
+	parentNode.node.triangleCount = static_cast<int>(triangles.size());
+
+	BuildModelBVH(triangles, nodes, parentNode, 0, candidate);
+
+	//Time the traversal the GPU will use. Wide trees the shader's stack can't hold and binary trees too deep for its ordered stack fall back
+	//the same way they do when the model is loaded.
+	int width = GetEffectiveBVHWidth(candidate);
+	std::vector<WideBVHChild> wideChildren;
+	int wideRootIndex = -1;
+	if (width > 2)
+	{
+		std::vector<int> wideSourceNodes;
+		wideRootIndex = CollapseToWideBVH(nodes, parentNode, 0, width, wideChildren, wideSourceNodes);
+		if (wideRootIndex != -1 && GetWideBVHStackSize(wideChildren, width, wideRootIndex) > WIDE_BVH_TRAVERSAL_STACK_SIZE)
+			wideRootIndex = -1;
+	}
+
+	bool stackless = wideRootIndex == -1 && ((candidate.stacklessTraversal && width == 2) || GetBVHMaxDepth(nodes, parentNode, 0) >= BLAS_TRAVERSAL_STACK_SIZE);
+	std::vector<int> missLinks;
+	if (stackless)
+		BuildBVHMissLinks(nodes, parentNode, 0, missLinks);
+
+	double bestTime = DBL_MAX;
+	for (int repeat = 0; repeat < TUNING_REPEATS; repeat++)
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (const BVHRay& ray : rays)
+		{
+			BVHRayHit hit;
+			if (wideRootIndex != -1)
+				TraceWideBVH(triangles, wideChildren, width, wideRootIndex, parentNode.node.aabb, ray, FLT_MAX, hit);
+			else if (stackless)
+				TraceBVHStackless(triangles, nodes, missLinks, parentNode, 0, ray, FLT_MAX, hit);
+			else
+				TraceBVH(triangles, nodes, parentNode, 0, ray, FLT_MAX, hit);
+		}
+		std::chrono::duration<double, std::nano> traceTime = std::chrono::high_resolution_clock::now() - startTime;
+		bestTime = std::min(bestTime, traceTime.count());
+	}
+
+	return static_cast<float>(bestTime / std::max<size_t>(rays.size(), 1));
+}
+
+BVHTuningResult TuneBVHBuildSettings(const std::vector<Triangle>& triangles, const AABB& bounds, const BVHBuildSettings& settings)
+{
+	BVHTuningResult best;
+	best.maxLeafTriangles = settings.maxLeafTriangles;
+	best.binCount = settings.binCount;
+	best.traversalCost = settings.traversalCost;
+	best.intersectionCost = settings.intersectionCost;
+	best.nanosecondsPerRay = FLT_MAX;
+
+	if (triangles.empty())
+		return best;
+
+	std::vector<BVHRay> rays = GenerateSampleRays(bounds, std::max(settings.autoTuneRayCount, 1), TUNING_RAY_SEED);
+
+	//The cost ratio and bin count only matter to the SAH builders, the others keep the configured values and only sweep the leaf size.
+	std::vector<float> costRatios = { settings.traversalCost / settings.intersectionCost };
+	std::vector<int> binCounts = { settings.binCount };
+	if (MethodUsesSAH(settings.method))
+	{
+		costRatios.assign(std::begin(TUNED_COST_RATIOS), std::end(TUNED_COST_RATIOS));
+		binCounts.assign(std::begin(TUNED_BIN_COUNTS), std::end(TUNED_BIN_COUNTS));
+	}
+
+	BVHBuildSettings candidate = settings;
+	candidate.optimizeTreelets = false;
+
+	for (int leafSize : TUNED_LEAF_SIZES)
+	{
+		for (float costRatio : costRatios)
+		{
+			for (int binCount : binCounts)
+			{
+				candidate.maxLeafTriangles = leafSize;
+				candidate.traversalCost = costRatio * settings.intersectionCost;
+				candidate.binCount = binCount;
+
+				float nanosecondsPerRay = TimeCandidate(triangles, bounds, candidate, rays);
+				best.candidateCount++;
+
+				if (nanosecondsPerRay < best.nanosecondsPerRay)
+				{
+					best.maxLeafTriangles = candidate.maxLeafTriangles;
+					best.binCount = candidate.binCount;
+					best.traversalCost = candidate.traversalCost;
+					best.intersectionCost = candidate.intersectionCost;
+					best.nanosecondsPerRay = nanosecondsPerRay;
+				}
+			}
+		}
+	}
+
+	return best;
+}
+
+void ApplyBVHTuning(const BVHTuningResult& tuning, BVHBuildSettings& settings)
+{
+	settings.maxLeafTriangles = tuning.maxLeafTriangles;
+	settings.binCount = tuning.binCount;
+	settings.traversalCost = tuning.traversalCost;
+	settings.intersectionCost = tuning.intersectionCost;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Build parameters the auto-tuner picked for one model. They replace the matching BVHBuildSettings fields when that model is built.
+*/
+struct BVHTuningResult
+{
+	int maxLeafTriangles = 2;
+	int binCount = 16;
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.0f;
+
+	//Measured CPU traversal time of the winning tree, and how many candidate trees were built and timed.
+	float nanosecondsPerRay = 0.0f;
+	int candidateCount = 0;
+};
+
+/**
+* Builds the model once for every combination of leaf size, traversal to intersection cost ratio and bin count, traces settings.autoTuneRayCount
+* sample rays through each tree on the CPU and returns the parameters of the fastest. Only parameters the build method uses are swept.
+* Candidates are built without treelet optimization to keep tuning time bounded, the final build applies it on top of the winner.
+* Each candidate is timed with the traversal the renderer will give it, wide BVHs are collapsed and walked wide.
+*/
+BVHTuningResult TuneBVHBuildSettings(const std::vector<Triangle>& triangles, const AABB& bounds, const BVHBuildSettings& settings);
+
+void ApplyBVHTuning(const BVHTuningResult& tuning, BVHBuildSettings& settings);
@@ -0,0 +1,823 @@
+#include "CPURaytracer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "BVHTraversal.h"
+#include "WideBVHBuilder.h"
+
+static const int TILE_SIZE = 16;
+
+struct Interval
+{
+	float min;
+	float max;
+};
+
+struct RayHit
+{
+	glm::vec3 point = glm::vec3(0.0f);
+	glm::vec3 normal = glm::vec3(0.0f);
+	int matIndex = 0;
+	float t = 0.0f;
+	bool frontFace = false;
+	bool hitObject = false;
+};
+
+struct InstanceTransform
+{
+	glm::mat4 objectTransform;
+	glm::mat3 normalMatrix;
+};
+
+struct FrameContext
+{
+	const CPURaytracerScene& scene;
+	const RaytracePushConstants& constants;
+	const std::vector<InstanceTransform>& transforms;
+
+	int width;
+	glm::vec4* accumulation;
+	glm::vec4* output;
+};
+
+//Random numbers, matching Random.glsl. Where the shader passes a seed by value it is copied here too, so each pixel draws the same sequence
+//as on the GPU. GLSL evaluates arguments left to right, calls that draw several numbers are split into statements to keep that order.
+
+static float RandomSeed(uint32_t& seed)
+{
+	seed = (seed ^ 61) ^ (seed >> 16);
+	seed *= 9;
+	seed = seed ^ (seed >> 4);
+	seed *= 0x27d4eb2d;
+	seed = seed ^ (seed >> 15);
+	return static_cast<float>(seed % 10000) / 10000.0f;
+}
+
+static float RandomFloatInRange(float min, float max, uint32_t& seed)
+{
+	seed += 1u;
+	return glm::mix(min, max, RandomSeed(seed));
+}
+
+static uint32_t SeedFromCoords(uint32_t x, uint32_t y, uint32_t frame, uint32_t i)
+{
+	uint32_t seed = x * 374761393u + y * 668265263u + frame * 1442695040u + i * 88963407u;
+	seed = (seed ^ (seed >> 16)) * 0x85ebca6b;
+	seed = (seed ^ (seed >> 13)) * 0xc2b2ae35;
+	seed = seed ^ (seed >> 16);
+	return seed;
+}
+
+static glm::vec3 SampleSquare(uint32_t& seed)
+{
+	seed += 1u;
+	float x = RandomFloatInRange(0.0f, 1.0f, seed);
+	float y = RandomFloatInRange(0.0f, 1.0f, seed);
+	return glm::vec3(x - 0.5f, y - 0.5f, 0.0f);
+}
+
+static glm::vec3 RandomInUnitDisk(uint32_t& seed)
+{
+	seed += 1u;
+	while (true)
+	{
+		float x = RandomFloatInRange(-1.0f, 1.0f, seed);
+		float y = RandomFloatInRange(-1.0f, 1.0f, seed);
+		glm::vec3 p(x, y, 0.0f);
+		if (std::sqrt(glm::length(p)) < 1.0f)
+			return p;
+	}
+}
+
+static glm::vec3 RandomVector(uint32_t& seed)
+{
+	seed += 1u;
+	float x = RandomFloatInRange(-1.0f, 1.0f, seed);
+	float y = RandomFloatInRange(-1.0f, 1.0f, seed);
+	float z = RandomFloatInRange(-1.0f, 1.0f, seed);
+	return glm::vec3(x, y, z);
+}
+
+static glm::vec3 RandomUnitVector(uint32_t& seed)
+{
+	seed += 1u;
+	while (true)
+	{
+		glm::vec3 p = RandomVector(seed);
+		float lengthSquared = glm::length(p) * glm::length(p);
+		if (lengthSquared > 0.0f && lengthSquared <= 1.0f)
+			return p / std::sqrt(lengthSquared);
+	}
+}
+
+static glm::vec3 RandomOnHemisphere(glm::vec3 normal, uint32_t& seed)
+{
+	seed += 1u;
+	glm::vec3 onUnitSphere = RandomUnitVector(seed);
+	return glm::dot(onUnitSphere, normal) > 0.0f ? onUnitSphere : -onUnitSphere;
+}
+
+static bool IntersectAABB(const BVHRay& ray, glm::vec3 boxMin, glm::vec3 boxMax, Interval& t)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		float originA = ray.origin[a];
+		float dirA = ray.direction[a];
+
+		//Parallel to the slab, only a miss if the origin is outside it.
+		if (std::abs(dirA) < 1e-8f)
+		{
+			if (originA < boxMin[a] || originA > boxMax[a])
+				return false;
+			continue;
+		}
+
+		float invD = 1.0f / dirA;
+		float t0 = (boxMin[a] - originA) * invD;
+		float t1 = (boxMax[a] - originA) * invD;
+		if (invD < 0.0f)
+			std::swap(t0, t1);
+
+		t.min = std::max(t.min, t0);
+		t.max = std::min(t.max, t1);
+		if (t.max <= t.min)
+			return false;
+	}
+
+	return true;
+}
+
+static bool IntersectTriangle(const CPURaytracerScene& scene, const BVHRay& ray, int triIndex, Interval t, RayHit& rec)
+{
+	glm::vec3 triV0 = glm::vec3(scene.triangleV0s[triIndex]);
+	glm::vec3 triV1 = glm::vec3(scene.triangleV1s[triIndex]);
+	glm::vec3 triV2 = glm::vec3(scene.triangleV2s[triIndex]);
+
+	glm::vec3 edge1 = triV1 - triV0;
+	glm::vec3 edge2 = triV2 - triV0;
+	glm::vec3 h = glm::cross(ray.direction, edge2);
+	float a = glm::dot(edge1, h);
+	const float eps = 1e-5f;
+	if (std::abs(a) < eps)
+		return false;
+
+	float invDet = 1.0f / a;
+	glm::vec3 s = ray.origin - triV0;
+	float u = invDet * glm::dot(s, h);
+
+	glm::vec3 sCross = glm::cross(s, edge1);
+	float v = invDet * glm::dot(ray.direction, sCross);
+	if (u < -eps || u > 1.0f + eps)
+		return false;
+	if (v < -eps || u + v > 1.0f + eps)
+		return false;
+
+	float hitT = invDet * glm::dot(edge2, sCross);
+	if (hitT < t.min || hitT > t.max || hitT <= eps)
+		return false;
+
+	rec.t = hitT;
+	rec.point = ray.origin + hitT * ray.direction;
+
+	float w = 1.0f - u - v;
+	glm::vec3 interpolatedNormal = glm::normalize(glm::vec3(scene.triangleN0s[triIndex]) * w + glm::vec3(scene.triangleN1s[triIndex]) * u + glm::vec3(scene.triangleN2s[triIndex]) * v);
+
+	rec.frontFace = glm::dot(ray.direction, interpolatedNormal) < 0.0f;
+	rec.normal = rec.frontFace ? interpolatedNormal : -interpolatedNormal;
+	rec.hitObject = true;
+	return true;
+}
+
+static float Reflectance(float cosine, float refIdx)
+{
+	//Schlick's approximation.
+	float r0 = (1.0f - refIdx) / (1.0f + refIdx);
+	r0 = r0 * r0;
+	return r0 + (1.0f - r0) * std::pow(1.0f - cosine, 5.0f);
+}
+
+static bool DielectricScatter(const FrameContext& context, const BVHRay& rayIn, const RayHit& rec, float refIdx, glm::vec3& attenuation, BVHRay& scattered, uint32_t seed)
+{
+	const GPUMaterial& targetMat = context.scene.materials[rec.matIndex];
+	attenuation = targetMat.albedo * glm::exp(-targetMat.absorbtion * rec.t);
+	float etaiOverEtat = rec.frontFace ? (1.0f / refIdx) : refIdx;
+	glm::vec3 unitDirection = glm::normalize(rayIn.direction);
+	float cosTheta = std::min(glm::dot(-unitDirection, rec.normal), 1.0f);
+	float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+	bool cannotRefract = etaiOverEtat * sinTheta > 1.0f;
+
+	glm::vec3 direction;
+	if (cannotRefract || Reflectance(cosTheta, refIdx) > RandomFloatInRange(0.0f, 1.0f, seed))
+		direction = glm::reflect(unitDirection, rec.normal);
+	else
+		direction = glm::refract(unitDirection, rec.normal, etaiOverEtat);
+
+	scattered.origin = rec.point;
+	scattered.direction = glm::normalize(direction);
+	return true;
+}
+
+static bool MaterialScatter(const FrameContext& context, const BVHRay& rayIn, const RayHit& rec, glm::vec3& attenuation, BVHRay& scattered, uint32_t seed)
+{
+	float scatterOrReflect = RandomFloatInRange(0.0f, 1.0f, seed);
+	const GPUMaterial& targetMat = context.scene.materials[rec.matIndex];
+
+	if (targetMat.refractiveIndex > 0.0f)
+		return DielectricScatter(context, rayIn, rec, targetMat.refractiveIndex, attenuation, scattered, seed);
+
+	const float EPSILON = 1e-4f;
+
+	if (scatterOrReflect < targetMat.smoothness)
+	{
+		glm::vec3 reflected = glm::reflect(glm::normalize(rayIn.direction), rec.normal);
+		reflected += targetMat.fuzziness * RandomOnHemisphere(rec.normal, seed);
+		scattered.origin = rec.point + reflected * EPSILON;
+		scattered.direction = glm::normalize(reflected);
+	}
+	else
+	{
+		glm::vec3 scatterDirection = rec.normal + RandomUnitVector(seed);
+		if (std::abs(scatterDirection.x) < 1e-8f && std::abs(scatterDirection.y) < 1e-8f && std::abs(scatterDirection.z) < 1e-8f)
+			scatterDirection = rec.normal;
+
+		scattered.origin = rec.point + scatterDirection * EPSILON;
+		scattered.direction = glm::normalize(scatterDirection);
+	}
+
+	attenuation = targetMat.albedo;
+	return true;
+}
+
+static float LinearToGamma(float linearComponent)
+{
+	return linearComponent > 0.0f ? std::sqrt(linearComponent) : 0.0f;
+}
+
+static void IntersectLeafTriangles(const FrameContext& context, const BVHRay& r, const BVHRay& localRay, int triangleStartIndex, int triangleCount, float tMin,
+	float& closestSoFar, float localScale, const InstanceTransform& transform, int materialIndex, RayHit& rec, int& triangleTests)
+{
+	for (int triIndex = triangleStartIndex; triIndex < triangleStartIndex + triangleCount; triIndex++)
+	{
+		triangleTests++;
+
+		RayHit tempRec;
+		if (!IntersectTriangle(context.scene, localRay, triIndex, { tMin * localScale, closestSoFar * localScale }, tempRec))
+			continue;
+
+		glm::vec3 worldPoint = glm::vec3(transform.objectTransform * glm::vec4(tempRec.point, 1.0f));
+		glm::vec3 worldNormal = glm::normalize(transform.normalMatrix * tempRec.normal);
+		float worldT = glm::dot(worldPoint - r.origin, r.direction);
+
+		if (worldT > tMin && worldT < closestSoFar)
+		{
+			closestSoFar = worldT;
+			rec.t = worldT;
+			rec.point = worldPoint;
+			rec.normal = worldNormal;
+			rec.matIndex = materialIndex;
+			rec.frontFace = glm::dot(r.direction, worldNormal) < 0.0f;
+			rec.hitObject = true;
+		}
+	}
+}
+
+//startNode is -1 to traverse the whole BLAS, rebraided top level leaves enter it at one of its nodes instead.
+static void IntersectInstance(const FrameContext& context, const BVHRay& r, int parentIndex, int startNode, float tMin, float& closestSoFar, RayHit& rec,
+	int& triangleTests, int& bvhNodeTests)
+{
+	const CPURaytracerScene& scene = context.scene;
+	const ParentBVHNode& targetBVH = scene.parentBVH[parentIndex];
+	const GPUObject& targetObject = scene.objects[targetBVH.objectIndex];
+	const InstanceTransform& transform = context.transforms[targetBVH.objectIndex];
+
+	glm::vec3 localDirection = glm::vec3(targetObject.inverseTransform * glm::vec4(r.direction, 0.0f));
+
+	BVHRay localRay;
+	localRay.origin = glm::vec3(targetObject.inverseTransform * glm::vec4(r.origin, 1.0f));
+	localRay.direction = glm::normalize(localDirection);
+
+	//Distances along the normalized local ray are the world distances scaled by the length of the transformed direction.
+	float localScale = glm::length(localDirection);
+	Interval rootInterval = { tMin * localScale, closestSoFar * localScale };
+
+	bvhNodeTests++;
+
+	bool hitRoot = startNode == -1 ? IntersectAABB(localRay, targetObject.localBounds.min, targetObject.localBounds.max, rootInterval)
+		: IntersectAABB(localRay, scene.bvhNodes[startNode].min, scene.bvhNodes[startNode].max, rootInterval);
+	if (!hitRoot)
+		return;
+
+	//Grid indices are local to the model, the walk's distances are local ones like the BVH's.
+	const TriangleGrid* grid = targetBVH.objectIndex < static_cast<int>(scene.objectGrids.size()) ? scene.objectGrids[targetBVH.objectIndex] : nullptr;
+	if (grid != nullptr)
+	{
+		WalkTriangleGrid(*grid, localRay, closestSoFar * localScale, [&](const int* triangleIndices, int count)
+			{
+				for (int i = 0; i < count; i++)
+				{
+					IntersectLeafTriangles(context, r, localRay, targetObject.triangleStartIndex + triangleIndices[i], 1, tMin, closestSoFar, localScale, transform,
+						targetObject.materialIndex, rec, triangleTests);
+				}
+
+				return closestSoFar * localScale;
+			});
+
+		return;
+	}
+
+	int subtreeLeft = targetBVH.node.leftChild;
+	int subtreeRight = targetBVH.node.rightChild;
+	int subtreeStart = targetBVH.node.triangleStartIndex;
+	int subtreeCount = targetBVH.node.triangleCount;
+	if (startNode != -1)
+	{
+		const PackedBVHNode& startBVHNode = scene.bvhNodes[startNode];
+		subtreeLeft = startBVHNode.IsLeaf() ? -1 : startBVHNode.leftChildOrFirstTriangle;
+		subtreeRight = startBVHNode.IsLeaf() ? -1 : startBVHNode.rightChildOrTriangleCount;
+		subtreeStart = startBVHNode.leftChildOrFirstTriangle;
+		subtreeCount = startBVHNode.GetTriangleCount();
+	}
+
+	if (subtreeLeft == -1)
+	{
+		IntersectLeafTriangles(context, r, localRay, subtreeStart, subtreeCount, tMin, closestSoFar, localScale, transform, targetObject.materialIndex, rec, triangleTests);
+		return;
+	}
+
+	//Wide traversal, each node's children are tested in slot order and the internal ones are pushed, so the last is expanded first.
+	//Only whole instances are traversed this way, and models whose wide tree would overflow the stack were given no wide root.
+	if (scene.bvhWidth > 2 && targetBVH.wideRootIndex != -1 && startNode == -1)
+	{
+		int quantizedNodeWords = scene.bvhQuantizationBits > 0 ? GetQuantizedWideNodeWords(scene.bvhWidth, scene.bvhQuantizationBits) : 0;
+
+		int wideStack[WIDE_BVH_TRAVERSAL_STACK_SIZE];
+		int wideStackPtr = 0;
+		wideStack[wideStackPtr++] = targetBVH.wideRootIndex;
+
+		while (wideStackPtr > 0)
+		{
+			int wideNodeIndex = wideStack[--wideStackPtr];
+			for (int c = 0; c < scene.bvhWidth; c++)
+			{
+				WideBVHChild child = scene.bvhQuantizationBits > 0
+					? DecodeQuantizedWideBVHChild(&scene.quantizedBVHWords[wideNodeIndex * quantizedNodeWords], scene.bvhWidth, scene.bvhQuantizationBits, c)
+					: scene.wideBVHChildren[wideNodeIndex * scene.bvhWidth + c];
+				if (child.index == -1)
+					break;
+
+				bvhNodeTests++;
+
+				Interval childInterval = { tMin * localScale, closestSoFar * localScale };
+				if (!IntersectAABB(localRay, child.min, child.max, childInterval))
+					continue;
+
+				if (child.triangleCount > 0)
+					IntersectLeafTriangles(context, r, localRay, child.index, child.triangleCount, tMin, closestSoFar, localScale, transform, targetObject.materialIndex, rec, triangleTests);
+				else if (wideStackPtr < WIDE_BVH_TRAVERSAL_STACK_SIZE)
+					wideStack[wideStackPtr++] = child.index;
+			}
+		}
+
+		return;
+	}
+
+	//Stackless traversal when the pipeline selects it, or for models deeper than the ordered stack can hold. Hits descend to the left
+	//child and misses follow the escape link.
+	if ((scene.stacklessTraversal && scene.bvhWidth == 2) || targetBVH.maxDepth >= BLAS_TRAVERSAL_STACK_SIZE)
+	{
+		//A subtree's nodes all come before its root's escape link, which is where its traversal ends.
+		int nodeIndex = startNode == -1 ? subtreeLeft : startNode;
+		int endIndex = startNode == -1 ? -1 : scene.bvhMissLinks[startNode];
+		while (nodeIndex != endIndex)
+		{
+			Interval nodeInterval = { tMin * localScale, closestSoFar * localScale };
+
+			bvhNodeTests++;
+
+			const PackedBVHNode& node = scene.bvhNodes[nodeIndex];
+			if (!IntersectAABB(localRay, node.min, node.max, nodeInterval))
+			{
+				nodeIndex = scene.bvhMissLinks[nodeIndex];
+				continue;
+			}
+
+			if (!node.IsLeaf())
+			{
+				nodeIndex = node.leftChildOrFirstTriangle;
+				continue;
+			}
+
+			IntersectLeafTriangles(context, r, localRay, node.leftChildOrFirstTriangle, node.GetTriangleCount(), tMin, closestSoFar, localScale, transform, targetObject.materialIndex, rec, triangleTests);
+			nodeIndex = scene.bvhMissLinks[nodeIndex];
+		}
+
+		return;
+	}
+
+	//Ordered stack traversal, both children are tested when their parent is expanded and the nearer one is popped first.
+	int stack[BLAS_TRAVERSAL_STACK_SIZE];
+	float stackEntry[BLAS_TRAVERSAL_STACK_SIZE];
+	int stackPtr = 0;
+
+	int leftChild = subtreeLeft;
+	int rightChild = subtreeRight;
+	while (leftChild != -1)
+	{
+		Interval leftInterval = { tMin * localScale, closestSoFar * localScale };
+		Interval rightInterval = { tMin * localScale, closestSoFar * localScale };
+
+		bvhNodeTests += 2;
+
+		bool hitLeft = IntersectAABB(localRay, scene.bvhNodes[leftChild].min, scene.bvhNodes[leftChild].max, leftInterval);
+		bool hitRight = IntersectAABB(localRay, scene.bvhNodes[rightChild].min, scene.bvhNodes[rightChild].max, rightInterval);
+
+		int nearChild = leftChild;
+		int farChild = rightChild;
+		float nearEntry = leftInterval.min;
+		float farEntry = rightInterval.min;
+		if (hitLeft && hitRight && rightInterval.min < leftInterval.min)
+		{
+			nearChild = rightChild;
+			farChild = leftChild;
+			nearEntry = rightInterval.min;
+			farEntry = leftInterval.min;
+		}
+		else if (!hitLeft)
+		{
+			nearChild = hitRight ? rightChild : -1;
+			nearEntry = rightInterval.min;
+			farChild = -1;
+		}
+		else if (!hitRight)
+		{
+			farChild = -1;
+		}
+
+		if (farChild != -1 && stackPtr < BLAS_TRAVERSAL_STACK_SIZE)
+		{
+			stack[stackPtr] = farChild;
+			stackEntry[stackPtr++] = farEntry;
+		}
+		if (nearChild != -1 && stackPtr < BLAS_TRAVERSAL_STACK_SIZE)
+		{
+			stack[stackPtr] = nearChild;
+			stackEntry[stackPtr++] = nearEntry;
+		}
+
+		//Pop until an internal node is found to expand, testing leaves along the way.
+		leftChild = -1;
+		while (stackPtr > 0)
+		{
+			stackPtr--;
+			//Entries are local distances, the closest hit is kept in world distance.
+			if (stackEntry[stackPtr] > closestSoFar * localScale)
+				continue;
+
+			const PackedBVHNode& node = scene.bvhNodes[stack[stackPtr]];
+			if (node.IsLeaf())
+			{
+				IntersectLeafTriangles(context, r, localRay, node.leftChildOrFirstTriangle, node.GetTriangleCount(), tMin, closestSoFar, localScale, transform, targetObject.materialIndex, rec, triangleTests);
+				continue;
+			}
+
+			leftChild = node.leftChildOrFirstTriangle;
+			rightChild = node.rightChildOrTriangleCount;
+			break;
+		}
+	}
+}
+
+static bool GetHit(const FrameContext& context, const BVHRay& rayIn, float tMin, float tMax, RayHit& rec, int& triangleTests, int& bvhNodeTests)
+{
+	BVHRay r;
+	r.origin = rayIn.origin;
+	r.direction = glm::normalize(rayIn.direction);
+
+	float closestSoFar = tMax;
+	rec.t = tMax;
+	rec.hitObject = false;
+
+	if (context.constants.parentBVHCount == 0)
+		return false;
+
+	//Ordered like the BLAS traversal, the builder keeps the tree shallow enough for the stack.
+	int topLevelStack[TOP_LEVEL_TRAVERSAL_STACK_SIZE];
+	float topLevelStackEntry[TOP_LEVEL_TRAVERSAL_STACK_SIZE];
+	int topLevelStackPtr = 0;
+
+	std::span<const BVHNode> topLevelBVH = context.scene.topLevelBVH;
+	Interval rootInterval = { tMin, closestSoFar };
+
+	bvhNodeTests++;
+
+	if (!IntersectAABB(r, topLevelBVH[0].aabb.min, topLevelBVH[0].aabb.max, rootInterval))
+		return false;
+
+	topLevelStack[topLevelStackPtr] = 0;
+	topLevelStackEntry[topLevelStackPtr++] = rootInterval.min;
+
+	while (topLevelStackPtr > 0)
+	{
+		topLevelStackPtr--;
+		if (topLevelStackEntry[topLevelStackPtr] > closestSoFar)
+			continue;
+
+		const BVHNode& node = topLevelBVH[topLevelStack[topLevelStackPtr]];
+		if (node.leftChild == -1)
+		{
+			IntersectInstance(context, r, node.triangleStartIndex, node.triangleCount, tMin, closestSoFar, rec, triangleTests, bvhNodeTests);
+			continue;
+		}
+
+		Interval leftInterval = { tMin, closestSoFar };
+		Interval rightInterval = { tMin, closestSoFar };
+
+		bvhNodeTests += 2;
+
+		const BVHNode& left = topLevelBVH[node.leftChild];
+		const BVHNode& right = topLevelBVH[node.rightChild];
+		bool hitLeft = IntersectAABB(r, left.aabb.min, left.aabb.max, leftInterval);
+		bool hitRight = IntersectAABB(r, right.aabb.min, right.aabb.max, rightInterval);
+
+		//Push the further child first so the nearer one is popped next.
+		bool leftNearer = !hitRight || (hitLeft && leftInterval.min <= rightInterval.min);
+		int nearChild = leftNearer ? node.leftChild : node.rightChild;
+		int farChild = leftNearer ? node.rightChild : node.leftChild;
+		float nearEntry = leftNearer ? leftInterval.min : rightInterval.min;
+		float farEntry = leftNearer ? rightInterval.min : leftInterval.min;
+
+		if (hitLeft && hitRight && topLevelStackPtr < TOP_LEVEL_TRAVERSAL_STACK_SIZE)
+		{
+			topLevelStack[topLevelStackPtr] = farChild;
+			topLevelStackEntry[topLevelStackPtr++] = farEntry;
+		}
+		if ((hitLeft || hitRight) && topLevelStackPtr < TOP_LEVEL_TRAVERSAL_STACK_SIZE)
+		{
+			topLevelStack[topLevelStackPtr] = nearChild;
+			topLevelStackEntry[topLevelStackPtr++] = nearEntry;
+		}
+	}
+
+	return rec.hitObject;
+}
+
+static glm::vec3 GetEnvironmentColour(const RaytracePushConstants& constants, const BVHRay& ray)
+{
+	glm::vec3 unitDir = glm::normalize(ray.direction);
+	glm::vec3 sunDir = glm::normalize(constants.sunDirection);
+	float sunDotUp = glm::dot(-sunDir, glm::vec3(0.0f, 1.0f, 0.0f));
+
+	const glm::vec3 dayZenith = glm::vec3(0.5f, 0.7f, 1.0f);
+	const glm::vec3 dayHorizon = glm::vec3(1.0f, 1.0f, 1.0f);
+	const glm::vec3 sunriseColor = glm::vec3(1.0f, 0.4f, 0.2f);
+	const glm::vec3 nightZenith = glm::vec3(0.0f, 0.0f, 0.0f);
+	const glm::vec3 nightHorizon = glm::vec3(0.0f, 0.0f, 0.0f);
+
+	float viewT = glm::clamp(0.5f * (unitDir.y + 1.0f), 0.0f, 1.0f);
+
+	glm::vec3 baseSky;
+	if (sunDotUp > 0.1f)
+	{
+		baseSky = glm::mix(dayHorizon, dayZenith, viewT);
+	}
+	else if (sunDotUp > -0.1f)
+	{
+		//Sunrise and sunset blend between the day sky and the sunrise colour.
+		float blend = (sunDotUp + 0.1f) / 0.2f;
+		glm::vec3 daySky = glm::mix(dayHorizon, dayZenith, viewT);
+		glm::vec3 sunSky = glm::mix(sunriseColor, sunriseColor * 0.5f, viewT);
+		baseSky = glm::mix(sunSky, daySky, blend);
+	}
+	else
+	{
+		baseSky = glm::mix(nightHorizon, nightZenith, viewT);
+	}
+
+	float cosTheta = glm::clamp(glm::dot(unitDir, -sunDir), 0.0f, 1.0f);
+	float sunDisk = std::exp(-std::pow(std::acos(cosTheta) / glm::radians(0.5f), 2.0f));
+	glm::vec3 sunGlow = constants.sunColour * constants.sunIntensity * sunDisk;
+
+	return baseSky + sunGlow;
+}
+
+static BVHRay GetRay(const RaytracePushConstants& constants, int x, int y, uint32_t seed)
+{
+	glm::vec3 offset = SampleSquare(seed);
+	glm::vec3 pixelSample = constants.pixel00Location + ((x + offset.x) * constants.pixelDeltaU) + ((y + offset.y) * constants.pixelDeltaV);
+
+	glm::vec3 rayOrigin = constants.cameraPosition;
+	if (constants.defocusAngle > 0.0f)
+	{
+		//The shader's DefocusDiskSample takes its own copy of the seed, after SampleSquare has advanced it.
+		uint32_t defocusSeed = seed;
+		glm::vec3 p = RandomInUnitDisk(defocusSeed);
+		rayOrigin = constants.cameraPosition + p.x * constants.defocusDiskU + p.y * constants.defocusDiskV;
+	}
+
+	BVHRay ray;
+	ray.origin = rayOrigin;
+	ray.direction = glm::normalize(pixelSample - rayOrigin);
+	return ray;
+}
+
+static glm::vec3 RayColour(const FrameContext& context, BVHRay ray, RayHit& rec, uint32_t& seed, int& triangleTests, int& bvhNodeTests)
+{
+	const RaytracePushConstants& constants = context.constants;
+
+	glm::vec3 result = glm::vec3(0.0f);
+	glm::vec3 throughput = glm::vec3(1.0f);
+
+	for (int bounce = 0; bounce < constants.maxBounces + 1; bounce++)
+	{
+		GetHit(context, ray, 0.001f, 1e20f, rec, triangleTests, bvhNodeTests);
+
+		if (!rec.hitObject)
+		{
+			result += throughput * GetEnvironmentColour(constants, ray);
+			break;
+		}
+
+		if (!rec.frontFace)
+			break;
+
+		const GPUMaterial& recMat = context.scene.materials[rec.matIndex];
+		result += throughput * recMat.albedo * recMat.emission;
+
+		//Emissive surfaces end the path.
+		if (recMat.emission > 0.0f)
+			break;
+
+		//Direct light from the sun.
+		float nDotL = std::max(glm::dot(rec.normal, -constants.sunDirection), 0.0f);
+		if (nDotL > 0.0f)
+		{
+			BVHRay shadowRay;
+			shadowRay.origin = rec.point + rec.normal * 0.01f;
+			shadowRay.direction = -constants.sunDirection;
+
+			RayHit shadowRec;
+			if (!GetHit(context, shadowRay, 0.001f, 1e20f, shadowRec, triangleTests, bvhNodeTests))
+			{
+				const float INV_PI = 0.31830988618f;
+				glm::vec3 direct = constants.sunIntensity * constants.sunColour * (nDotL * INV_PI);
+
+				//Glass only shows the sun it reflects, refracted sunlight would be a caustic.
+				if (recMat.refractiveIndex == 0.0f)
+					result += throughput * recMat.albedo * direct;
+				else
+					result += throughput * Reflectance(nDotL, recMat.refractiveIndex) * direct;
+			}
+		}
+
+		BVHRay scattered;
+		glm::vec3 attenuation;
+		if (!MaterialScatter(context, ray, rec, attenuation, scattered, seed))
+			break;
+
+		throughput *= attenuation;
+		ray = scattered;
+	}
+
+	return result;
+}
+
+static void Pathtrace(const FrameContext& context, int x, int y, float raysPerPixelRatio, float accumulationMultiplier)
+{
+	const RaytracePushConstants& constants = context.constants;
+	const int pixelIndex = y * context.width + x;
+
+	glm::vec4 newColour = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	int triangleTests = 0;
+	int bvhNodeTests = 0;
+
+	for (int i = 0; i < constants.raysPerPixel; i++)
+	{
+		uint32_t seed = SeedFromCoords(x, y, constants.frame, i);
+		BVHRay ray = GetRay(constants, x, y, seed);
+		RayHit rec;
+		newColour += glm::vec4(RayColour(context, ray, rec, seed, triangleTests, bvhNodeTests), 0.0f);
+	}
+
+	if (constants.renderMode == 0)
+	{
+		newColour *= glm::vec4(glm::vec3(raysPerPixelRatio), 1.0f);
+
+		glm::vec4& accumulatedColour = context.accumulation[pixelIndex];
+		accumulatedColour += glm::vec4(glm::vec3(newColour), 0.0f);
+
+		glm::vec4 avgColour = constants.accumulateFrames == 1 ? accumulatedColour : newColour;
+		avgColour *= glm::vec4(glm::vec3(accumulationMultiplier), 1.0f);
+
+		context.output[pixelIndex] = glm::vec4(LinearToGamma(avgColour.r), LinearToGamma(avgColour.g), LinearToGamma(avgColour.b), avgColour.a);
+		return;
+	}
+
+	//Heatmaps of the triangle tests or node tests the pixel's rays needed, red once the shown count passes its threshold.
+	const int thresholdTests = constants.renderMode == 3 ? constants.triangleTestThreshold : constants.bvhNodeTestThreshold;
+	int targetTestValue = constants.renderMode == 3 ? triangleTests : bvhNodeTests;
+
+	int greyScale = std::clamp(static_cast<int>(static_cast<float>(targetTestValue) / static_cast<float>(thresholdTests) * 255.0f), 0, 255);
+	float grey = static_cast<float>(greyScale) / 255.0f;
+	context.output[pixelIndex] = targetTestValue > thresholdTests ? glm::vec4(1.0f, 0.0f, 0.0f, 1.0f) : glm::vec4(grey, grey, grey, 1.0f);
+}
+
+static void RenderBoundingBoxes(const FrameContext& context, int x, int y)
+{
+	glm::vec4 outColour = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	BVHRay ray = GetRay(context.constants, x, y, 123u);
+	for (int i = 0; i < context.constants.parentBVHCount; i++)
+	{
+		const AABB& bounds = context.scene.parentBVH[i].node.aabb;
+		Interval interval = { 0.001f, 1e20f };
+		if (IntersectAABB(ray, bounds.min, bounds.max, interval))
+		{
+			outColour = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+			break;
+		}
+	}
+
+	context.output[y * context.width + x] = outColour;
+}
+
+static void RenderDepth(const FrameContext& context, int x, int y)
+{
+	BVHRay ray = GetRay(context.constants, x, y, 123u);
+	RayHit rec;
+
+	int triangleTests = 0;
+	int bvhNodeTests = 0;
+
+	glm::vec4 outColour = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	if (GetHit(context, ray, 0.001f, 1e20f, rec, triangleTests, bvhNodeTests))
+	{
+		float depth = glm::clamp(glm::length(rec.point - context.constants.cameraPosition) / context.constants.depthDebugScale, 0.0f, 1.0f);
+		outColour = glm::vec4(depth, depth, depth, 1.0f);
+	}
+
+	context.output[y * context.width + x] = outColour;
+}
+
+CPURaytracer::CPURaytracer(int threadCount) : m_threadPool(threadCount)
+{
+}
+
+void CPURaytracer::Resize(int width, int height)
+{
+	m_iWidth = width;
+	m_iHeight = height;
+	m_output.assign(static_cast<size_t>(width) * height, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	ClearAccumulation();
+}
+
+void CPURaytracer::ClearAccumulation()
+{
+	m_accumulation.assign(static_cast<size_t>(m_iWidth) * m_iHeight, glm::vec4(0.0f));
+}
+
+void CPURaytracer::RenderFrame(const CPURaytracerScene& scene, const RaytracePushConstants& pushConstants)
+{
+	//The shader inverts an instance's transform for every ray that reaches it, here it is done once per frame.
+	std::vector<InstanceTransform> transforms(scene.objects.size());
+	for (size_t i = 0; i < scene.objects.size(); i++)
+	{
+		transforms[i].objectTransform = glm::inverse(scene.objects[i].inverseTransform);
+		transforms[i].normalMatrix = glm::mat3(glm::transpose(scene.objects[i].inverseTransform));
+	}
+
+	const FrameContext context = { scene, pushConstants, transforms, m_iWidth, m_accumulation.data(), m_output.data() };
+
+	const float raysPerPixelRatio = 1.0f / static_cast<float>(pushConstants.raysPerPixel);
+	const float accumulationMultiplier = pushConstants.accumulateFrames == 1 ? 1.0f / static_cast<float>(pushConstants.frame + 1) : 1.0f;
+
+	const int tilesX = (m_iWidth + TILE_SIZE - 1) / TILE_SIZE;
+	const int tilesY = (m_iHeight + TILE_SIZE - 1) / TILE_SIZE;
+
+	//One task per tile, idle threads steal whole tiles so sky tiles and tiles over dense geometry still balance out.
+	ParallelFor(m_threadPool, tilesX * tilesY, 1, [&](int begin, int end)
+		{
+			for (int tile = begin; tile < end; tile++)
+			{
+				int startX = (tile % tilesX) * TILE_SIZE;
+				int startY = (tile / tilesX) * TILE_SIZE;
+				int endX = std::min(startX + TILE_SIZE, m_iWidth);
+				int endY = std::min(startY + TILE_SIZE, m_iHeight);
+
+				for (int y = startY; y < endY; y++)
+				{
+					for (int x = startX; x < endX; x++)
+					{
+						if (pushConstants.renderMode == 0 || pushConstants.renderMode == 3 || pushConstants.renderMode == 4)
+							Pathtrace(context, x, y, raysPerPixelRatio, accumulationMultiplier);
+						else if (pushConstants.renderMode == 1)
+							RenderBoundingBoxes(context, x, y);
+						else if (pushConstants.renderMode == 2)
+							RenderDepth(context, x, y);
+					}
+				}
+			}
+		});
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+#include "TriangleGrid.h"
+#include "../Useful/ThreadPool.h"
+
+/**
+* The scene arrays the compute shader reads, in the same layout the renderer uploads them in. Only viewed, the renderer keeps ownership.
+*/
+struct CPURaytracerScene
+{
+	std::span<const glm::vec4> triangleV0s;
+	std::span<const glm::vec4> triangleV1s;
+	std::span<const glm::vec4> triangleV2s;
+
+	std::span<const glm::vec4> triangleN0s;
+	std::span<const glm::vec4> triangleN1s;
+	std::span<const glm::vec4> triangleN2s;
+
+	std::span<const PackedBVHNode> bvhNodes;
+	std::span<const int> bvhMissLinks;
+	std::span<const WideBVHChild> wideBVHChildren;
+	std::span<const uint32_t> quantizedBVHWords;
+	std::span<const ParentBVHNode> parentBVH;
+	std::span<const BVHNode> topLevelBVH;
+
+	std::span<const GPUObject> objects;
+	std::span<const GPUMaterial> materials;
+
+	//Optional grid per object, indexed like objects. Objects with a grid are traced through it instead of their BVH, left empty every object uses its BVH.
+	std::span<const TriangleGrid* const> objectGrids;
+	//The traversal the shader's specialization constants select. Quantized wide nodes are read from quantizedBVHWords, full precision ones
+	//from wideBVHChildren, and stacklessTraversal only applies to binary BVHs like BVH_STACKLESS.
+	int bvhWidth = 2;
+	int bvhQuantizationBits = 0;
+	bool stacklessTraversal = false;
+};
+
+/**
+* CPU port of raytrace.comp for machines without a GPU. Every render mode, material, the sky and the random number sequences follow the
+* shader line for line, so an image converges to the same result as the GPU's. Frames are split into 16x16 tiles, the shader's workgroup
+* size, which run as separate tasks on a work stealing pool. Tiles share nothing but the read only scene, so rendering scales with cores.
+* BLAS are walked with whichever of the shader's wide, stackless or ordered stack traversals the scene's settings select, under the same
+* conditions, so the test count render modes match the GPU's. Objects given a triangle grid walk its cells instead, which the GPU can't.
+*/
+class CPURaytracer
+{
+private:
+
+	ThreadPool m_threadPool;
+
+	int m_iWidth = 0;
+	int m_iHeight = 0;
+
+	//Running sum of every frame since the last clear, and the gamma corrected image the last frame produced.
+	std::vector<glm::vec4> m_accumulation;
+	std::vector<glm::vec4> m_output;
+
+public:
+
+	/**
+	* 0 threads uses every hardware thread.
+	*/
+	CPURaytracer(int threadCount = 0);
+
+	/**
+	* Sets the image size and clears the accumulation.
+	*/
+	void Resize(int width, int height);
+	void ClearAccumulation();
+
+	/**
+	* Renders one frame with the given shader constants, pushConstants.frame has to count up from 0 since the last clear like it does on the GPU.
+	*/
+	void RenderFrame(const CPURaytracerScene& scene, const RaytracePushConstants& pushConstants);
+
+	/**
+	* RGBA pixels of the last frame, rows top to bottom, in the format the shader writes to its output image.
+	*/
+	const std::vector<glm::vec4>& GetOutput() const { return m_output; }
+
+	int GetWidth() const { return m_iWidth; }
+	int GetHeight() const { return m_iHeight; }
+	int GetThreadCount() const { return m_threadPool.GetThreadCount(); }
+};
@@ -1,5 +1,7 @@
 #include "HardwareRenderer.h"
 
+#include <algorithm>
+#include <map>
 #include <numeric>
 
 #define VMA_IMPLEMENTATION
@@ -19,6 +21,14 @@
 #include "Imgui/implot.h"
 
 #include "../ModelLoader.h"
+#include "../BVHCache.h"
+#include "../BVHTuner.h"
+#include "../WideBVHBuilder.h"
+#include "../TopLevelBVHBuilder.h"
+#include "../BVHTraversal.h"
+#include "../BVHLayout.h"
+#include "../BVHAnalysis.h"
+#include "../CPURaytracer.h"
 
 #include "../../Useful/Useful.h"
 #include "../../Interface/RaytracerSettingsUI.hpp"
@@ -336,7 +346,6 @@ void HardwareRenderer::InitializeDescriptors()
 		builder.AddBinding(14, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
 		builder.AddBinding(15, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
 		builder.AddBinding(16, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
-		builder.AddBinding(17, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
 		m_sceneDescriptorLayout = builder.Build(m_device);
 	}
 
@@ -461,9 +470,21 @@ void HardwareRenderer::InitializePipelines()
 
 		std::string computePath = GetWorkingDirectory() + "\\Resources\\Shaders\\raytrace.spv";
 		VkShaderModule computeShader;
-		LoadShaderModule(computePath.c_str(), m_device, &computeShader);
+		if (!LoadShaderModule(computePath.c_str(), m_device, &computeShader))
+			throw std::exception(FormatString("Failed to load the raytrace shader from %s.", computePath.c_str()).c_str());
+
+		//A raytrace.spv built before the stack sizes became specialization constants would silently run with its own sizes, and its bindings
+		//no longer match the renderer's. The last constant added is checked, as the CompileShaders target rebuilds every shader together.
+		if (!ShaderHasSpecializationConstant(computePath.c_str(), 5))
+			throw std::exception(FormatString("%s is out of date, build the CompileShaders target to regenerate it.", computePath.c_str()).c_str());
 
 		pipelineBuilder.SetComputeShader(computeShader);
+		pipelineBuilder.AddSpecializationConstant(0, GetEffectiveBVHWidth(m_bvhBuildSettings));
+		pipelineBuilder.AddSpecializationConstant(1, GetEffectiveBVHQuantizationBits(m_bvhBuildSettings));
+		pipelineBuilder.AddSpecializationConstant(2, UsesStacklessTraversal() ? 1 : 0);
+		pipelineBuilder.AddSpecializationConstant(3, BLAS_TRAVERSAL_STACK_SIZE);
+		pipelineBuilder.AddSpecializationConstant(4, TOP_LEVEL_TRAVERSAL_STACK_SIZE);
+		pipelineBuilder.AddSpecializationConstant(5, WIDE_BVH_TRAVERSAL_STACK_SIZE);
 		pipelineBuilder.m_pipelineLayout = m_raytracePipelineLayout;
 		m_raytracePipeline = pipelineBuilder.BuildComputePipeline(GetLogicalDevice());
 
@@ -487,7 +508,7 @@ int HardwareRenderer::GetMaterialIndex(const GPUMaterial& material)
 	return -1;
 }
 
-void HardwareRenderer::AddSceneObject(std::string modelPath, glm::vec3 position, glm::vec3 rotation, glm::vec3 scale, const GPUMaterial& material)
+void HardwareRenderer::AddSceneObject(std::string modelPath, glm::vec3 position, glm::vec3 rotation, glm::vec3 scale, const GPUMaterial& material, bool isStatic)
 {
 	SceneObject newObject;
 	newObject.modelName = modelPath;
@@ -495,59 +516,171 @@ void HardwareRenderer::AddSceneObject(std::string modelPath, glm::vec3 position,
 	newObject.rotation = rotation;
 	newObject.scale = scale;
 	newObject.materialIndex = GetMaterialIndex(material);
+	newObject.isStatic = isStatic;
 
 	m_sceneObjects.push_back(newObject);
 }
 
-void HardwareRenderer::ConvertSceneObjectToGPUObject(const SceneObject& obj)
+static glm::mat4 GetObjectTransform(const SceneObject& obj)
 {
-	GPUObject gpuObject;
-
 	glm::mat4 objectMat = glm::mat4(1.0f);
 	objectMat = glm::translate(objectMat, obj.position);
 	objectMat = glm::rotate(objectMat, glm::radians(obj.rotation.x), glm::vec3(1, 0, 0));
 	objectMat = glm::rotate(objectMat, glm::radians(obj.rotation.y), glm::vec3(0, 1, 0));
 	objectMat = glm::rotate(objectMat, glm::radians(obj.rotation.z), glm::vec3(0, 0, 1));
 	objectMat = glm::scale(objectMat, obj.scale);
+	return objectMat;
+}
+
+AABB HardwareRenderer::GetInstanceBounds(const Model& model, const glm::mat4& objectMat) const
+{
+	//Transforming only the root box makes rotated instances far larger than the model, the boxes a few levels down follow its shape much closer.
+	const BVHNode& root = model.parentBVH.node;
+	if (root.leftChild == -1)
+		return TransformAABB(root.aabb, objectMat);
+
+	AABB bounds = EmptyAABB();
+	std::vector<std::pair<int, int>> stack = { { root.leftChild, 1 }, { root.rightChild, 1 } };
+	while (!stack.empty())
+	{
+		auto [node, depth] = stack.back();
+		stack.pop_back();
+
+		const PackedBVHNode& packedNode = m_bvhNodes[node];
+		if (depth < INSTANCE_BOUNDS_DEPTH && !packedNode.IsLeaf())
+		{
+			stack.push_back({ packedNode.leftChildOrFirstTriangle, depth + 1 });
+			stack.push_back({ packedNode.rightChildOrTriangleCount, depth + 1 });
+			continue;
+		}
+
+		AABB nodeAABB;
+		nodeAABB.min = packedNode.min;
+		nodeAABB.max = packedNode.max;
+
+		AABB transformed = TransformAABB(nodeAABB, objectMat);
+		bounds.Grow(transformed.min);
+		bounds.Grow(transformed.max);
+	}
+
+	return bounds;
+}
+
+void HardwareRenderer::ConvertSceneObjectToGPUObject(const SceneObject& obj, int objectIndex, GPUObject& outObject, ParentBVHNode& outParentNode)
+{
+	const Model& model = m_models[obj.modelName];
+	glm::mat4 objectMat = GetObjectTransform(obj);
+	AABB objectAABB = GetInstanceBounds(model, objectMat);
+
+	outObject.inverseTransform = glm::inverse(objectMat);
+	outObject.materialIndex = obj.materialIndex;
+	outObject.localBounds = model.parentBVH.node.aabb;
+
+	outObject.triangleStartIndex = model.triangleStartIndex;
+	outObject.triangleCount = model.triangleCount;
 
-	AABB objectAABB = m_models[obj.modelName].parentBVH.node.aabb;
-	glm::vec3 aabbMin = objectAABB.min;
-	glm::vec3 aabbMax = objectAABB.max;
-
-	glm::vec3 corners[8] = {
-		{aabbMin.x, aabbMin.y, aabbMin.z},
-		{aabbMax.x, aabbMin.y, aabbMin.z},
-		{aabbMin.x, aabbMax.y, aabbMin.z},
-		{aabbMax.x, aabbMax.y, aabbMin.z},
-		{aabbMin.x, aabbMin.y, aabbMax.z},
-		{aabbMax.x, aabbMin.y, aabbMax.z},
-		{aabbMin.x, aabbMax.y, aabbMax.z},
-		{aabbMax.x, aabbMax.y, aabbMax.z}
-	};
 
-	glm::vec3 newMin(FLT_MAX), newMax(-FLT_MAX);
-	for (int i = 0; i < 8; ++i) {
-		glm::vec3 transformed = glm::vec3(objectMat * glm::vec4(corners[i], 1.0f));
-		newMin = glm::min(newMin, transformed);
-		newMax = glm::max(newMax, transformed);
+	outParentNode = model.parentBVH;
+	outParentNode.node.aabb = objectAABB;
+	outParentNode.objectIndex = objectIndex;
+}
+
+void HardwareRenderer::UpdateSceneObject(int objectIndex)
+{
+	if (objectIndex < 0 || objectIndex >= static_cast<int>(m_sceneObjectGPUIndices.size()) || IsSceneObjectMerged(objectIndex))
+		return;
+
+	int gpuIndex = m_sceneObjectGPUIndices[objectIndex];
+	ConvertSceneObjectToGPUObject(m_sceneObjects[objectIndex], gpuIndex, m_gpuSceneObjects[gpuIndex], m_parentBVH[gpuIndex]);
+	UploadBufferRange(m_sceneObjectBuffer, &m_gpuSceneObjects[gpuIndex], sizeof(GPUObject) * gpuIndex, sizeof(GPUObject));
+	UploadBufferRange(m_parentBVHBuffer, &m_parentBVH[gpuIndex], sizeof(ParentBVHNode) * gpuIndex, sizeof(ParentBVHNode));
+
+	std::vector<int> changedNodes;
+	if (!UsesTopLevelRebraiding())
+	{
+		UpdateTopLevelBVHLeaf(m_topLevelBVH, m_topLevelBVHParents, m_topLevelBVHInstanceLeaves[gpuIndex], m_parentBVH[gpuIndex].node.aabb, changedNodes);
+	}
+	else
+	{
+		//Rebraided trees can spread the object over several leaves, each holding the whole instance or one of its BLAS nodes.
+		glm::mat4 objectMat = glm::inverse(m_gpuSceneObjects[gpuIndex].inverseTransform);
+		for (int leaf = 0; leaf < static_cast<int>(m_topLevelBVH.size()); leaf++)
+		{
+			const BVHNode& leafNode = m_topLevelBVH[leaf];
+			if (leafNode.leftChild != -1 || leafNode.triangleStartIndex != gpuIndex)
+				continue;
+
+			AABB leafBounds = m_parentBVH[gpuIndex].node.aabb;
+			if (leafNode.triangleCount != -1)
+			{
+				AABB nodeBounds;
+				nodeBounds.min = m_bvhNodes[leafNode.triangleCount].min;
+				nodeBounds.max = m_bvhNodes[leafNode.triangleCount].max;
+				leafBounds = TransformAABB(nodeBounds, objectMat);
+			}
+
+			UpdateTopLevelBVHLeaf(m_topLevelBVH, m_topLevelBVHParents, leaf, leafBounds, changedNodes);
+		}
+	}
+
+	//Refitting keeps the topology the object had when the tree was built, rebuild once it has drifted far enough to slow traversal down.
+	//Rebuilding a rebraided tree also reopens instances against their new neighbours.
+	if (GetTopLevelBVHCost(m_topLevelBVH) > m_topLevelBVHBuildCost * TOP_LEVEL_REBUILD_THRESHOLD)
+	{
+		BuildTopLevelBVHFromObjects();
+		UploadBufferRange(m_topLevelBVHBuffer, m_topLevelBVH.data(), 0, sizeof(BVHNode) * m_topLevelBVH.size());
 	}
+	else
+	{
+		for (int node : changedNodes)
+			UploadBufferRange(m_topLevelBVHBuffer, &m_topLevelBVH[node], sizeof(BVHNode) * node, sizeof(BVHNode));
+	}
+
+	m_bRefreshAccumulation = true;
+}
 
-	objectAABB.min = newMin;
-	objectAABB.max = newMax;
+bool HardwareRenderer::IsSceneObjectMerged(int objectIndex) const
+{
+	return objectIndex >= 0 && objectIndex < static_cast<int>(m_sceneObjectGPUIndices.size()) && m_sceneObjectGPUIndices[objectIndex] == -1;
+}
 
-	gpuObject.inverseTransform = glm::inverse(objectMat);
-	gpuObject.materialIndex = obj.materialIndex;
+void HardwareRenderer::UpdateSceneMaterial(int materialIndex)
+{
+	if (materialIndex < 0 || materialIndex >= static_cast<int>(m_sceneMaterials.size()))
+		return;
 
-	gpuObject.triangleStartIndex = m_models[obj.modelName].triangleStartIndex;
-	gpuObject.triangleCount = m_models[obj.modelName].triangleCount;
+	UploadBufferRange(m_sceneMaterialBuffer, &m_sceneMaterials[materialIndex], sizeof(GPUMaterial) * materialIndex, sizeof(GPUMaterial));
+	m_bRefreshAccumulation = true;
+}
 
+void HardwareRenderer::BuildTopLevelBVHFromObjects()
+{
+	if (UsesTopLevelRebraiding())
+	{
+		std::vector<glm::mat4> instanceTransforms;
+		for (const ParentBVHNode& parentNode : m_parentBVH)
+			instanceTransforms.push_back(glm::inverse(m_gpuSceneObjects[parentNode.objectIndex].inverseTransform));
+
+		std::vector<TopLevelReference> references;
+		std::vector<AABB> referenceBounds;
+		RebraidTopLevelInstances(m_parentBVH, instanceTransforms, m_bvhNodes, m_bvhBuildSettings.rebraidBudget, references, referenceBounds);
+		BuildRebraidedTopLevelBVH(references, referenceBounds, m_topLevelBVH);
+
+		//Instances can own several leaves, only the parent links are used to refit them.
+		LinkTopLevelBVH(m_topLevelBVH, static_cast<int>(m_parentBVH.size()), m_topLevelBVHParents, m_topLevelBVHInstanceLeaves);
+		m_topLevelBVHInstanceLeaves.clear();
+	}
+	else
+	{
+		std::vector<AABB> instanceBounds;
+		for (const ParentBVHNode& parentNode : m_parentBVH)
+			instanceBounds.push_back(parentNode.node.aabb);
 
-	ParentBVHNode parentNode = m_models[obj.modelName].parentBVH;
-	parentNode.node.aabb = objectAABB;
-	parentNode.objectIndex = m_gpuSceneObjects.size();
+		BuildTopLevelBVH(instanceBounds, m_topLevelBVH);
+		LinkTopLevelBVH(m_topLevelBVH, static_cast<int>(instanceBounds.size()), m_topLevelBVHParents, m_topLevelBVHInstanceLeaves);
+	}
 
-	m_gpuSceneObjects.push_back(gpuObject);
-	m_parentBVH.push_back(parentNode);
+	m_topLevelBVHBuildCost = GetTopLevelBVHCost(m_topLevelBVH);
 }
 
 void HardwareRenderer::InitializeUIs()
@@ -638,24 +771,150 @@ void HardwareRenderer::InitializeScene()
 	AddSceneObject(spherePath, glm::vec3(0, 10, 0), glm::vec3(0, 0, 0), glm::vec3(2, 2, 2), emissiveMaterial);
 	AddSceneObject(dragonPath, glm::vec3(0, 2, 0), glm::vec3(0, 195, 0), glm::vec3(1, 1, 1), dullGoldMaterial);
 
-	AddSceneObject(quadModelPath, glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(5, 5, 5), groundMaterial);
-	AddSceneObject(quadModelPath, glm::vec3(0, 10, 0), glm::vec3(0, 0, 180), glm::vec3(5, 5, 5), groundMaterial);
-	AddSceneObject(quadModelPath, glm::vec3(0, 5, -5), glm::vec3(90, 0, 0), glm::vec3(5, 5, 5), groundMaterial);
-	AddSceneObject(quadModelPath, glm::vec3(-5, 5, 0), glm::vec3(0, 0, 90), glm::vec3(5, 5, 5), redMaterial);
-	AddSceneObject(quadModelPath, glm::vec3(5, 5, 0), glm::vec3(0, 0, -90), glm::vec3(5, 5, 5), greenMaterial);
-	AddSceneObject(quadModelPath, glm::vec3(0, 5, 5), glm::vec3(-90, 0, 0), glm::vec3(5, 5, 5), groundMaterial);
+	AddSceneObject(quadModelPath, glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(5, 5, 5), groundMaterial, true);
+	AddSceneObject(quadModelPath, glm::vec3(0, 10, 0), glm::vec3(0, 0, 180), glm::vec3(5, 5, 5), groundMaterial, true);
+	AddSceneObject(quadModelPath, glm::vec3(0, 5, -5), glm::vec3(90, 0, 0), glm::vec3(5, 5, 5), groundMaterial, true);
+	AddSceneObject(quadModelPath, glm::vec3(-5, 5, 0), glm::vec3(0, 0, 90), glm::vec3(5, 5, 5), redMaterial, true);
+	AddSceneObject(quadModelPath, glm::vec3(5, 5, 0), glm::vec3(0, 0, -90), glm::vec3(5, 5, 5), greenMaterial, true);
+	AddSceneObject(quadModelPath, glm::vec3(0, 5, 5), glm::vec3(-90, 0, 0), glm::vec3(5, 5, 5), groundMaterial, true);
+}
 
-	BufferSceneData();
+bool HardwareRenderer::IsMergedStaticObject(const SceneObject& obj) const
+{
+	if (!obj.isStatic || m_bvhBuildSettings.staticMergeTriangleThreshold <= 0)
+		return false;
+
+	auto modelIt = m_models.find(obj.modelName);
+	return modelIt != m_models.end() && modelIt->second.sourceVertexCount / 3 <= m_bvhBuildSettings.staticMergeTriangleThreshold;
 }
 
-void HardwareRenderer::BufferSceneData()
+std::string HardwareRenderer::BuildMergedStaticModel(int materialIndex, const std::vector<int>& objectIndices)
+{
+	//Static objects can't be edited, so a merged model built for the same objects by an earlier buffering is still valid.
+	std::string modelName = "MergedStatic:" + std::to_string(materialIndex);
+	for (int objectIndex : objectIndices)
+		modelName += ":" + std::to_string(objectIndex);
+
+	if (m_models.find(modelName) != m_models.end())
+		return modelName;
+
+	//The source models are already loaded, their stored triangles are put back into source order so the merged mesh keeps each object's
+	//triangles together. Builders may duplicate a triangle into several references, only the first copy of each is used.
+	std::unordered_map<std::string, std::vector<int>> sourceTriangles;
+	std::vector<Vertex> mergedVertices;
+	for (int objectIndex : objectIndices)
+	{
+		const SceneObject& obj = m_sceneObjects[objectIndex];
+		const Model& model = m_models[obj.modelName];
+		std::vector<int>& storedTriangles = sourceTriangles[obj.modelName];
+		if (storedTriangles.empty())
+		{
+			storedTriangles.assign(model.sourceVertexCount / 3, -1);
+			for (int i = 0; i < model.triangleCount; i++)
+			{
+				int& storedTriangle = storedTriangles[model.triangleSourceIndices[i]];
+				if (storedTriangle == -1)
+					storedTriangle = model.triangleStartIndex + i;
+			}
+		}
+
+		glm::mat4 objectMat = GetObjectTransform(obj);
+		glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(objectMat)));
+
+		//Mirroring transforms flip the winding, swap two vertices so face normals still point the same way as the instanced object's.
+		bool flipWinding = glm::determinant(glm::mat3(objectMat)) < 0.0f;
+
+		for (int triangleIndex : storedTriangles)
+		{
+			if (triangleIndex == -1)
+				continue;
+
+			const glm::vec4* positions[3] = { &m_triangleV0s[triangleIndex], &m_triangleV1s[triangleIndex], &m_triangleV2s[triangleIndex] };
+			const glm::vec4* normals[3] = { &m_triangleN0s[triangleIndex], &m_triangleN1s[triangleIndex], &m_triangleN2s[triangleIndex] };
+			for (int corner = 0; corner < 3; corner++)
+			{
+				int sourceCorner = flipWinding && corner > 0 ? 3 - corner : corner;
+
+				Vertex vertex;
+				vertex.m_position = glm::vec3(objectMat * glm::vec4(glm::vec3(*positions[sourceCorner]), 1.0f));
+				vertex.m_normal = normalMat * glm::vec3(*normals[sourceCorner]);
+				mergedVertices.push_back(vertex);
+			}
+		}
+	}
+
+	std::vector<Triangle> modelTriangles;
+	AABB modelAABB;
+	BuildModelTriangles(mergedVertices, modelTriangles, modelAABB);
+
+	ParentBVHNode parentNode;
+	parentNode.node.aabb = modelAABB;
+	parentNode.objectIndex = -1;
+	parentNode.node.leftChild = -1;
+	parentNode.node.rightChild = -1;
+	parentNode.node.triangleStartIndex = 0;
+	parentNode.node.triangleCount = modelTriangles.size();
+
+	std::vector<BVHNode> modelBVH;
+	if (!modelTriangles.empty())
+		BuildModelBVH(modelTriangles, modelBVH, parentNode, m_bvhNodes.size(), m_bvhBuildSettings);
+
+	AppendModel(modelName, modelTriangles, modelBVH, parentNode, static_cast<int>(mergedVertices.size()));
+	return modelName;
+}
+
+void HardwareRenderer::PrepareSceneData()
 {
 	m_gpuSceneObjects.clear();
-	for (const auto& obj : m_sceneObjects)
+	m_parentBVH.clear();
+	m_sceneObjectGPUIndices.clear();
+
+	//Small static objects are grouped by material, each group becomes one world space mesh with a single instance.
+	std::map<int, std::vector<int>> mergedObjectsByMaterial;
+	for (size_t i = 0; i < m_sceneObjects.size(); i++)
+	{
+		const SceneObject& obj = m_sceneObjects[i];
+		if (IsMergedStaticObject(obj))
+		{
+			mergedObjectsByMaterial[obj.materialIndex].push_back(static_cast<int>(i));
+			m_sceneObjectGPUIndices.push_back(-1);
+			continue;
+		}
+
+		GPUObject gpuObject;
+		ParentBVHNode parentNode;
+		m_sceneObjectGPUIndices.push_back(static_cast<int>(m_gpuSceneObjects.size()));
+		ConvertSceneObjectToGPUObject(obj, static_cast<int>(m_gpuSceneObjects.size()), gpuObject, parentNode);
+
+		m_gpuSceneObjects.push_back(gpuObject);
+		m_parentBVH.push_back(parentNode);
+	}
+
+	for (const auto& [materialIndex, objectIndices] : mergedObjectsByMaterial)
 	{
-		ConvertSceneObjectToGPUObject(obj);
+		SceneObject mergedObject;
+		mergedObject.modelName = BuildMergedStaticModel(materialIndex, objectIndices);
+		mergedObject.materialIndex = materialIndex;
+		mergedObject.isStatic = true;
+
+		GPUObject gpuObject;
+		ParentBVHNode parentNode;
+		ConvertSceneObjectToGPUObject(mergedObject, static_cast<int>(m_gpuSceneObjects.size()), gpuObject, parentNode);
+
+		m_gpuSceneObjects.push_back(gpuObject);
+		m_parentBVH.push_back(parentNode);
 	}
 
+	if (!mergedObjectsByMaterial.empty())
+		std::cout << "Merged " << std::count(m_sceneObjectGPUIndices.begin(), m_sceneObjectGPUIndices.end(), -1) << " static objects into " << mergedObjectsByMaterial.size() << " meshes" << std::endl;
+
+	BuildTopLevelBVHFromObjects();
+}
+
+void HardwareRenderer::BufferSceneData()
+{
+	PrepareSceneData();
+
 	void* data;
 
 	m_parentBVHBuffer = CreateBuffer(sizeof(ParentBVHNode) * m_parentBVH.size()+1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "SceneAABBBuffer");
@@ -663,6 +922,17 @@ void HardwareRenderer::BufferSceneData()
 	memcpy(data, m_parentBVH.data(), sizeof(ParentBVHNode) * m_parentBVH.size());
 	vmaUnmapMemory(m_allocator, m_parentBVHBuffer.m_allocation);
 
+	//Rebraided trees change size when they are rebuilt for moved objects, so their buffer is sized for the most references rebraiding can create.
+	size_t topLevelBVHCount = m_topLevelBVH.size();
+	if (UsesTopLevelRebraiding())
+		topLevelBVHCount = std::max<size_t>(topLevelBVHCount, 2 * GetRebraidReferenceLimit(static_cast<int>(m_parentBVH.size()), m_bvhBuildSettings.rebraidBudget) - 1);
+
+	size_t topLevelBVHSize = sizeof(BVHNode) * std::max<size_t>(topLevelBVHCount, 1);
+	m_topLevelBVHBuffer = CreateBuffer(topLevelBVHSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "TopLevelBVHBuffer");
+	vmaMapMemory(m_allocator, m_topLevelBVHBuffer.m_allocation, &data);
+	memcpy(data, m_topLevelBVH.data(), sizeof(BVHNode) * m_topLevelBVH.size());
+	vmaUnmapMemory(m_allocator, m_topLevelBVHBuffer.m_allocation);
+
 	m_sceneObjectBuffer = CreateBuffer(sizeof(GPUObject) * m_gpuSceneObjects.size() + 1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "SceneObjectBuffer");
 	vmaMapMemory(m_allocator, m_sceneObjectBuffer.m_allocation, &data);
 	memcpy(data, m_gpuSceneObjects.data(), sizeof(GPUObject) * m_gpuSceneObjects.size());
@@ -718,35 +988,35 @@ void HardwareRenderer::BufferSceneData()
 	memcpy(data, m_triangleUV2s.data(), sizeof(glm::vec4) * m_triangleUV2s.size());
 	vmaUnmapMemory(m_allocator, m_triangleUV2Buffer.m_allocation);
 
-	m_aabbMinBuffer = CreateBuffer(sizeof(glm::vec4) * m_aabbMins.size()+1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "AABBMinBuffer");
-	vmaMapMemory(m_allocator, m_aabbMinBuffer.m_allocation, &data);
-	memcpy(data, m_aabbMins.data(), sizeof(glm::vec4) * m_aabbMins.size());
-	vmaUnmapMemory(m_allocator, m_aabbMinBuffer.m_allocation);
-
-	m_aabbMaxBuffer = CreateBuffer(sizeof(glm::vec4) * m_aabbMaxs.size() + 1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "AABBMaxBuffer");
-	vmaMapMemory(m_allocator, m_aabbMaxBuffer.m_allocation, &data);
-	memcpy(data, m_aabbMaxs.data(), sizeof(glm::vec4) * m_aabbMaxs.size());
-	vmaUnmapMemory(m_allocator, m_aabbMaxBuffer.m_allocation);
-
-	m_bvhLeftChildrenBuffer = CreateBuffer(sizeof(int) * m_bvhLeftChildren.size() + 1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "BVHLeftChildrenBuffer");
-	vmaMapMemory(m_allocator, m_bvhLeftChildrenBuffer.m_allocation, &data);
-	memcpy(data, m_bvhLeftChildren.data(), sizeof(int) * m_bvhLeftChildren.size());
-	vmaUnmapMemory(m_allocator, m_bvhLeftChildrenBuffer.m_allocation);
-
-	m_bvhRightChildrenBuffer = CreateBuffer(sizeof(int) * m_bvhRightChildren.size() + 1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "BVHRightChildrenBuffer");
-	vmaMapMemory(m_allocator, m_bvhRightChildrenBuffer.m_allocation, &data);
-	memcpy(data, m_bvhRightChildren.data(), sizeof(int) * m_bvhRightChildren.size());
-	vmaUnmapMemory(m_allocator, m_bvhRightChildrenBuffer.m_allocation);
-
-	m_bvhTriangleStartIndicesBuffer = CreateBuffer(sizeof(int) * m_bvhTriangleStartIndices.size() + 1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "BVHTriangleStartIndicesBuffer");
-	vmaMapMemory(m_allocator, m_bvhTriangleStartIndicesBuffer.m_allocation, &data);
-	memcpy(data, m_bvhTriangleStartIndices.data(), sizeof(int) * m_bvhTriangleStartIndices.size());
-	vmaUnmapMemory(m_allocator, m_bvhTriangleStartIndicesBuffer.m_allocation);
-
-	m_bvhTriangleCountsBuffer = CreateBuffer(sizeof(int) * m_bvhTriangleCounts.size() + 1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "BVHTriangleCountsBuffer");
-	vmaMapMemory(m_allocator, m_bvhTriangleCountsBuffer.m_allocation, &data);
-	memcpy(data, m_bvhTriangleCounts.data(), sizeof(int) * m_bvhTriangleCounts.size());
-	vmaUnmapMemory(m_allocator, m_bvhTriangleCountsBuffer.m_allocation);
+	//Wide BVHs are traversed from their own nodes, the binary nodes and their escape links only get a minimal buffer unless a model falls back to them.
+	bool bindBinaryBVH = UsesBinaryBVHNodes();
+	size_t bvhNodeCount = bindBinaryBVH ? m_bvhNodes.size() : 0;
+	size_t bvhNodeSize = sizeof(PackedBVHNode) * std::max<size_t>(bvhNodeCount, 1);
+	m_bvhNodeBuffer = CreateBuffer(bvhNodeSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "BVHNodeBuffer");
+	vmaMapMemory(m_allocator, m_bvhNodeBuffer.m_allocation, &data);
+	memcpy(data, m_bvhNodes.data(), sizeof(PackedBVHNode) * bvhNodeCount);
+	vmaUnmapMemory(m_allocator, m_bvhNodeBuffer.m_allocation);
+
+	//Only one of the wide node formats is read by the shader, the other binding gets a minimal buffer as it still needs a valid range.
+	size_t wideBVHCount = m_quantizedBVHWords.empty() ? m_wideBVHChildren.size() : 0;
+	size_t wideBVHSize = sizeof(WideBVHChild) * std::max<size_t>(wideBVHCount, 1);
+	m_wideBVHBuffer = CreateBuffer(wideBVHSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "WideBVHBuffer");
+	vmaMapMemory(m_allocator, m_wideBVHBuffer.m_allocation, &data);
+	memcpy(data, m_wideBVHChildren.data(), sizeof(WideBVHChild) * wideBVHCount);
+	vmaUnmapMemory(m_allocator, m_wideBVHBuffer.m_allocation);
+
+	size_t quantizedBVHSize = sizeof(uint32_t) * std::max<size_t>(m_quantizedBVHWords.size(), 1);
+	m_quantizedBVHBuffer = CreateBuffer(quantizedBVHSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "QuantizedBVHBuffer");
+	vmaMapMemory(m_allocator, m_quantizedBVHBuffer.m_allocation, &data);
+	memcpy(data, m_quantizedBVHWords.data(), sizeof(uint32_t) * m_quantizedBVHWords.size());
+	vmaUnmapMemory(m_allocator, m_quantizedBVHBuffer.m_allocation);
+
+	size_t missLinkCount = bindBinaryBVH ? m_bvhMissLinks.size() : 0;
+	size_t missLinksSize = sizeof(int) * std::max<size_t>(missLinkCount, 1);
+	m_bvhMissLinksBuffer = CreateBuffer(missLinksSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "BVHMissLinksBuffer");
+	vmaMapMemory(m_allocator, m_bvhMissLinksBuffer.m_allocation, &data);
+	memcpy(data, m_bvhMissLinks.data(), sizeof(int) * missLinkCount);
+	vmaUnmapMemory(m_allocator, m_bvhMissLinksBuffer.m_allocation);
 
 	DescriptorWriter writer;
 	writer.WriteBuffer(0, m_parentBVHBuffer.m_buffer, sizeof(ParentBVHNode) * m_parentBVH.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
@@ -761,42 +1031,20 @@ void HardwareRenderer::BufferSceneData()
 	writer.WriteBuffer(9, m_triangleUV0Buffer.m_buffer, sizeof(glm::vec4) * m_triangleUV0s.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 	writer.WriteBuffer(10, m_triangleUV1Buffer.m_buffer, sizeof(glm::vec4) * m_triangleUV1s.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 	writer.WriteBuffer(11, m_triangleUV2Buffer.m_buffer, sizeof(glm::vec4) * m_triangleUV2s.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-	writer.WriteBuffer(12, m_aabbMinBuffer.m_buffer, sizeof(glm::vec4)* m_aabbMins.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-	writer.WriteBuffer(13, m_aabbMaxBuffer.m_buffer, sizeof(glm::vec4)* m_aabbMaxs.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-	writer.WriteBuffer(14, m_bvhLeftChildrenBuffer.m_buffer, sizeof(int)* m_bvhLeftChildren.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-	writer.WriteBuffer(15, m_bvhRightChildrenBuffer.m_buffer, sizeof(int)* m_bvhRightChildren.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-	writer.WriteBuffer(16, m_bvhTriangleStartIndicesBuffer.m_buffer, sizeof(int)* m_bvhTriangleStartIndices.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-	writer.WriteBuffer(17, m_bvhTriangleCountsBuffer.m_buffer, sizeof(int)* m_bvhTriangleCounts.size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.WriteBuffer(12, m_bvhNodeBuffer.m_buffer, bvhNodeSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.WriteBuffer(13, m_wideBVHBuffer.m_buffer, wideBVHSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.WriteBuffer(14, m_quantizedBVHBuffer.m_buffer, quantizedBVHSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.WriteBuffer(15, m_topLevelBVHBuffer.m_buffer, topLevelBVHSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.WriteBuffer(16, m_bvhMissLinksBuffer.m_buffer, missLinksSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 	writer.UpdateSet(m_device, m_sceneDescriptor);
 }
 
-void HardwareRenderer::ClearSceneData()
-{
-	DestroyBuffer(m_parentBVHBuffer);
-	//DestroyBuffer(m_childBVHBuffer);
-	DestroyBuffer(m_sceneObjectBuffer);
-	DestroyBuffer(m_sceneMaterialBuffer);
-
-	m_parentBVH.clear();
-	m_gpuSceneObjects.clear();
-	//m_sceneTriangles.clear();
-	//m_sceneObjects.clear();
-	//m_sceneMaterials.clear();
-}
-
-void HardwareRenderer::RebufferSceneData()
+void HardwareRenderer::UpdatePushConstants(uint32_t width, uint32_t height)
 {
-	ClearSceneData();
-	BufferSceneData();
-}
-
-void HardwareRenderer::DispatchRayTracingCommands(VkCommandBuffer cmd)
-{
-	float pixelSampleScale = 1.0f / static_cast<float>(m_pushConstants.raysPerPixel);
 	auto theta = glm::radians(m_camera.cameraFov);
 	auto h = std::tan(theta / 2.0);
 	float viewportHeight = 2 * h * m_camera.focusDistance;
-	float viewportWidth = viewportHeight * (double(m_drawExtent.width) / m_drawExtent.height);
+	float viewportWidth = viewportHeight * (double(width) / height);
 
 	glm::vec3 up = glm::vec3(0, 1, 0);
 	glm::vec3 w = glm::normalize(-m_camera.cameraLookDirection);
@@ -806,8 +1054,8 @@ void HardwareRenderer::DispatchRayTracingCommands(VkCommandBuffer cmd)
 	auto viewportU = viewportWidth * u;
 	auto viewportV = viewportHeight * -v;
 
-	glm::vec3 pixelDeltaU = viewportU / static_cast<float>(m_drawExtent.width);
-	glm::vec3 pixelDeltaV = viewportV / static_cast<float>(m_drawExtent.height);
+	glm::vec3 pixelDeltaU = viewportU / static_cast<float>(width);
+	glm::vec3 pixelDeltaV = viewportV / static_cast<float>(height);
 
 	auto viewportUpperLeft = m_camera.cameraPosition - (m_camera.focusDistance * w) - viewportU / 2.0f - viewportV / 2.0f;
 	glm::vec3 pixel00Location = viewportUpperLeft + 0.5 * (pixelDeltaU + pixelDeltaV);
@@ -822,6 +1070,11 @@ void HardwareRenderer::DispatchRayTracingCommands(VkCommandBuffer cmd)
 	m_pushConstants.defocusDiskU = defocusRadius * u;
 	m_pushConstants.defocusDiskV = defocusRadius * v;
 	m_pushConstants.parentBVHCount = m_parentBVH.size();
+}
+
+void HardwareRenderer::DispatchRayTracingCommands(VkCommandBuffer cmd)
+{
+	UpdatePushConstants(m_drawExtent.width, m_drawExtent.height);
 
 	std::vector<VkDescriptorSet> sets;
 	sets.push_back(m_drawImageDescriptors);
@@ -1092,8 +1345,15 @@ void HardwareRenderer::WriteDrawImageToFile()
 
 	void* mappedData = nullptr;
 	vmaMapMemory(m_allocator, stagingBuffer.m_allocation, &mappedData);
-	const float* floatPixels = reinterpret_cast<const float*>(mappedData);
+	WriteRenderToFile(reinterpret_cast<const float*>(mappedData), width, height);
+	vmaUnmapMemory(m_allocator, stagingBuffer.m_allocation);
 
+	vmaDestroyBuffer(m_allocator, stagingBuffer.m_buffer, stagingBuffer.m_allocation);
+}
+
+void HardwareRenderer::WriteRenderToFile(const float* floatPixels, uint32_t width, uint32_t height)
+{
+	const size_t pixelCount = size_t(width) * size_t(height);
 	std::vector<uint8_t> imageData(pixelCount * 4);
 
 	for (size_t i = 0; i < pixelCount; ++i)
@@ -1124,10 +1384,8 @@ void HardwareRenderer::WriteDrawImageToFile()
 		// imageData[i*4 + 3] = static_cast<uint8_t>(a * 255.0f + 0.5f);
 	}
 
-	vmaUnmapMemory(m_allocator, stagingBuffer.m_allocation);
-
 	CreateNewDirectory("Renders");
-	std::string fileName = "Renders\\render_" + GetDateTimeString() + ".png";
+	std::string fileName = "Renders/render_" + GetDateTimeString() + ".png";
 
 	stbi_write_png(
 		fileName.c_str(),
@@ -1138,8 +1396,6 @@ void HardwareRenderer::WriteDrawImageToFile()
 		static_cast<int>(width) * 4
 	);
 
-	vmaDestroyBuffer(m_allocator, stagingBuffer.m_buffer, stagingBuffer.m_allocation);
-
 	std::cout << "Wrote render to " << fileName << std::endl;
 }
 
@@ -1150,10 +1406,84 @@ void HardwareRenderer::InitializeRenderer()
 	InitializeVulkan();
 	InitializeUIs();
 	InitializeScene();
+	BufferSceneData();
 
 	MainLoop();
 }
 
+void HardwareRenderer::RenderOnCPU(int width, int height, int frames, int threadCount)
+{
+	if (width <= 0 || height <= 0 || frames <= 0)
+		throw std::exception("CPU renders need a positive width, height and frame count.");
+
+	std::chrono::time_point<std::chrono::system_clock> startTime = std::chrono::system_clock::now();
+
+	InitializeScene();
+	PrepareSceneData();
+
+	CPURaytracerScene scene;
+	scene.triangleV0s = m_triangleV0s;
+	scene.triangleV1s = m_triangleV1s;
+	scene.triangleV2s = m_triangleV2s;
+	scene.triangleN0s = m_triangleN0s;
+	scene.triangleN1s = m_triangleN1s;
+	scene.triangleN2s = m_triangleN2s;
+	scene.bvhNodes = m_bvhNodes;
+	scene.bvhMissLinks = m_bvhMissLinks;
+	scene.wideBVHChildren = m_wideBVHChildren;
+	scene.quantizedBVHWords = m_quantizedBVHWords;
+	scene.parentBVH = m_parentBVH;
+	scene.topLevelBVH = m_topLevelBVH;
+	scene.objects = m_gpuSceneObjects;
+	scene.materials = m_sceneMaterials;
+	scene.bvhWidth = GetEffectiveBVHWidth(m_bvhBuildSettings);
+	scene.bvhQuantizationBits = GetEffectiveBVHQuantizationBits(m_bvhBuildSettings);
+	scene.stacklessTraversal = UsesStacklessTraversal();
+
+	//Grids are only read by the CPU renderer, so they are built here rather than when models are loaded. Merged static meshes are
+	//models too, so every object's triangles start where exactly one model's do.
+	std::unordered_map<int, const TriangleGrid*> modelGrids;
+	if (m_bvhBuildSettings.accelerationStructure == ModelAccelerationStructure::TriangleGrid)
+	{
+		for (auto& [modelName, model] : m_models)
+		{
+			if (model.grid.topCells.empty())
+				BuildModelGrid(model);
+
+			modelGrids[model.triangleStartIndex] = &model.grid;
+		}
+	}
+
+	std::vector<const TriangleGrid*> objectGrids(m_gpuSceneObjects.size(), nullptr);
+	for (size_t i = 0; i < m_gpuSceneObjects.size(); i++)
+	{
+		auto gridIt = modelGrids.find(m_gpuSceneObjects[i].triangleStartIndex);
+		if (gridIt != modelGrids.end())
+			objectGrids[i] = gridIt->second;
+	}
+	scene.objectGrids = objectGrids;
+
+	CPURaytracer raytracer(threadCount);
+	raytracer.Resize(width, height);
+	UpdatePushConstants(width, height);
+
+	std::cout << "Rendering " << width << "x" << height << " on " << raytracer.GetThreadCount() << " CPU threads" << std::endl;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		m_pushConstants.frame = frame;
+		raytracer.RenderFrame(scene, m_pushConstants);
+		std::cout << "\rRendering: " << (frame + 1) * 100 / frames << "%   " << std::flush;
+	}
+	std::cout << std::endl;
+
+	WriteRenderToFile(reinterpret_cast<const float*>(raytracer.GetOutput().data()), width, height);
+
+	std::chrono::time_point<std::chrono::system_clock> endTime = std::chrono::system_clock::now();
+	std::chrono::duration<double> elapsedSeconds = endTime - startTime;
+	std::cout << "Render took " << elapsedSeconds.count() << " seconds." << std::endl;
+}
+
 void HardwareRenderer::LoadModel(const std::string& filePath)
 {
 	if (filePath.substr(filePath.find_last_of(".") + 1) != "obj")
@@ -1172,106 +1502,145 @@ void HardwareRenderer::LoadModel(const std::string& filePath)
 		throw std::exception(error.c_str());
 	}
 
-	Model newModel;
 	AABB modelAABB;
-	newModel.triangleStartIndex = static_cast<int>(m_triangleV0s.size());
-
-	std::vector<Vertex> vertices;
 	std::vector<Triangle> modelTriangles;
+	std::vector<BVHNode> modelBVH;
+	ParentBVHNode parentNode;
+	int sourceVertexCount = 0;
+
+	//Parsing and building are skipped entirely for models whose file and build settings match the cache.
+	std::string cachePath = filePath + ".bvhcache";
+	uint64_t cacheKey = 0;
+	bool loadedFromCache = false;
+	BVHTuningResult tuning;
+	if (m_bvhBuildSettings.cacheBVHs)
+	{
+		cacheKey = HashBVHBuildInputs(filePath, m_bvhBuildSettings);
+		loadedFromCache = LoadCachedBVH(cachePath, cacheKey, modelTriangles, modelBVH, parentNode, sourceVertexCount, m_bvhNodes.size(), &tuning);
+	}
 
-	LoadObjFile(filePath, vertices);
-
-	float minX = INT_MAX;
-	float minY = INT_MAX;
-	float minZ = INT_MAX;
-	float maxX = INT_MIN;
-	float maxY = INT_MIN;
-	float maxZ = INT_MIN;
-
-	int triangleCount = static_cast<int>(vertices.size() / 3);
-	for (int i = 0; i < (int)vertices.size(); i += 3)
+	if (!loadedFromCache)
 	{
-		Triangle newTriangle;
-		newTriangle.v0 = vertices[i].m_position;
-		newTriangle.v1 = vertices[i + 1].m_position;
-		newTriangle.v2 = vertices[i + 2].m_position;
+		std::vector<Vertex> vertices;
+		LoadObjFile(filePath, vertices);
+		sourceVertexCount = static_cast<int>(vertices.size());
 
-		newTriangle.triCentroid = (newTriangle.v0 + newTriangle.v1 + newTriangle.v2) * 0.33f;
+		BuildModelTriangles(vertices, modelTriangles, modelAABB);
 
-		if (vertices[i].m_normal != glm::vec3(0.0f) &&
-			vertices[i + 1].m_normal != glm::vec3(0.0f) &&
-			vertices[i + 2].m_normal != glm::vec3(0.0f))
-		{
-			newTriangle.n0 = glm::normalize(vertices[i].m_normal);
-			newTriangle.n1 = glm::normalize(vertices[i + 1].m_normal);
-			newTriangle.n2 = glm::normalize(vertices[i + 2].m_normal);
-		}
-		else
+		parentNode.node.aabb = modelAABB;
+		parentNode.objectIndex = -1;
+		parentNode.node.leftChild = -1;
+		parentNode.node.rightChild = -1;
+		parentNode.node.triangleStartIndex = 0;
+		parentNode.node.triangleCount = modelTriangles.size();
+
+		if (!modelTriangles.empty())
 		{
-			glm::vec3 edge1 = newTriangle.v1 - newTriangle.v0;
-			glm::vec3 edge2 = newTriangle.v2 - newTriangle.v0;
-			glm::vec3 faceNormal = glm::normalize(glm::cross(edge1, edge2));
-			newTriangle.n0 = faceNormal;
-			newTriangle.n1 = faceNormal;
-			newTriangle.n2 = faceNormal;
+			//Tuning picks this model's leaf size, costs and bin count, everything else still comes from the renderer's settings.
+			BVHBuildSettings modelSettings = m_bvhBuildSettings;
+			if (m_bvhBuildSettings.autoTuneBVHs)
+			{
+				tuning = TuneBVHBuildSettings(modelTriangles, modelAABB, m_bvhBuildSettings);
+				ApplyBVHTuning(tuning, modelSettings);
+			}
+
+			BVHBuildStats buildStats;
+			BuildModelBVH(modelTriangles, modelBVH, parentNode, m_bvhNodes.size(), modelSettings, &buildStats);
+
+			if (m_bvhBuildSettings.optimizeTreelets)
+				std::cout << "Treelet optimization for " << filePath << " restructured " << buildStats.restructuredTreelets << " treelets" << std::endl;
+
+			if (m_bvhBuildSettings.method == BVHBuildMethod::SBVH)
+				std::cout << "SBVH for " << filePath << " duplicated " << buildStats.duplicatedReferences << " triangle references (" << sourceVertexCount / 3 << " triangles)" << std::endl;
 		}
 
-		// update bounding ints
-		if (newTriangle.v0.x < minX) minX = static_cast<int>(std::floor(newTriangle.v0.x));
-		if (newTriangle.v0.y < minY) minY = static_cast<int>(std::floor(newTriangle.v0.y));
-		if (newTriangle.v0.z < minZ) minZ = static_cast<int>(std::floor(newTriangle.v0.z));
-		if (newTriangle.v0.x > maxX) maxX = static_cast<int>(std::ceil(newTriangle.v0.x));
-		if (newTriangle.v0.y > maxY) maxY = static_cast<int>(std::ceil(newTriangle.v0.y));
-		if (newTriangle.v0.z > maxZ) maxZ = static_cast<int>(std::ceil(newTriangle.v0.z));
-
-		if (newTriangle.v1.x < minX) minX = static_cast<int>(std::floor(newTriangle.v1.x));
-		if (newTriangle.v1.y < minY) minY = static_cast<int>(std::floor(newTriangle.v1.y));
-		if (newTriangle.v1.z < minZ) minZ = static_cast<int>(std::floor(newTriangle.v1.z));
-		if (newTriangle.v1.x > maxX) maxX = static_cast<int>(std::ceil(newTriangle.v1.x));
-		if (newTriangle.v1.y > maxY) maxY = static_cast<int>(std::ceil(newTriangle.v1.y));
-		if (newTriangle.v1.z > maxZ) maxZ = static_cast<int>(std::ceil(newTriangle.v1.z));
-
-		if (newTriangle.v2.x < minX) minX = static_cast<int>(std::floor(newTriangle.v2.x));
-		if (newTriangle.v2.y < minY) minY = static_cast<int>(std::floor(newTriangle.v2.y));
-		if (newTriangle.v2.z < minZ) minZ = static_cast<int>(std::floor(newTriangle.v2.z));
-		if (newTriangle.v2.x > maxX) maxX = static_cast<int>(std::ceil(newTriangle.v2.x));
-		if (newTriangle.v2.y > maxY) maxY = static_cast<int>(std::ceil(newTriangle.v2.y));
-		if (newTriangle.v2.z > maxZ) maxZ = static_cast<int>(std::ceil(newTriangle.v2.z));
-
-		modelTriangles.push_back(newTriangle);
+		if (m_bvhBuildSettings.cacheBVHs)
+			SaveCachedBVH(cachePath, cacheKey, modelTriangles, modelBVH, parentNode, sourceVertexCount, m_bvhNodes.size(), m_bvhBuildSettings.autoTuneBVHs ? &tuning : nullptr);
 	}
 
-	// ensure non-zero extents
-	float xDiff = maxX - minX;
-	float yDiff = maxY - minY;
-	float zDiff = maxZ - minZ;
-	if (xDiff == 0) { maxX += 1; minX -= 1; }
-	if (yDiff == 0) { maxY += 1; minY -= 1; }
-	if (zDiff == 0) { maxZ += 1; minZ -= 1; }
-
-	modelAABB.min = glm::vec3(minX, minY, minZ);
-	modelAABB.max = glm::vec3(maxX, maxY, maxZ);
+	if (m_bvhBuildSettings.autoTuneBVHs && !modelTriangles.empty())
+	{
+		std::cout << "Auto-tuned BVH for " << filePath << (loadedFromCache ? " (cached)" : "") << ": leaf size " << tuning.maxLeafTriangles
+			<< ", traversal cost " << tuning.traversalCost << ", intersection cost " << tuning.intersectionCost << ", " << tuning.binCount << " bins, "
+			<< tuning.nanosecondsPerRay << " ns per ray on the CPU over " << tuning.candidateCount << " candidates" << std::endl;
+	}
 
-	ParentBVHNode parentNode;
-	parentNode.node.aabb = modelAABB;
-	parentNode.objectIndex = -1;
-	parentNode.node.leftChild = -1;
-	parentNode.node.rightChild = -1;
-	parentNode.node.triangleStartIndex = 0;
-	parentNode.node.triangleCount = modelTriangles.size();
+	AppendModel(filePath, modelTriangles, modelBVH, parentNode, sourceVertexCount);
+}
 
+void HardwareRenderer::AppendModel(const std::string& modelName, std::vector<Triangle>& modelTriangles, std::vector<BVHNode>& modelBVH, ParentBVHNode& parentNode, int sourceVertexCount)
+{
+	Model newModel;
 	newModel.parentBVH = parentNode;
 
-	std::vector<BVHNode> modelBVH;
-	if (!modelTriangles.empty())
-		BuildBVH(modelTriangles, modelBVH, parentNode, m_aabbMins.size());
-	
 	newModel.triangleStartIndex = m_triangleV0s.size();
 	newModel.triangleCount = modelTriangles.size();
+	newModel.bvhNodeStartIndex = m_bvhNodes.size();
+	newModel.bvhNodeCount = modelBVH.size();
+	newModel.sourceVertexCount = sourceVertexCount;
 
 	// Now convert modelBVH node local starts into global indices and update child indices
-	int bvhGlobalOffset = static_cast<int>(m_aabbMins.size());
+	int bvhGlobalOffset = static_cast<int>(m_bvhNodes.size());
 	int triangleGlobalOffset = static_cast<int>(m_triangleV0s.size());
+
+	//Measured here rather than in the builders so cached and merged models get it too, the shader walks models too deep for its stack stackless.
+	parentNode.maxDepth = GetBVHMaxDepth(modelBVH, parentNode, bvhGlobalOffset);
+	if (parentNode.maxDepth >= BLAS_TRAVERSAL_STACK_SIZE && !UsesStacklessTraversal())
+		std::cout << modelName << " has a BVH depth of " << parentNode.maxDepth << ", too deep for the traversal stack, it will be traversed stackless" << std::endl;
+
+	int bvhWidth = GetEffectiveBVHWidth(m_bvhBuildSettings);
+	if (bvhWidth > 2)
+	{
+		std::vector<WideBVHChild> wideChildren;
+		std::vector<int> wideSourceNodes;
+		int wideRootIndex = CollapseToWideBVH(modelBVH, parentNode, bvhGlobalOffset, bvhWidth, wideChildren, wideSourceNodes);
+
+		//Trees the shader's wide stack can't hold keep only their binary nodes, without a wide root the shader traverses them as a binary BVH.
+		int wideStackSize = GetWideBVHStackSize(wideChildren, bvhWidth, wideRootIndex);
+		if (wideStackSize > WIDE_BVH_TRAVERSAL_STACK_SIZE)
+		{
+			std::cout << modelName << " needs " << wideStackSize << " wide traversal stack entries, it will be traversed as a binary BVH" << std::endl;
+			wideRootIndex = -1;
+			wideChildren.clear();
+			wideSourceNodes.clear();
+		}
+
+		int wideGlobalOffset = static_cast<int>(m_wideBVHChildren.size()) / bvhWidth;
+		parentNode.wideRootIndex = wideRootIndex != -1 ? wideRootIndex + wideGlobalOffset : -1;
+		newModel.wideBVHChildStartIndex = static_cast<int>(m_wideBVHChildren.size());
+		newModel.wideBVHChildCount = static_cast<int>(wideChildren.size());
+
+		for (size_t i = 0; i < wideChildren.size(); i++)
+		{
+			WideBVHChild& child = wideChildren[i];
+			if (child.index != -1)
+			{
+				child.index += child.triangleCount > 0 ? triangleGlobalOffset : wideGlobalOffset;
+				wideSourceNodes[i] += bvhGlobalOffset;
+			}
+
+			m_wideBVHChildren.push_back(child);
+			m_wideBVHSourceNodes.push_back(wideSourceNodes[i]);
+		}
+
+		int quantizationBits = GetEffectiveBVHQuantizationBits(m_bvhBuildSettings);
+		if (quantizationBits > 0)
+		{
+			int nodeWords = GetQuantizedWideNodeWords(bvhWidth, quantizationBits);
+			for (int child = newModel.wideBVHChildStartIndex; child < static_cast<int>(m_wideBVHChildren.size()); child += bvhWidth)
+			{
+				m_quantizedBVHWords.resize(m_quantizedBVHWords.size() + nodeWords);
+				QuantizeWideBVHNode(&m_wideBVHChildren[child], bvhWidth, quantizationBits, &m_quantizedBVHWords[m_quantizedBVHWords.size() - nodeWords]);
+			}
+		}
+	}
+
+	//Built for every model so the links stay aligned with the node buffers whichever traversal the pipeline uses.
+	std::vector<int> missLinks;
+	BuildBVHMissLinks(modelBVH, parentNode, bvhGlobalOffset, missLinks);
+	for (int missLink : missLinks)
+		m_bvhMissLinks.push_back(missLink != -1 ? missLink + bvhGlobalOffset : -1);
+
 	for (auto& node : modelBVH)
 	{
 		node.leftChild = node.leftChild != -1 ? node.leftChild + bvhGlobalOffset : -1;
@@ -1279,21 +1648,17 @@ void HardwareRenderer::LoadModel(const std::string& filePath)
 
 		node.triangleStartIndex += triangleGlobalOffset;
 
-		m_aabbMins.push_back(glm::vec4(node.aabb.min, 0.0f));
-		m_aabbMaxs.push_back(glm::vec4(node.aabb.max, 0.0f));
-
-		m_bvhLeftChildren.push_back(node.leftChild);
-		m_bvhRightChildren.push_back(node.rightChild);
-
-		m_bvhTriangleStartIndices.push_back(node.triangleStartIndex);
-		m_bvhTriangleCounts.push_back(node.triangleCount);
+		m_bvhNodes.push_back(PackBVHNode(node));
 	}
 
 	parentNode.node.triangleStartIndex += triangleGlobalOffset;
 
 	//Append reordered triangles to global list
+	newModel.triangleSourceIndices.reserve(modelTriangles.size());
 	for (auto& tri : modelTriangles)
 	{
+		newModel.triangleSourceIndices.push_back(tri.sourceIndex);
+
 		m_triangleV0s.push_back(glm::vec4(tri.v0, 0.0));
 		m_triangleV1s.push_back(glm::vec4(tri.v1, 0.0));
 		m_triangleV2s.push_back(glm::vec4(tri.v2, 0.0));
@@ -1310,7 +1675,232 @@ void HardwareRenderer::LoadModel(const std::string& filePath)
 
 	// store parent BVH and model
 	newModel.parentBVH = parentNode;
-	m_models[filePath] = newModel;
+	m_models[modelName] = newModel;
+}
+
+void HardwareRenderer::BuildModelGrid(Model& model)
+{
+	std::vector<Triangle> gridTriangles(model.triangleCount);
+	for (int i = 0; i < model.triangleCount; i++)
+	{
+		Triangle& triangle = gridTriangles[i];
+		triangle.v0 = glm::vec3(m_triangleV0s[model.triangleStartIndex + i]);
+		triangle.v1 = glm::vec3(m_triangleV1s[model.triangleStartIndex + i]);
+		triangle.v2 = glm::vec3(m_triangleV2s[model.triangleStartIndex + i]);
+
+		triangle.bounds = EmptyAABB();
+		triangle.bounds.Grow(triangle.v0);
+		triangle.bounds.Grow(triangle.v1);
+		triangle.bounds.Grow(triangle.v2);
+	}
+
+	BuildTriangleGrid(gridTriangles, GridBuildSettings(), model.grid);
+}
+
+bool HardwareRenderer::UsesStacklessTraversal() const
+{
+	return m_bvhBuildSettings.stacklessTraversal && GetEffectiveBVHWidth(m_bvhBuildSettings) == 2;
+}
+
+bool HardwareRenderer::UsesBinaryBVHNodes() const
+{
+	if (GetEffectiveBVHWidth(m_bvhBuildSettings) == 2)
+		return true;
+
+	//Rebraiding is off for wide BVHs, so binary nodes are only read for models whose wide tree was dropped for being too deep for the stack.
+	for (const auto& [modelName, model] : m_models)
+	{
+		if (model.parentBVH.wideRootIndex == -1 && model.parentBVH.node.leftChild != -1)
+			return true;
+	}
+
+	return false;
+}
+
+bool HardwareRenderer::UsesTopLevelRebraiding() const
+{
+	return m_bvhBuildSettings.rebraidTopLevel && GetEffectiveBVHWidth(m_bvhBuildSettings) == 2 &&
+		m_bvhBuildSettings.accelerationStructure == ModelAccelerationStructure::BVH;
+}
+
+void HardwareRenderer::RefitModel(const std::string& filePath, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals)
+{
+	auto modelIt = m_models.find(filePath);
+	if (modelIt == m_models.end())
+	{
+		std::string error = filePath + " has not been loaded.";
+		throw std::exception(error.c_str());
+	}
+
+	Model& model = modelIt->second;
+	if (static_cast<int>(positions.size()) != model.sourceVertexCount || (!normals.empty() && static_cast<int>(normals.size()) != model.sourceVertexCount))
+		throw std::exception("Refit vertex count does not match the loaded model.");
+
+	std::lock_guard<std::mutex> lock(m_renderMutex);
+
+	for (int i = 0; i < model.triangleCount; i++)
+	{
+		int triangleIndex = model.triangleStartIndex + i;
+		int sourceVertex = model.triangleSourceIndices[i] * 3;
+
+		m_triangleV0s[triangleIndex] = glm::vec4(positions[sourceVertex], 0.0f);
+		m_triangleV1s[triangleIndex] = glm::vec4(positions[sourceVertex + 1], 0.0f);
+		m_triangleV2s[triangleIndex] = glm::vec4(positions[sourceVertex + 2], 0.0f);
+
+		if (normals.empty())
+			continue;
+
+		if (normals[sourceVertex] != glm::vec3(0.0f) &&
+			normals[sourceVertex + 1] != glm::vec3(0.0f) &&
+			normals[sourceVertex + 2] != glm::vec3(0.0f))
+		{
+			m_triangleN0s[triangleIndex] = glm::vec4(glm::normalize(normals[sourceVertex]), 0.0f);
+			m_triangleN1s[triangleIndex] = glm::vec4(glm::normalize(normals[sourceVertex + 1]), 0.0f);
+			m_triangleN2s[triangleIndex] = glm::vec4(glm::normalize(normals[sourceVertex + 2]), 0.0f);
+		}
+		else
+		{
+			glm::vec3 edge1 = positions[sourceVertex + 1] - positions[sourceVertex];
+			glm::vec3 edge2 = positions[sourceVertex + 2] - positions[sourceVertex];
+			glm::vec4 faceNormal = glm::vec4(glm::normalize(glm::cross(edge1, edge2)), 0.0f);
+			m_triangleN0s[triangleIndex] = faceNormal;
+			m_triangleN1s[triangleIndex] = faceNormal;
+			m_triangleN2s[triangleIndex] = faceNormal;
+		}
+	}
+
+	auto growByTriangles = [this](glm::vec3& outMin, glm::vec3& outMax, int start, int count)
+		{
+			outMin = glm::vec3(FLT_MAX);
+			outMax = glm::vec3(-FLT_MAX);
+			for (int t = start; t < start + count; t++)
+			{
+				outMin = glm::min(outMin, glm::vec3(glm::min(m_triangleV0s[t], glm::min(m_triangleV1s[t], m_triangleV2s[t]))));
+				outMax = glm::max(outMax, glm::vec3(glm::max(m_triangleV0s[t], glm::max(m_triangleV1s[t], m_triangleV2s[t]))));
+			}
+		};
+
+	//Children are always stored after their parent, so walking the model's nodes backwards visits every child before its parent.
+	for (int node = model.bvhNodeStartIndex + model.bvhNodeCount - 1; node >= model.bvhNodeStartIndex; node--)
+	{
+		PackedBVHNode& packedNode = m_bvhNodes[node];
+		if (packedNode.IsLeaf())
+		{
+			growByTriangles(packedNode.min, packedNode.max, packedNode.leftChildOrFirstTriangle, packedNode.GetTriangleCount());
+			continue;
+		}
+
+		const PackedBVHNode& left = m_bvhNodes[packedNode.leftChildOrFirstTriangle];
+		const PackedBVHNode& right = m_bvhNodes[packedNode.rightChildOrTriangleCount];
+		packedNode.min = glm::min(left.min, right.min);
+		packedNode.max = glm::max(left.max, right.max);
+	}
+
+	BVHNode& root = model.parentBVH.node;
+	glm::vec3 rootMin, rootMax;
+	if (root.leftChild == -1)
+	{
+		growByTriangles(rootMin, rootMax, root.triangleStartIndex, root.triangleCount);
+	}
+	else
+	{
+		rootMin = glm::min(m_bvhNodes[root.leftChild].min, m_bvhNodes[root.rightChild].min);
+		rootMax = glm::max(m_bvhNodes[root.leftChild].max, m_bvhNodes[root.rightChild].max);
+	}
+
+	root.aabb.min = rootMin;
+	root.aabb.max = rootMax;
+	PadFlatAABB(root.aabb);
+
+	//Grids build faster than the BVH refits, so they are simply rebuilt from the moved triangles.
+	if (!model.grid.topCells.empty())
+		BuildModelGrid(model);
+
+	size_t triangleOffset = sizeof(glm::vec4) * model.triangleStartIndex;
+	size_t triangleSize = sizeof(glm::vec4) * model.triangleCount;
+	UploadBufferRange(m_triangleV0Buffer, m_triangleV0s.data() + model.triangleStartIndex, triangleOffset, triangleSize);
+	UploadBufferRange(m_triangleV1Buffer, m_triangleV1s.data() + model.triangleStartIndex, triangleOffset, triangleSize);
+	UploadBufferRange(m_triangleV2Buffer, m_triangleV2s.data() + model.triangleStartIndex, triangleOffset, triangleSize);
+
+	if (!normals.empty())
+	{
+		UploadBufferRange(m_triangleN0Buffer, m_triangleN0s.data() + model.triangleStartIndex, triangleOffset, triangleSize);
+		UploadBufferRange(m_triangleN1Buffer, m_triangleN1s.data() + model.triangleStartIndex, triangleOffset, triangleSize);
+		UploadBufferRange(m_triangleN2Buffer, m_triangleN2s.data() + model.triangleStartIndex, triangleOffset, triangleSize);
+	}
+
+	//The refit itself works on m_bvhNodes, the GPU copy only exists when the shader reads binary nodes.
+	if (UsesBinaryBVHNodes())
+	{
+		size_t nodeOffset = sizeof(PackedBVHNode) * model.bvhNodeStartIndex;
+		size_t nodeSize = sizeof(PackedBVHNode) * model.bvhNodeCount;
+		UploadBufferRange(m_bvhNodeBuffer, m_bvhNodes.data() + model.bvhNodeStartIndex, nodeOffset, nodeSize);
+	}
+
+	if (model.wideBVHChildCount > 0)
+	{
+		for (int i = model.wideBVHChildStartIndex; i < model.wideBVHChildStartIndex + model.wideBVHChildCount; i++)
+		{
+			int sourceNode = m_wideBVHSourceNodes[i];
+			if (sourceNode == -1)
+				continue;
+
+			m_wideBVHChildren[i].min = m_bvhNodes[sourceNode].min;
+			m_wideBVHChildren[i].max = m_bvhNodes[sourceNode].max;
+		}
+
+		int bvhWidth = GetEffectiveBVHWidth(m_bvhBuildSettings);
+		int quantizationBits = GetEffectiveBVHQuantizationBits(m_bvhBuildSettings);
+		if (m_quantizedBVHWords.empty())
+		{
+			UploadBufferRange(m_wideBVHBuffer, m_wideBVHChildren.data() + model.wideBVHChildStartIndex, sizeof(WideBVHChild) * model.wideBVHChildStartIndex, sizeof(WideBVHChild) * model.wideBVHChildCount);
+		}
+		else
+		{
+			int nodeWords = GetQuantizedWideNodeWords(bvhWidth, quantizationBits);
+			int firstWord = model.wideBVHChildStartIndex / bvhWidth * nodeWords;
+			for (int child = model.wideBVHChildStartIndex; child < model.wideBVHChildStartIndex + model.wideBVHChildCount; child += bvhWidth)
+				QuantizeWideBVHNode(&m_wideBVHChildren[child], bvhWidth, quantizationBits, &m_quantizedBVHWords[child / bvhWidth * nodeWords]);
+
+			UploadBufferRange(m_quantizedBVHBuffer, m_quantizedBVHWords.data() + firstWord, sizeof(uint32_t) * firstWord, sizeof(uint32_t) * (model.wideBVHChildCount / bvhWidth) * nodeWords);
+		}
+	}
+
+	//Objects using the model need their world space and local bounds updated. Merged static meshes keep the pose they were baked with.
+	for (size_t i = 0; i < m_sceneObjects.size() && i < m_sceneObjectGPUIndices.size(); i++)
+	{
+		int gpuIndex = m_sceneObjectGPUIndices[i];
+		if (m_sceneObjects[i].modelName != filePath || gpuIndex == -1)
+			continue;
+
+		m_parentBVH[gpuIndex].node.aabb = GetInstanceBounds(model, GetObjectTransform(m_sceneObjects[i]));
+		UploadBufferRange(m_parentBVHBuffer, &m_parentBVH[gpuIndex], sizeof(ParentBVHNode) * gpuIndex, sizeof(ParentBVHNode));
+
+		m_gpuSceneObjects[gpuIndex].localBounds = root.aabb;
+		UploadBufferRange(m_sceneObjectBuffer, &m_gpuSceneObjects[gpuIndex], sizeof(GPUObject) * gpuIndex, sizeof(GPUObject));
+	}
+
+	if (!m_topLevelBVH.empty())
+	{
+		std::vector<AABB> instanceBounds;
+		for (const ParentBVHNode& parentNode : m_parentBVH)
+			instanceBounds.push_back(parentNode.node.aabb);
+
+		if (UsesTopLevelRebraiding())
+		{
+			BuildTopLevelBVHFromObjects();
+		}
+		else
+		{
+			RefitTopLevelBVH(instanceBounds, m_topLevelBVH);
+			if (GetTopLevelBVHCost(m_topLevelBVH) > m_topLevelBVHBuildCost * TOP_LEVEL_REBUILD_THRESHOLD)
+				BuildTopLevelBVHFromObjects();
+		}
+
+		UploadBufferRange(m_topLevelBVHBuffer, m_topLevelBVH.data(), 0, sizeof(BVHNode) * m_topLevelBVH.size());
+	}
+
+	m_bRefreshAccumulation = true;
 }
 
 void HardwareRenderer::ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
@@ -1365,4 +1955,15 @@ AllocatedBuffer HardwareRenderer::CreateBuffer(size_t allocSize, VkBufferUsageFl
 void HardwareRenderer::DestroyBuffer(const AllocatedBuffer& buffer)
 {
 	vmaDestroyBuffer(m_allocator, buffer.m_buffer, buffer.m_allocation);
+}
+
+void HardwareRenderer::UploadBufferRange(const AllocatedBuffer& buffer, const void* data, size_t offset, size_t size)
+{
+	if (size == 0)
+		return;
+
+	void* mappedData;
+	vmaMapMemory(m_allocator, buffer.m_allocation, &mappedData);
+	memcpy(static_cast<char*>(mappedData) + offset, data, size);
+	vmaUnmapMemory(m_allocator, buffer.m_allocation);
 }
\ No newline at end of file
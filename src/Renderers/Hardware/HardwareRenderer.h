@@ -19,6 +19,7 @@
 #include "InputManager.h"
 #include "PerformanceStats.h"
 #include "RaytracerTypes.h"
+#include "../TriangleGrid.h"
 #include "CameraController.h"
 #include "Imgui/ImGui.h"
 
@@ -79,7 +80,20 @@ struct Model
 	int triangleStartIndex = -1;
 	int triangleCount = 0;
 
+	int bvhNodeStartIndex = -1;
+	int bvhNodeCount = 0;
+
+	int wideBVHChildStartIndex = -1;
+	int wideBVHChildCount = 0;
+
+	//Vertex count of the source mesh and the source triangle behind each stored triangle, used to refit from new vertex positions.
+	int sourceVertexCount = 0;
+	std::vector<int> triangleSourceIndices;
+
 	ParentBVHNode parentBVH;
+
+	//Only built by RenderOnCPU when models are traced with a grid, its triangle indices are relative to triangleStartIndex.
+	TriangleGrid grid;
 };
 
 struct SceneObject
@@ -89,6 +103,9 @@ struct SceneObject
 	glm::vec3 rotation = glm::vec3(0, 0, 0);
 	glm::vec3 scale = glm::vec3(1, 1, 1);
 	int materialIndex = -1;
+
+	//Static objects never move, small ones are baked into a merged world space mesh when the scene is buffered and can't be edited afterwards.
+	bool isStatic = false;
 };
 
 class HardwareRenderer
@@ -166,6 +183,7 @@ private:
 	PerformanceStats m_performanceStats;
 	InputManager m_inputManager;
 
+	BVHBuildSettings m_bvhBuildSettings;
 	std::unordered_map<std::string, Model> m_models;
 	std::vector<SceneObject> m_sceneObjects;
 
@@ -174,6 +192,9 @@ private:
 	std::vector<GPUObject> m_gpuSceneObjects;
 	AllocatedBuffer m_sceneObjectBuffer;
 
+	//GPU object of each scene object, -1 for static objects merged into a shared mesh. Merged meshes come after every scene object's entry.
+	std::vector<int> m_sceneObjectGPUIndices;
+
 	std::vector<glm::vec4> m_triangleV0s;
 	AllocatedBuffer m_triangleV0Buffer;
 
@@ -204,23 +225,37 @@ private:
 	std::vector<ParentBVHNode> m_parentBVH;
 	AllocatedBuffer m_parentBVHBuffer;
 
-	std::vector<glm::vec4> m_aabbMins;
-	AllocatedBuffer m_aabbMinBuffer;
+	//BVH over the world space bounds of m_parentBVH, leaves index into it. Lets rays skip objects without testing each one.
+	std::vector<BVHNode> m_topLevelBVH;
+	AllocatedBuffer m_topLevelBVHBuffer;
 
-	std::vector<glm::vec4> m_aabbMaxs;
-	AllocatedBuffer m_aabbMaxBuffer;
+	//Refitted top level trees are rebuilt once their cost exceeds the cost at build time by this factor.
+	constexpr static float TOP_LEVEL_REBUILD_THRESHOLD = 1.5f;
 
-	std::vector<int> m_bvhLeftChildren;
-	AllocatedBuffer m_bvhLeftChildrenBuffer;
+	//Depth of the model BVH nodes whose transformed boxes make up an instance's world bounds.
+	constexpr static int INSTANCE_BOUNDS_DEPTH = 3;
 
-	std::vector<int> m_bvhRightChildren;
-	AllocatedBuffer m_bvhRightChildrenBuffer;
+	//Links for updating single objects in place, and the tree's cost when it was built to tell when refits have degraded it.
+	std::vector<int> m_topLevelBVHParents;
+	std::vector<int> m_topLevelBVHInstanceLeaves;
+	float m_topLevelBVHBuildCost = 0.0f;
 
-	std::vector<int> m_bvhTriangleStartIndices;
-	AllocatedBuffer m_bvhTriangleStartIndicesBuffer;
+	//Binary BVH nodes of every model, children and triangle indices are global.
+	std::vector<PackedBVHNode> m_bvhNodes;
+	AllocatedBuffer m_bvhNodeBuffer;
 
-	std::vector<int> m_bvhTriangleCounts;
-	AllocatedBuffer m_bvhTriangleCountsBuffer;
+	//Escape links for the stackless traversal, one per binary node.
+	std::vector<int> m_bvhMissLinks;
+	AllocatedBuffer m_bvhMissLinksBuffer;
+
+	//Wide nodes mirror the binary tree when bvhWidth is 4 or 8, source nodes map each slot back to its binary node for refits.
+	std::vector<WideBVHChild> m_wideBVHChildren;
+	std::vector<int> m_wideBVHSourceNodes;
+	AllocatedBuffer m_wideBVHBuffer;
+
+	//Quantized copy of the wide nodes, replaces m_wideBVHBuffer on the GPU when bvhQuantizationBits is set.
+	std::vector<uint32_t> m_quantizedBVHWords;
+	AllocatedBuffer m_quantizedBVHBuffer;
 
 	std::vector<GPUMaterial> m_sceneMaterials;
 	AllocatedBuffer m_sceneMaterialBuffer;
@@ -255,15 +290,24 @@ private:
 	void Quit();
 
 	int GetMaterialIndex(const GPUMaterial& material);
-	void AddSceneObject(std::string modelPath, glm::vec3 position, glm::vec3 rotation, glm::vec3 scale, const GPUMaterial& material);
-	void ConvertSceneObjectToGPUObject(const SceneObject& obj);
+	void AddSceneObject(std::string modelPath, glm::vec3 position, glm::vec3 rotation, glm::vec3 scale, const GPUMaterial& material, bool isStatic = false);
+	void AppendModel(const std::string& modelName, std::vector<Triangle>& modelTriangles, std::vector<BVHNode>& modelBVH, ParentBVHNode& parentNode, int sourceVertexCount);
+	bool IsMergedStaticObject(const SceneObject& obj) const;
+	std::string BuildMergedStaticModel(int materialIndex, const std::vector<int>& objectIndices);
+	void BuildModelGrid(Model& model);
+	AABB GetInstanceBounds(const Model& model, const glm::mat4& objectMat) const;
+	void ConvertSceneObjectToGPUObject(const SceneObject& obj, int objectIndex, GPUObject& outObject, ParentBVHNode& outParentNode);
+	void BuildTopLevelBVHFromObjects();
+	bool UsesStacklessTraversal() const;
+	bool UsesBinaryBVHNodes() const;
+	bool UsesTopLevelRebraiding() const;
 
 	void InitializeUIs();
 	void InitializeScene();
+	void PrepareSceneData();
 	void BufferSceneData();
-	void ClearSceneData();
-	void RebufferSceneData();
 
+	void UpdatePushConstants(uint32_t width, uint32_t height);
 	void DispatchRayTracingCommands(VkCommandBuffer cmd);
 	void RefreshAccumulation(VkCommandBuffer cmd);
 	void RenderImGui(VkCommandBuffer cmd, VkImage targetImage, VkImageView targetImageView);
@@ -275,16 +319,54 @@ private:
 
 	void ProduceRender();
 	void WriteDrawImageToFile();
+	void WriteRenderToFile(const float* floatPixels, uint32_t width, uint32_t height);
 
 public:
 
 	void InitializeRenderer();
+
+	/**
+	* Renders the default scene for the given number of accumulated frames on the CPU backend and writes it to Renders, without creating
+	* a window or any Vulkan objects. For machines without a GPU. 0 threads uses every hardware thread.
+	*/
+	void RenderOnCPU(int width, int height, int frames, int threadCount = 0);
+
 	void LoadModel(const std::string& filePath);
 
+	/**
+	* Moves the vertices of a loaded model and refits its BVH bottom up instead of rebuilding it. Positions and normals are per vertex in the order
+	* the OBJ was loaded, three per triangle. Normals are left unchanged if none are given. Only the model's ranges of the GPU buffers are re-uploaded.
+	* Tree quality degrades as the mesh moves away from the pose it was built in, reload the model for large deformations.
+	*/
+	void RefitModel(const std::string& filePath, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals = {});
+
+	/**
+	* Re-uploads one scene object after its transform or material changed. Only the object's entries and the top level nodes above it are
+	* written, the top level BVH is refitted rather than rebuilt unless the refits have made it much worse than a fresh build.
+	*/
+	void UpdateSceneObject(int objectIndex);
+
+	/**
+	* True if the scene object was baked into a merged static mesh the last time the scene was buffered. Merged objects can't be updated.
+	*/
+	bool IsSceneObjectMerged(int objectIndex) const;
+
+	/**
+	* Re-uploads one material after it has been edited.
+	*/
+	void UpdateSceneMaterial(int materialIndex);
+
 	void SetDoRender() { m_bDoRender = true; }
 	void SetRenderFrames(int frames) { m_iRenderFrames = frames; }
 	void SetRefreshAccumulation() { m_bRefreshAccumulation = true; }
 
+	/**
+	* Sets the builder used for models loaded after this call. Models that are already loaded keep their BVH.
+	* The BVH width and traversal are baked into the raytracing pipeline and only take effect if set before InitializeRenderer.
+	*/
+	void SetBVHBuildSettings(const BVHBuildSettings& settings) { m_bvhBuildSettings = settings; }
+	const BVHBuildSettings& GetBVHBuildSettings() const { return m_bvhBuildSettings; }
+
 	InputManager* GetInputManager() { return &m_inputManager; }
 	PerformanceStats* GetPerformanceStats() { return &m_performanceStats; }
 	Window* GetWindow() { return m_pWindow; }
@@ -303,6 +385,7 @@ public:
 	void ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 	AllocatedBuffer CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, std::string allocationName);
 	void DestroyBuffer(const AllocatedBuffer& buffer);
+	void UploadBufferRange(const AllocatedBuffer& buffer, const void* data, size_t offset, size_t size);
 
 	VkFormat GetDrawImageFormat() { return m_drawImage.m_imageFormat; }
 	AllocatedImage* GetDrawImage() { return &m_drawImage; }
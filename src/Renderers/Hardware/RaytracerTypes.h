@@ -9,10 +9,8 @@
 #include <functional>
 #include <deque>
 #include <iostream>
-
-#include <vulkan/vulkan.h>
-#include <vulkan/vk_enum_string_helper.h>
-#include <vk_mem_alloc.h>
+#include <cfloat>
+#include <climits>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/mat4x4.hpp>
@@ -88,15 +86,170 @@ struct BVHNode
 	int triangleCount;
 };
 
+/**
+* One child slot of a wide BVH node. A wide node is BVHBuildSettings::bvhWidth consecutive slots, unused slots have an index of -1.
+*/
+struct WideBVHChild
+{
+	glm::vec3 min;
+	int index;  //Wide node index for internal children, first triangle for leaves.
+	glm::vec3 max;
+	int triangleCount;  //0 for internal children.
+};
+
+/**
+* Binary BVH node in the format the GPU and the renderer's refits read, 32 bytes so visiting a node touches a single cache line.
+* Internal nodes store both children, as node layouts other than Build do not keep siblings together. Leaves store their first
+* triangle and the bitwise complement of their triangle count, which makes the second field negative exactly for leaves.
+*/
+struct PackedBVHNode
+{
+	glm::vec3 min;
+	int leftChildOrFirstTriangle;
+	glm::vec3 max;
+	int rightChildOrTriangleCount;
+
+	bool IsLeaf() const { return rightChildOrTriangleCount < 0; }
+	int GetTriangleCount() const { return IsLeaf() ? ~rightChildOrTriangleCount : 0; }
+};
+
+/**
+* Entries in the traversal stacks of raytrace.comp and the CPU backend, given to the shader as specialization constants.
+* The ordered traversals need one more entry than the depth of the tree, top level BVHs are built to fit and BLAS that don't are walked stackless.
+* Models whose wide tree needs more than WIDE_BVH_TRAVERSAL_STACK_SIZE entries, see GetWideBVHStackSize, are traversed as binary BVHs.
+*/
+static const int BLAS_TRAVERSAL_STACK_SIZE = 32;
+static const int WIDE_BVH_TRAVERSAL_STACK_SIZE = 32;
+static const int TOP_LEVEL_TRAVERSAL_STACK_SIZE = 64;
+
 struct ParentBVHNode
 {
 	BVHNode node;
 	int objectIndex;
-	int padding1;
-	int padding2;
+	int wideRootIndex = -1;
+	int maxDepth = 0;  //Depth of the model's deepest leaf, the root is depth 0.
 	int padding3;
 };
 
+enum class BVHBuildMethod
+{
+	Midpoint,
+	SAH,
+	LBVH,
+	SBVH,
+	IndexedSAH,
+	PLOC
+};
+
+enum class BVHNodeLayout
+{
+	Build,
+	DepthFirst,
+	VanEmdeBoas
+};
+
+enum class ModelAccelerationStructure
+{
+	BVH,
+	TriangleGrid
+};
+
+struct BVHBuildSettings
+{
+	BVHBuildMethod method = BVHBuildMethod::SAH;
+
+	//Number of centroid bins evaluated per axis by the SAH builder.
+	int binCount = 16;
+
+	//Relative costs used by the SAH, a split is only made if it is cheaper than intersecting every triangle in the node.
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.0f;
+
+	//Nodes with this many triangles or fewer are never split, by any builder. Larger leaves mean fewer nodes to test but more triangles per leaf.
+	int maxLeafTriangles = 2;
+
+	//Builds SAH trees on a thread pool, 0 threads uses every hardware thread.
+	bool parallelBuild = true;
+	int threadCount = 0;
+
+	//Subtrees with at least this many triangles are forked onto the pool, and nodes above the pass cutoff also bin and partition in parallel.
+	int parallelTaskCutoff = 4096;
+	int parallelPassCutoff = 65536;
+
+	//Morton code length used by the LBVH builder, 30 or 63 bits. 63 bit codes separate dense meshes better but double the sort passes.
+	int mortonCodeBits = 30;
+
+	//Clusters either side of each cluster the PLOC builder searches for its nearest neighbour. Wider searches find better pairs but take longer.
+	int plocSearchRadius = 16;
+
+	//Spatial splits are only tried when the object split children overlap by more than this fraction of the root surface area.
+	float spatialSplitAlpha = 1e-5f;
+
+	//Maximum number of duplicated triangle references the SBVH builder may create, as a fraction of the model's triangle count.
+	float spatialSplitBudget = 0.3f;
+
+	//Branching factor of the BVH the GPU traverses. 4 or 8 collapse the binary tree into wide nodes with their child bounds stored together.
+	//It is baked into the raytracing pipeline, so it has to be set before the renderer is initialized.
+	int bvhWidth = 2;
+
+	//Walks the binary BVH on the GPU with precomputed escape links instead of a per ray stack. Uses fewer registers and has no depth limit,
+	//but cannot visit the nearer child first. Baked into the pipeline and ignored when bvhWidth is above 2.
+	bool stacklessTraversal = false;
+
+	//Opens large instances that overlap other instances into their BLAS subtrees in the top level BVH, so rays are not forced into several big
+	//instance boxes. The top level may grow to rebraidBudget references per instance. Needs binary nodes, so it is ignored when bvhWidth is above 2.
+	bool rebraidTopLevel = false;
+	float rebraidBudget = 4.0f;
+
+	//Stores wide node child bounds as 8 or 16 bit offsets from the node's bounds instead of floats, 0 keeps full precision. Also baked into the pipeline.
+	int bvhQuantizationBits = 0;
+
+	//Restructures treelets of up to treeletLeafCount leaves after the build to lower the SAH cost. Worth the extra build time for long renders.
+	bool optimizeTreelets = false;
+	int treeletLeafCount = 7;
+	int treeletPasses = 3;
+
+	//Milliseconds the treelet optimizer may spend per model, 0 means no limit.
+	float treeletTimeBudget = 2000.0f;
+
+	//Order the nodes are stored in after the build. Build keeps each builder's own order, DepthFirst and VanEmdeBoas improve cache locality on large models.
+	BVHNodeLayout nodeLayout = BVHNodeLayout::Build;
+
+	//Splits triangles whose bounds are much larger than the triangle itself into several references with clipped bounds before any builder runs.
+	//Only triangles whose bounds area is over preSplitThreshold times their own area are split, up to preSplitBudget times the triangle count.
+	bool preSplitTriangles = false;
+	float preSplitThreshold = 8.0f;
+	float preSplitBudget = 0.1f;
+
+	//Static scene objects whose model has at most this many triangles are baked into one world space mesh per material, with its own BVH.
+	//Saves rays the instance transform and a separate BVH descent for trivial geometry, 0 keeps every object as its own instance.
+	int staticMergeTriangleThreshold = 256;
+
+	//Sweeps maxLeafTriangles, the traversal to intersection cost ratio and binCount for every model the first time it is built, timing each
+	//candidate tree on autoTuneRayCount sample rays, and builds with the fastest. The winner is kept in the model's cache.
+	bool autoTuneBVHs = false;
+	int autoTuneRayCount = 4096;
+
+	//Structure the CPU renderer traces each model's triangles with. TriangleGrid walks a two level grid instead of descending the model's BVH,
+	//built when a CPU render starts, the GPU always uses the BVH. Rebraiding is turned off with grids, since it places BLAS nodes in the top level.
+	ModelAccelerationStructure accelerationStructure = ModelAccelerationStructure::BVH;
+
+	//Keeps each model's triangles and BVH in a .bvhcache file next to it, so unchanged models skip parsing and building on later loads.
+	bool cacheBVHs = true;
+};
+
+struct BVHBuildStats
+{
+	//Triangle references added by spatial splits, each one is an extra copy in the model's triangle list.
+	int duplicatedReferences = 0;
+
+	//Triangle references added by pre-splitting, counted the same way.
+	int preSplitReferences = 0;
+
+	//Treelets the optimizer replaced with a cheaper topology.
+	int restructuredTreelets = 0;
+};
+
 struct Triangle
 {
 	glm::vec3 v0;
@@ -112,6 +265,12 @@ struct Triangle
 	glm::vec3 n2;
 
 	glm::vec3 triCentroid;
+
+	//Bounds the builders use for this reference. They only differ from the triangle's own bounds when pre-splitting has clipped it.
+	AABB bounds;
+
+	//Index of the triangle in the source mesh, builders reorder and may duplicate triangles.
+	int sourceIndex = -1;
 };
 
 struct GPUObject
@@ -122,6 +281,9 @@ struct GPUObject
 	float padding;
 
 	glm::mat4 inverseTransform;
+
+	//Bounds of the model in its own space, rays are tested against them before the BLAS as the world bounds of a rotated instance are loose.
+	AABB localBounds;
 };
 
 struct GPUMaterial
@@ -146,4 +308,41 @@ struct GPUMaterial
 			(refractiveIndex == other.refractiveIndex) &&
 			(absorbtion == other.absorbtion);
 	}
-};
\ No newline at end of file
+};
+
+struct Vertex
+{
+	glm::vec3 m_position = glm::vec3(0, 0, 0);
+	float m_uvX = 0;
+	glm::vec3 m_normal = glm::vec3(0, 0, 0);
+	float m_uvY = 0;
+
+	bool operator==(const Vertex& other) const
+	{
+		return m_position == other.m_position && m_normal == other.m_normal && m_uvX == other.m_uvX && m_uvY == other.m_uvY;
+	}
+
+	Vertex() {};
+	Vertex(glm::vec3 pos, glm::vec2 uv, glm::vec3 normal)
+	{
+		m_position = pos;
+		m_normal = normal;
+
+		m_uvX = uv.x;
+		m_uvY = uv.y;
+	}
+};
+
+namespace std
+{
+	template<> struct hash<Vertex>
+	{
+		size_t operator()(Vertex const& vertex) const
+		{
+			return ((hash<glm::vec3>()(vertex.m_position) ^
+				(hash<glm::vec3>()(vertex.m_normal) << 1) >> 1 ^
+				(hash<float>()(vertex.m_uvX) << 1) >> 1 ^
+				(hash<float>()(vertex.m_uvY) << 1) >> 1));
+		}
+	};
+}
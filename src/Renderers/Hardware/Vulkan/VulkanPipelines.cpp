@@ -52,6 +52,42 @@ bool LoadShaderModule(const char* filePath,
 }
 
 
+bool ShaderHasSpecializationConstant(const char* filePath, uint32_t constantId)
+{
+    std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    size_t fileSize = (size_t)file.tellg();
+    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+    file.seekg(0);
+    file.read((char*)buffer.data(), fileSize);
+    file.close();
+
+    // the first 5 words are the header, each instruction after it starts with its word count in the high 16 bits and its opcode in the low 16
+    const uint32_t opDecorate = 71;
+    const uint32_t decorationSpecId = 1;
+    size_t wordIndex = 5;
+    while (wordIndex < buffer.size()) {
+        uint32_t wordCount = buffer[wordIndex] >> 16;
+        uint32_t opcode = buffer[wordIndex] & 0xFFFF;
+        if (wordCount == 0) {
+            return false;
+        }
+
+        // OpDecorate <target> SpecId <constant id>
+        if (opcode == opDecorate && wordCount == 4 && wordIndex + 3 < buffer.size()
+            && buffer[wordIndex + 2] == decorationSpecId && buffer[wordIndex + 3] == constantId) {
+            return true;
+        }
+
+        wordIndex += wordCount;
+    }
+    return false;
+}
+
 void PipelineBuilder::Clear()
 {
     //clear all of the structs we need back to 0 with their correct stype	
@@ -71,6 +107,10 @@ void PipelineBuilder::Clear()
     m_renderInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
 
     m_shaderStages.clear();
+
+    m_specializationEntries.clear();
+    m_specializationData.clear();
+    m_specializationInfo = {};
 }
 
 void PipelineBuilder::SetShaders(VkShaderModule vertexShader, VkShaderModule fragmentShader)
@@ -88,6 +128,17 @@ void PipelineBuilder::SetComputeShader(VkShaderModule computeShader)
     m_shaderStages.push_back(PipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, computeShader));
 }
 
+void PipelineBuilder::AddSpecializationConstant(uint32_t constantId, int value)
+{
+    VkSpecializationMapEntry entry = {};
+    entry.constantID = constantId;
+    entry.offset = static_cast<uint32_t>(m_specializationData.size() * sizeof(int));
+    entry.size = sizeof(int);
+
+    m_specializationEntries.push_back(entry);
+    m_specializationData.push_back(value);
+}
+
 
 void PipelineBuilder::SetInputTopology(VkPrimitiveTopology topology)
 {
@@ -255,6 +306,15 @@ VkPipeline PipelineBuilder::BuildComputePipeline(VkDevice device)
 	pipelineInfo.stage = m_shaderStages[0];
 	pipelineInfo.layout = m_pipelineLayout;
 
+    if (!m_specializationEntries.empty())
+    {
+        m_specializationInfo.mapEntryCount = static_cast<uint32_t>(m_specializationEntries.size());
+        m_specializationInfo.pMapEntries = m_specializationEntries.data();
+        m_specializationInfo.dataSize = m_specializationData.size() * sizeof(int);
+        m_specializationInfo.pData = m_specializationData.data();
+        pipelineInfo.stage.pSpecializationInfo = &m_specializationInfo;
+    }
+
 	VkPipeline newPipeline;
 	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
 		nullptr, &newPipeline)
@@ -7,6 +7,7 @@
 
 
 bool LoadShaderModule(const char* filePath, VkDevice device, VkShaderModule* outShaderModule);
+bool ShaderHasSpecializationConstant(const char* filePath, uint32_t constantId);
 
 class PipelineBuilder
 {
@@ -22,12 +23,17 @@ class PipelineBuilder
     VkPipelineRenderingCreateInfo m_renderInfo;
     VkFormat m_colorAttachmentFormat;
 
+    std::vector<VkSpecializationMapEntry> m_specializationEntries;
+    std::vector<int> m_specializationData;
+    VkSpecializationInfo m_specializationInfo;
+
     PipelineBuilder() { Clear(); }
 
     void Clear();
 
     void SetShaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
     void SetComputeShader(VkShaderModule computeShader);
+    void AddSpecializationConstant(uint32_t constantId, int value);
     void SetInputTopology(VkPrimitiveTopology topology);
     void SetPolygonMode(VkPolygonMode mode);
     void SetCullMode(VkCullModeFlags cullMode, VkFrontFace frontFace);
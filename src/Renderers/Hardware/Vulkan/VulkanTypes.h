@@ -35,43 +35,6 @@ struct AllocatedBuffer
     VmaAllocationInfo m_info;
 };
 
-struct Vertex
-{
-    glm::vec3 m_position = glm::vec3(0, 0, 0);
-    float m_uvX = 0;
-    glm::vec3 m_normal = glm::vec3(0, 0, 0);
-    float m_uvY = 0;
-
-    bool operator==(const Vertex& other) const
-    {
-        return m_position == other.m_position && m_normal == other.m_normal && m_uvX == other.m_uvX && m_uvY == other.m_uvY;
-    }
-
-    Vertex() {};
-    Vertex(glm::vec3 pos, glm::vec2 uv, glm::vec3 normal)
-    {
-        m_position = pos;
-        m_normal = normal;
-
-        m_uvX = uv.x;
-        m_uvY = uv.y;
-    }
-};
-
-namespace std
-{
-    template<> struct hash<Vertex>
-    {
-        size_t operator()(Vertex const& vertex) const
-        {
-            return ((hash<glm::vec3>()(vertex.m_position) ^
-                (hash<glm::vec3>()(vertex.m_normal) << 1) >> 1 ^
-                (hash<float>()(vertex.m_uvX) << 1) >> 1 ^
-                (hash<float>()(vertex.m_uvY) << 1) >> 1));
-        }
-    };
-}
-
 struct GPUMeshBuffers
 {
     AllocatedBuffer m_indexBuffer;
@@ -0,0 +1,246 @@
+#include "IndexedBVHBuilder.h"
+
+#include <algorithm>
+
+#include "ModelLoader.h"
+
+//Everything the build needs to know about a triangle, a third of the size of the Triangle itself.
+struct IndexedReference
+{
+	glm::vec3 centroid;
+	int triangleIndex;
+	AABB bounds;
+};
+
+struct PendingIndexedNode
+{
+	int nodeIndex;
+	AABB centroidBounds;
+};
+
+struct IndexedBuildContext
+{
+	const BVHBuildSettings& settings;
+	int binCount;
+
+	std::vector<IndexedReference> references;
+
+	//Node 0 is the root, every split takes the next two slots.
+	std::vector<BVHNode> arena;
+	int nodeCount = 0;
+
+	//Reused by every node, binCount bins per axis. The centroid bounds of each bin give the children's centroid bounds without another pass.
+	std::vector<SAHBin> bins;
+	std::vector<AABB> binCentroidBounds;
+	std::vector<SAHBin> axisBins;
+};
+
+//Returns the number of references moved to the left of the node, 0 if the node should stay a leaf.
+static int PartitionNodeIndexed(IndexedBuildContext& context, const BVHNode& node, const AABB& centroidBounds, AABB& outLeftBounds, AABB& outRightBounds,
+	AABB& outLeftCentroidBounds, AABB& outRightCentroidBounds)
+{
+	const int binCount = context.binCount;
+	const int first = node.triangleStartIndex;
+	const int last = node.triangleStartIndex + node.triangleCount;
+
+	glm::vec3 binScale;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		binScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+	}
+
+	for (int b = 0; b < 3 * binCount; b++)
+	{
+		context.bins[b].bounds = EmptyAABB();
+		context.bins[b].triangleCount = 0;
+		context.binCentroidBounds[b] = EmptyAABB();
+	}
+
+	//Bin all three axes in one pass over the references.
+	for (int i = first; i < last; i++)
+	{
+		const IndexedReference& reference = context.references[i];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (binScale[axis] == 0.0f)
+				continue;
+
+			int bin = axis * binCount + GetSAHBinIndex(reference.centroid[axis], centroidBounds.min[axis], binScale[axis], binCount);
+			context.bins[bin].triangleCount++;
+			context.bins[bin].bounds.Grow(reference.bounds.min);
+			context.bins[bin].bounds.Grow(reference.bounds.max);
+			context.binCentroidBounds[bin].Grow(reference.centroid);
+		}
+	}
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplitBin = -1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (binScale[axis] == 0.0f)
+			continue;
+
+		std::copy(context.bins.begin() + axis * binCount, context.bins.begin() + (axis + 1) * binCount, context.axisBins.begin());
+
+		int splitBin;
+		float cost = EvaluateSAHBins(context.axisBins, splitBin);
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			bestAxis = axis;
+			bestSplitBin = splitBin;
+		}
+	}
+
+	if (bestAxis == -1)
+		return 0;
+
+	float splitCost = context.settings.traversalCost * node.aabb.GetArea() + context.settings.intersectionCost * bestCost;
+	float leafCost = context.settings.intersectionCost * node.triangleCount * node.aabb.GetArea();
+	if (splitCost >= leafCost)
+		return 0;
+
+	//The children's bounds are the union of the bins on each side, no extra pass over the references needed.
+	outLeftBounds = EmptyAABB();
+	outRightBounds = EmptyAABB();
+	outLeftCentroidBounds = EmptyAABB();
+	outRightCentroidBounds = EmptyAABB();
+	for (int b = 0; b < binCount; b++)
+	{
+		int bin = bestAxis * binCount + b;
+		if (context.bins[bin].triangleCount == 0)
+			continue;
+
+		bool left = b <= bestSplitBin;
+		AABB& bounds = left ? outLeftBounds : outRightBounds;
+		bounds.Grow(context.bins[bin].bounds.min);
+		bounds.Grow(context.bins[bin].bounds.max);
+
+		AABB& centroids = left ? outLeftCentroidBounds : outRightCentroidBounds;
+		centroids.Grow(context.binCentroidBounds[bin].min);
+		centroids.Grow(context.binCentroidBounds[bin].max);
+	}
+
+	int i = first;
+	int j = last - 1;
+	while (i <= j)
+	{
+		if (GetSAHBinIndex(context.references[i].centroid[bestAxis], centroidBounds.min[bestAxis], binScale[bestAxis], binCount) <= bestSplitBin)
+		{
+			i++;
+		}
+		else
+		{
+			std::swap(context.references[i], context.references[j]);
+			j--;
+		}
+	}
+
+	int leftCount = i - first;
+	if (leftCount == node.triangleCount)
+		return 0;
+
+	return leftCount;
+}
+
+static void BuildIndexedNodes(IndexedBuildContext& context, const AABB& rootCentroidBounds)
+{
+	//Splitting the top of the stack each time allocates nodes in the same depth first order as the recursive builders.
+	std::vector<PendingIndexedNode> stack;
+	stack.push_back({ 0, rootCentroidBounds });
+
+	while (!stack.empty())
+	{
+		PendingIndexedNode pending = stack.back();
+		stack.pop_back();
+
+		BVHNode& node = context.arena[pending.nodeIndex];
+		node.leftChild = -1;
+		node.rightChild = -1;
+
+		//No need to split further
+		if (node.triangleCount <= context.settings.maxLeafTriangles)
+			continue;
+
+		AABB leftBounds, rightBounds, leftCentroidBounds, rightCentroidBounds;
+		int leftCount = PartitionNodeIndexed(context, node, pending.centroidBounds, leftBounds, rightBounds, leftCentroidBounds, rightCentroidBounds);
+		if (leftCount == 0)
+			continue;
+
+		int leftChildIndex = context.nodeCount++;
+		int rightChildIndex = context.nodeCount++;
+
+		BVHNode& leftChild = context.arena[leftChildIndex];
+		leftChild.aabb = leftBounds;
+		leftChild.triangleStartIndex = node.triangleStartIndex;
+		leftChild.triangleCount = leftCount;
+
+		BVHNode& rightChild = context.arena[rightChildIndex];
+		rightChild.aabb = rightBounds;
+		rightChild.triangleStartIndex = node.triangleStartIndex + leftCount;
+		rightChild.triangleCount = node.triangleCount - leftCount;
+
+		node.leftChild = leftChildIndex;
+		node.rightChild = rightChildIndex;
+
+		stack.push_back({ rightChildIndex, rightCentroidBounds });
+		stack.push_back({ leftChildIndex, leftCentroidBounds });
+	}
+}
+
+void BuildBVHSAHIndexed(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings)
+{
+	//No need to split further
+	if (static_cast<int>(triangles.size()) <= settings.maxLeafTriangles)
+		return;
+
+	const int triangleCount = static_cast<int>(triangles.size());
+
+	IndexedBuildContext context{ settings, std::max(settings.binCount, 2) };
+	context.bins.resize(3 * context.binCount);
+	context.binCentroidBounds.resize(3 * context.binCount);
+	context.axisBins.resize(context.binCount);
+
+	AABB rootCentroidBounds = EmptyAABB();
+	context.references.resize(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		context.references[i] = { triangles[i].triCentroid, i, triangles[i].bounds };
+		rootCentroidBounds.Grow(triangles[i].triCentroid);
+	}
+
+	context.arena.resize(2 * static_cast<size_t>(triangleCount) - 1);
+	context.arena[0] = parentNode.node;
+	context.arena[0].triangleStartIndex = 0;
+	context.arena[0].triangleCount = triangleCount;
+	context.nodeCount = 1;
+
+	BuildIndexedNodes(context, rootCentroidBounds);
+
+	//Apply the final order to the triangles in one pass.
+	std::vector<Triangle> sortedTriangles(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+		sortedTriangles[i] = triangles[context.references[i].triangleIndex];
+	triangles.swap(sortedTriangles);
+
+	if (context.arena[0].leftChild == -1)
+		return;
+
+	//The root lives in the parent node, so the arena is written out from node 1.
+	outNodes.reserve(outNodes.size() + context.nodeCount - 1);
+	for (int i = 1; i < context.nodeCount; i++)
+	{
+		BVHNode node = context.arena[i];
+		if (node.leftChild != -1)
+		{
+			node.leftChild -= 1;
+			node.rightChild -= 1;
+		}
+		outNodes.push_back(node);
+	}
+
+	parentNode.node.leftChild = currentBVHSize;
+	parentNode.node.rightChild = currentBVHSize + 1;
+}
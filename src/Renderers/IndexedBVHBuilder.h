@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Binned SAH builder that never moves triangles while building. It partitions an array of triangle indices against precomputed centroids
+* and bounds, writes nodes into an arena preallocated for the 2N - 1 nodes a binary tree over N triangles can need, and reorders the
+* triangles once at the end. Produces the same tree as BuildBVHSAH with far less memory traffic on large meshes.
+*/
+void BuildBVHSAHIndexed(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings);
@@ -0,0 +1,316 @@
+#include "LinearBVHBuilder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
+#include "ModelLoader.h"
+#include "../Useful/ThreadPool.h"
+
+static const int LBVH_GRAIN_SIZE = 65536;
+static const int RADIX_BITS = 8;
+static const int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+//Spreads the low 21 bits of v so there are two zero bits between each of them.
+static uint64_t ExpandBits(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffff;
+	v = (v | v << 16) & 0x1f0000ff0000ff;
+	v = (v | v << 8) & 0x100f00f00f00f00f;
+	v = (v | v << 4) & 0x10c30c30c30c30c3;
+	v = (v | v << 2) & 0x1249249249249249;
+	return v;
+}
+
+static uint64_t GetMortonCode(const glm::vec3& normalisedPosition, int bitsPerAxis)
+{
+	const float cells = static_cast<float>(1u << bitsPerAxis);
+	uint64_t code = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float cell = std::min(std::max(normalisedPosition[axis] * cells, 0.0f), cells - 1.0f);
+		code |= ExpandBits(static_cast<uint64_t>(cell)) << (2 - axis);
+	}
+	return code;
+}
+
+void RadixSort(ThreadPool& pool, std::vector<uint64_t>& keys, std::vector<int>& values, int keyBits)
+{
+	const int count = static_cast<int>(keys.size());
+	const int chunkCount = (count + LBVH_GRAIN_SIZE - 1) / LBVH_GRAIN_SIZE;
+
+	std::vector<uint64_t> keyScratch(count);
+	std::vector<int> valueScratch(count);
+	std::vector<int> chunkOffsets(static_cast<size_t>(chunkCount) * RADIX_BUCKETS);
+
+	for (int shift = 0; shift < keyBits; shift += RADIX_BITS)
+	{
+		std::fill(chunkOffsets.begin(), chunkOffsets.end(), 0);
+		ParallelFor(pool, count, LBVH_GRAIN_SIZE, [&](int begin, int end)
+			{
+				int* histogram = &chunkOffsets[static_cast<size_t>(begin / LBVH_GRAIN_SIZE) * RADIX_BUCKETS];
+				for (int i = begin; i < end; i++)
+					histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+			});
+
+		//Exclusive prefix sum over digits first, then chunks, keeps the scatter stable.
+		int offset = 0;
+		for (int digit = 0; digit < RADIX_BUCKETS; digit++)
+		{
+			for (int chunk = 0; chunk < chunkCount; chunk++)
+			{
+				int& bucket = chunkOffsets[static_cast<size_t>(chunk) * RADIX_BUCKETS + digit];
+				int bucketCount = bucket;
+				bucket = offset;
+				offset += bucketCount;
+			}
+		}
+
+		ParallelFor(pool, count, LBVH_GRAIN_SIZE, [&](int begin, int end)
+			{
+				int* offsets = &chunkOffsets[static_cast<size_t>(begin / LBVH_GRAIN_SIZE) * RADIX_BUCKETS];
+				for (int i = begin; i < end; i++)
+				{
+					int destination = offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+					keyScratch[destination] = keys[i];
+					valueScratch[destination] = values[i];
+				}
+			});
+
+		keys.swap(keyScratch);
+		values.swap(valueScratch);
+	}
+}
+
+void SortTrianglesByMortonCode(ThreadPool& pool, const std::vector<Triangle>& triangles, int mortonCodeBits, std::vector<uint64_t>& outCodes, std::vector<int>& outOrder)
+{
+	const int count = static_cast<int>(triangles.size());
+	const int chunkCount = (count + LBVH_GRAIN_SIZE - 1) / LBVH_GRAIN_SIZE;
+	const int bitsPerAxis = mortonCodeBits > 30 ? 21 : 10;
+
+	std::vector<AABB> chunkBounds(chunkCount, EmptyAABB());
+	ParallelFor(pool, count, LBVH_GRAIN_SIZE, [&](int begin, int end)
+		{
+			AABB& bounds = chunkBounds[begin / LBVH_GRAIN_SIZE];
+			for (int i = begin; i < end; i++)
+				bounds.Grow(triangles[i].triCentroid);
+		});
+
+	AABB centroidBounds = EmptyAABB();
+	for (const AABB& bounds : chunkBounds)
+	{
+		centroidBounds.Grow(bounds.min);
+		centroidBounds.Grow(bounds.max);
+	}
+
+	glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	glm::vec3 inverseExtent;
+	for (int axis = 0; axis < 3; axis++)
+		inverseExtent[axis] = extent[axis] > 0.0f ? 1.0f / extent[axis] : 0.0f;
+
+	outCodes.resize(count);
+	outOrder.resize(count);
+	ParallelFor(pool, count, LBVH_GRAIN_SIZE, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				outCodes[i] = GetMortonCode((triangles[i].triCentroid - centroidBounds.min) * inverseExtent, bitsPerAxis);
+				outOrder[i] = i;
+			}
+		});
+
+	RadixSort(pool, outCodes, outOrder, bitsPerAxis * 3);
+}
+
+struct LinearBVHTree
+{
+	//Internal nodes are [0, n - 1), leaves are [n - 1, 2n - 1) and hold one sorted triangle each.
+	std::vector<int> leftChildren;
+	std::vector<int> rightChildren;
+	std::vector<int> rangeFirst;
+	std::vector<int> rangeLast;
+	std::vector<int> parents;
+	std::vector<AABB> bounds;
+};
+
+//Length of the common prefix of two sorted codes, equal codes fall back to comparing their indices.
+static int CommonPrefix(const std::vector<uint64_t>& codes, int i, int j)
+{
+	if (j < 0 || j >= static_cast<int>(codes.size()))
+		return -1;
+
+	uint64_t difference = codes[i] ^ codes[j];
+	if (difference != 0)
+		return std::countl_zero(difference);
+
+	return 64 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+}
+
+static void BuildInternalNode(const std::vector<uint64_t>& codes, LinearBVHTree& tree, int i)
+{
+	const int leafOffset = static_cast<int>(codes.size()) - 1;
+
+	int direction = CommonPrefix(codes, i, i + 1) - CommonPrefix(codes, i, i - 1) > 0 ? 1 : -1;
+	int minPrefix = CommonPrefix(codes, i, i - direction);
+
+	int maxLength = 2;
+	while (CommonPrefix(codes, i, i + maxLength * direction) > minPrefix)
+		maxLength *= 2;
+
+	int length = 0;
+	for (int step = maxLength / 2; step >= 1; step /= 2)
+	{
+		if (CommonPrefix(codes, i, i + (length + step) * direction) > minPrefix)
+			length += step;
+	}
+
+	int j = i + length * direction;
+	int nodePrefix = CommonPrefix(codes, i, j);
+
+	int split = 0;
+	int step = length;
+	do
+	{
+		step = (step + 1) / 2;
+		if (CommonPrefix(codes, i, i + (split + step) * direction) > nodePrefix)
+			split += step;
+	} while (step > 1);
+
+	int gamma = i + split * direction + std::min(direction, 0);
+	int first = std::min(i, j);
+	int last = std::max(i, j);
+
+	int left = first == gamma ? leafOffset + gamma : gamma;
+	int right = last == gamma + 1 ? leafOffset + gamma + 1 : gamma + 1;
+
+	tree.leftChildren[i] = left;
+	tree.rightChildren[i] = right;
+	tree.rangeFirst[i] = first;
+	tree.rangeLast[i] = last;
+	tree.parents[left] = i;
+	tree.parents[right] = i;
+}
+
+//Converts a Karras node into the renderer layout. Ranges of maxLeafTriangles or fewer become leaves like the other builders.
+//maxLeafTriangles must be at least 1, single triangles are leaves of the Karras tree and have no children to emit.
+static void EmitLinearBVHNode(const LinearBVHTree& tree, std::vector<BVHNode>& outNodes, int treeIndex, int outIndex, int maxLeafTriangles)
+{
+	outNodes[outIndex].leftChild = -1;
+	outNodes[outIndex].rightChild = -1;
+
+	if (outNodes[outIndex].triangleCount <= maxLeafTriangles)
+		return;
+
+	int children[2] = { tree.leftChildren[treeIndex], tree.rightChildren[treeIndex] };
+	int childIndices[2];
+	for (int c = 0; c < 2; c++)
+	{
+		BVHNode child;
+		child.aabb = tree.bounds[children[c]];
+		child.triangleStartIndex = tree.rangeFirst[children[c]];
+		child.triangleCount = tree.rangeLast[children[c]] - tree.rangeFirst[children[c]] + 1;
+
+		childIndices[c] = static_cast<int>(outNodes.size());
+		outNodes.push_back(child);
+	}
+
+	outNodes[outIndex].leftChild = childIndices[0];
+	outNodes[outIndex].rightChild = childIndices[1];
+
+	EmitLinearBVHNode(tree, outNodes, children[0], childIndices[0], maxLeafTriangles);
+	EmitLinearBVHNode(tree, outNodes, children[1], childIndices[1], maxLeafTriangles);
+}
+
+void BuildBVHLinear(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings)
+{
+	//No need to split further
+	if (static_cast<int>(triangles.size()) <= settings.maxLeafTriangles)
+		return;
+
+	ThreadPool pool(settings.parallelBuild ? settings.threadCount : 1);
+
+	std::vector<uint64_t> codes;
+	std::vector<int> order;
+	SortTrianglesByMortonCode(pool, triangles, settings.mortonCodeBits, codes, order);
+
+	const int count = static_cast<int>(triangles.size());
+	const int leafOffset = count - 1;
+
+	//Apply the sorted order to the triangles once.
+	std::vector<Triangle> sortedTriangles(count);
+	ParallelFor(pool, count, LBVH_GRAIN_SIZE, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+				sortedTriangles[i] = triangles[order[i]];
+		});
+	triangles.swap(sortedTriangles);
+
+	LinearBVHTree tree;
+	tree.leftChildren.resize(count - 1);
+	tree.rightChildren.resize(count - 1);
+	tree.rangeFirst.resize(2 * count - 1);
+	tree.rangeLast.resize(2 * count - 1);
+	tree.parents.assign(2 * count - 1, -1);
+	tree.bounds.resize(2 * count - 1);
+
+	ParallelFor(pool, count - 1, LBVH_GRAIN_SIZE, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+				BuildInternalNode(codes, tree, i);
+		});
+
+	//Bounds are propagated bottom up, the second child to arrive at a parent computes its box.
+	std::vector<std::atomic<int>> arrivals(count - 1);
+	for (std::atomic<int>& arrival : arrivals)
+		arrival = 0;
+
+	ParallelFor(pool, count, LBVH_GRAIN_SIZE, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const Triangle& tri = triangles[i];
+				int leaf = leafOffset + i;
+				tree.rangeFirst[leaf] = i;
+				tree.rangeLast[leaf] = i;
+				tree.bounds[leaf] = tri.bounds;
+
+				int node = tree.parents[leaf];
+				while (node != -1 && arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 1)
+				{
+					const AABB& left = tree.bounds[tree.leftChildren[node]];
+					const AABB& right = tree.bounds[tree.rightChildren[node]];
+					tree.bounds[node].min = glm::min(left.min, right.min);
+					tree.bounds[node].max = glm::max(left.max, right.max);
+					node = tree.parents[node];
+				}
+			}
+		});
+
+	//Node 0 is the root, its children become the first pair just like BuildBVH.
+	BVHNode root = parentNode.node;
+	root.triangleStartIndex = 0;
+	root.triangleCount = count;
+
+	std::vector<BVHNode> nodes;
+	nodes.reserve(2 * count);
+	nodes.push_back(root);
+	EmitLinearBVHNode(tree, nodes, 0, 0, std::max(settings.maxLeafTriangles, 1));
+
+	if (nodes[0].leftChild == -1)
+		return;
+
+	for (size_t i = 1; i < nodes.size(); i++)
+	{
+		BVHNode node = nodes[i];
+		if (node.leftChild != -1)
+		{
+			node.leftChild -= 1;
+			node.rightChild -= 1;
+		}
+		outNodes.push_back(node);
+	}
+
+	parentNode.node.leftChild = currentBVHSize;
+	parentNode.node.rightChild = currentBVHSize + 1;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+class ThreadPool;
+
+/**
+* Linear BVH builder. Sorts triangles along a Morton curve and derives the hierarchy from the sorted codes (Karras 2012).
+* Quality is below the SAH builders but it runs in a handful of linear passes, so it suits geometry that is rebuilt often.
+*/
+void BuildBVHLinear(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings);
+
+/**
+* Computes 30 or 63 bit Morton codes for the triangle centroids and sorts them. outOrder holds the triangle index for each sorted code.
+*/
+void SortTrianglesByMortonCode(ThreadPool& pool, const std::vector<Triangle>& triangles, int mortonCodeBits, std::vector<uint64_t>& outCodes, std::vector<int>& outOrder);
+
+/**
+* Stable parallel LSD radix sort of 64 bit keys with an int payload. Only the low keyBits bits are sorted on.
+*/
+void RadixSort(ThreadPool& pool, std::vector<uint64_t>& keys, std::vector<int>& values, int keyBits);
@@ -1,16 +1,31 @@
 #include "ModelLoader.h"
+#include "ParallelBVHBuilder.h"
+#include "LinearBVHBuilder.h"
+#include "SpatialSplitBVHBuilder.h"
+#include "IndexedBVHBuilder.h"
+#include "PLOCBVHBuilder.h"
+#include "TreeletOptimizer.h"
+#include "BVHLayout.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
+#include <algorithm>
+#include <queue>
 #include <unordered_map>
 
 #include "../Useful/Useful.h"
 
-void BuildBVH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize)
+//Deepest a triangle is halved by pre-splitting, so one huge triangle cannot take the whole budget.
+static const int PRE_SPLIT_MAX_DEPTH = 6;
+
+//Thickness given to flat model bounds, relative to the longest axis.
+static const float FLAT_AABB_THICKNESS = 1e-4f;
+
+void BuildBVH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings)
 {
 	//No need to split further
-	if (triangles.size() <= 2)
+	if (static_cast<int>(triangles.size()) <= settings.maxLeafTriangles)
 		return;
 
 	//Determine longest axis
@@ -54,14 +69,14 @@ void BuildBVH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes,
 	int leftChildIndex = 0;
 	int rightChildIndex = 1;
 
-	SplitBVHNode(triangles, outNodes, leftChildIndex);
-	SplitBVHNode(triangles, outNodes, rightChildIndex);
+	SplitBVHNode(triangles, outNodes, leftChildIndex, settings);
+	SplitBVHNode(triangles, outNodes, rightChildIndex, settings);
 
 	parentNode.node.leftChild = currentBVHSize;
 	parentNode.node.rightChild = currentBVHSize + 1;
 }
 
-void SplitBVHNode(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, int& currentNodeIndex)
+void SplitBVHNode(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, int& currentNodeIndex, const BVHBuildSettings& settings)
 {
 	BVHNode& node = outNodes[currentNodeIndex];
 
@@ -69,7 +84,7 @@ void SplitBVHNode(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNod
 	node.rightChild = -1;
 
 	//No need to split further
-	if (node.triangleCount <= 2)
+	if (node.triangleCount <= settings.maxLeafTriangles)
 		return;
 
 	//Determine longest axis
@@ -115,94 +130,268 @@ void SplitBVHNode(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNod
 	outNodes.push_back(leftChild);
 	outNodes.push_back(rightChild);
 
-	SplitBVHNode(triangles, outNodes, leftChildIndex);
-	SplitBVHNode(triangles, outNodes, rightChildIndex);
+	SplitBVHNode(triangles, outNodes, leftChildIndex, settings);
+	SplitBVHNode(triangles, outNodes, rightChildIndex, settings);
 }
 
-//WIP - SAH version
+//Binned SAH version
+
+AABB EmptyAABB()
+{
+	AABB aabb;
+	aabb.min = glm::vec3(FLT_MAX);
+	aabb.max = glm::vec3(-FLT_MAX);
+	return aabb;
+}
 
-void BuildBVHSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize)
+int GetSAHBinIndex(float centroid, float centroidMin, float binScale, int binCount)
+{
+	int binIndex = static_cast<int>((centroid - centroidMin) * binScale);
+	return std::min(std::max(binIndex, 0), binCount - 1);
+}
+
+float EvaluateSAHBins(const std::vector<SAHBin>& bins, int& outSplitBin)
+{
+	const int binCount = static_cast<int>(bins.size());
+	std::vector<float> leftAreas(binCount - 1), rightAreas(binCount - 1);
+	std::vector<int> leftCounts(binCount - 1), rightCounts(binCount - 1);
+
+	//Sweep from both ends so each candidate plane is evaluated in constant time.
+	AABB leftBox = EmptyAABB(), rightBox = EmptyAABB();
+	int leftSum = 0, rightSum = 0;
+	for (int i = 0; i < binCount - 1; i++)
+	{
+		leftSum += bins[i].triangleCount;
+		leftCounts[i] = leftSum;
+		if (bins[i].triangleCount > 0)
+		{
+			leftBox.Grow(bins[i].bounds.min);
+			leftBox.Grow(bins[i].bounds.max);
+		}
+		leftAreas[i] = leftSum > 0 ? leftBox.GetArea() : 0.0f;
+
+		int j = binCount - 1 - i;
+		rightSum += bins[j].triangleCount;
+		rightCounts[j - 1] = rightSum;
+		if (bins[j].triangleCount > 0)
+		{
+			rightBox.Grow(bins[j].bounds.min);
+			rightBox.Grow(bins[j].bounds.max);
+		}
+		rightAreas[j - 1] = rightSum > 0 ? rightBox.GetArea() : 0.0f;
+	}
+
+	float bestCost = FLT_MAX;
+	outSplitBin = -1;
+	for (int i = 0; i < binCount - 1; i++)
+	{
+		if (leftCounts[i] == 0 || rightCounts[i] == 0)
+			continue;
+
+		float cost = leftCounts[i] * leftAreas[i] + rightCounts[i] * rightAreas[i];
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			outSplitBin = i;
+		}
+	}
+
+	return bestCost;
+}
+
+void BuildModelBVH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings, BVHBuildStats* outStats)
+{
+	if (settings.preSplitTriangles)
+	{
+		PreSplitTriangles(triangles, settings, outStats);
+		parentNode.node.triangleCount = static_cast<int>(triangles.size());
+	}
+
+	switch (settings.method)
+	{
+	case BVHBuildMethod::Midpoint:
+		BuildBVH(triangles, outNodes, parentNode, currentBVHSize, settings);
+		break;
+	case BVHBuildMethod::SAH:
+		if (settings.parallelBuild)
+			BuildBVHSAHParallel(triangles, outNodes, parentNode, currentBVHSize, settings);
+		else
+			BuildBVHSAH(triangles, outNodes, parentNode, currentBVHSize, settings);
+		break;
+	case BVHBuildMethod::LBVH:
+		BuildBVHLinear(triangles, outNodes, parentNode, currentBVHSize, settings);
+		break;
+	case BVHBuildMethod::SBVH:
+		BuildBVHSpatialSplits(triangles, outNodes, parentNode, currentBVHSize, settings, outStats);
+		break;
+	case BVHBuildMethod::IndexedSAH:
+		BuildBVHSAHIndexed(triangles, outNodes, parentNode, currentBVHSize, settings);
+		break;
+	case BVHBuildMethod::PLOC:
+		BuildBVHPLOC(triangles, outNodes, parentNode, currentBVHSize, settings);
+		break;
+	}
+
+	if (settings.optimizeTreelets)
+		OptimizeBVHTreelets(triangles, outNodes, parentNode, currentBVHSize, settings, outStats);
+
+	ReorderBVHNodes(outNodes, parentNode, currentBVHSize, settings.nodeLayout);
+}
+
+void BuildBVHSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings)
 {
 	//No need to split further
-	if (triangles.size() <= 2)
+	if (static_cast<int>(triangles.size()) <= settings.maxLeafTriangles)
+		return;
+
+	int leftCount = PartitionNodeSAH(triangles, parentNode.node, settings);
+	if (leftCount == 0)
 		return;
 
 	BVHNode leftChild;
-	leftChild.leftChild = -1;
+	leftChild.triangleStartIndex = parentNode.node.triangleStartIndex;
+	leftChild.triangleCount = leftCount;
 	leftChild.aabb = AABB();
 
 	BVHNode rightChild;
-	rightChild.leftChild = -1;
+	rightChild.triangleStartIndex = parentNode.node.triangleStartIndex + leftCount;
+	rightChild.triangleCount = parentNode.node.triangleCount - leftCount;
 	rightChild.aabb = AABB();
 
+	ExpandNodeAABB(triangles, leftChild);
+	ExpandNodeAABB(triangles, rightChild);
+
 	outNodes.push_back(leftChild);
 	outNodes.push_back(rightChild);
 
-	SplitBVHNodeSAH(triangles, outNodes, leftChild);
-	SplitBVHNodeSAH(triangles, outNodes, rightChild);
+	SplitBVHNodeSAH(triangles, outNodes, 0, settings);
+	SplitBVHNodeSAH(triangles, outNodes, 1, settings);
 
 	parentNode.node.leftChild = currentBVHSize;
 	parentNode.node.rightChild = currentBVHSize + 1;
 }
 
-void SplitBVHNodeSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, BVHNode& node)
+void SplitBVHNodeSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, int currentNodeIndex, const BVHBuildSettings& settings)
 {
-	node.leftChild = -1;
-	node.rightChild = -1;
+	outNodes[currentNodeIndex].leftChild = -1;
+	outNodes[currentNodeIndex].rightChild = -1;
 
 	//No need to split further
-	if (node.triangleCount <= 2)
+	if (outNodes[currentNodeIndex].triangleCount <= settings.maxLeafTriangles)
+		return;
+
+	int leftCount = PartitionNodeSAH(triangles, outNodes[currentNodeIndex], settings);
+	if (leftCount == 0)
 		return;
 
+	//Copy out before push_back can reallocate the node storage.
+	BVHNode node = outNodes[currentNodeIndex];
+
 	int leftChildIndex = outNodes.size();
 	int rightChildIndex = outNodes.size() + 1;
 
-	node.leftChild = leftChildIndex;
-	node.rightChild = rightChildIndex;
+	outNodes[currentNodeIndex].leftChild = leftChildIndex;
+	outNodes[currentNodeIndex].rightChild = rightChildIndex;
 
 	BVHNode leftChild;
-	leftChild.leftChild = -1;
+	leftChild.triangleStartIndex = node.triangleStartIndex;
+	leftChild.triangleCount = leftCount;
 	leftChild.aabb = AABB();
 
 	BVHNode rightChild;
-	rightChild.leftChild = -1;
+	rightChild.triangleStartIndex = node.triangleStartIndex + leftCount;
+	rightChild.triangleCount = node.triangleCount - leftCount;
 	rightChild.aabb = AABB();
 
+	ExpandNodeAABB(triangles, leftChild);
+	ExpandNodeAABB(triangles, rightChild);
+
 	outNodes.push_back(leftChild);
 	outNodes.push_back(rightChild);
 
-	int bestAxis = -1;
-	float bestPos = 0.0f, bestCost = 1e30f;
-	for (int a = 0; a < 3; a++)
+	SplitBVHNodeSAH(triangles, outNodes, leftChildIndex, settings);
+	SplitBVHNodeSAH(triangles, outNodes, rightChildIndex, settings);
+}
+
+float FindBestSplitPlane(const std::vector<Triangle>& triangles, const BVHNode& node, const BVHBuildSettings& settings, int& outAxis, int& outSplitBin, glm::vec3& outCentroidMin, glm::vec3& outBinScale)
+{
+	const int binCount = std::max(settings.binCount, 2);
+
+	glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+	for (int i = 0; i < node.triangleCount; i++)
+	{
+		const Triangle& tri = triangles[node.triangleStartIndex + i];
+		centroidMin = glm::min(centroidMin, tri.triCentroid);
+		centroidMax = glm::max(centroidMax, tri.triCentroid);
+	}
+
+	outCentroidMin = centroidMin;
+	outAxis = -1;
+	outSplitBin = -1;
+
+	std::vector<SAHBin> bins(binCount);
+
+	float bestCost = FLT_MAX;
+	for (int axis = 0; axis < 3; axis++)
 	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.0f)
+		{
+			outBinScale[axis] = 0.0f;
+			continue;
+		}
+
+		float binScale = binCount / extent;
+		outBinScale[axis] = binScale;
+
+		for (SAHBin& bin : bins)
+		{
+			bin.bounds = EmptyAABB();
+			bin.triangleCount = 0;
+		}
+
 		for (int i = 0; i < node.triangleCount; i++)
 		{
-			Triangle& tri = triangles[node.triangleStartIndex + i];
-			float centroidPos = tri.triCentroid[a];
-			if (centroidPos > node.aabb.min[a] && centroidPos < node.aabb.max[a])
-			{
-				float cost = EvaluateSplitCost(triangles, outNodes, node, a, centroidPos);
-				if (cost < bestCost)
-				{
-					bestCost = cost;
-					bestAxis = a;
-					bestPos = centroidPos;
-				}
-			}
+			const Triangle& tri = triangles[node.triangleStartIndex + i];
+			SAHBin& bin = bins[GetSAHBinIndex(tri.triCentroid[axis], centroidMin[axis], binScale, binCount)];
+			bin.triangleCount++;
+			bin.bounds.Grow(tri.bounds.min);
+			bin.bounds.Grow(tri.bounds.max);
+		}
+
+		int splitBin;
+		float cost = EvaluateSAHBins(bins, splitBin);
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			outAxis = axis;
+			outSplitBin = splitBin;
 		}
 	}
 
-	float splitPos = bestPos;
-	int i = node.triangleStartIndex;
-	int j = node.triangleStartIndex + node.triangleCount - 1;
+	if (outAxis == -1)
+		return FLT_MAX;
 
-	glm::vec3 e = node.aabb.max - node.aabb.min;
-	float parentArea = e.x * e.y + e.y * e.z + e.z * e.x;
-	float parentCost = node.triangleCount * parentArea;
+	//Both costs are left unnormalised by the parent area, so scale the traversal term instead.
+	return settings.traversalCost * node.aabb.GetArea() + settings.intersectionCost * bestCost;
+}
 
+int PartitionNodeSAH(std::vector<Triangle>& triangles, const BVHNode& node, const BVHBuildSettings& settings)
+{
+	int axis, splitBin;
+	glm::vec3 centroidMin, binScale;
+	float splitCost = FindBestSplitPlane(triangles, node, settings, axis, splitBin, centroidMin, binScale);
+
+	float leafCost = settings.intersectionCost * node.triangleCount * node.aabb.GetArea();
+	if (axis == -1 || splitCost >= leafCost)
+		return 0;
+
+	const int binCount = std::max(settings.binCount, 2);
+	int i = node.triangleStartIndex;
+	int j = node.triangleStartIndex + node.triangleCount - 1;
 	while (i <= j)
 	{
-		if (triangles[i].triCentroid[bestAxis] < splitPos)
+		if (GetSAHBinIndex(triangles[i].triCentroid[axis], centroidMin[axis], binScale[axis], binCount) <= splitBin)
 		{
 			i++;
 		}
@@ -212,81 +401,238 @@ void SplitBVHNodeSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& out
 			j--;
 		}
 	}
+
 	int leftCount = i - node.triangleStartIndex;
-	if (leftCount == 0 || leftCount == node.triangleCount)
-		return;
+	if (leftCount == node.triangleCount)
+		return 0;
 
-	if (bestCost >= parentCost) return;
+	return leftCount;
+}
+
+void ExpandNodeAABB(std::vector<Triangle>& triangles, BVHNode& child)
+{
+	child.aabb.min = glm::vec3(FLT_MAX);
+	child.aabb.max = glm::vec3(-FLT_MAX);
 
-	SplitBVHNodeSAH(triangles, outNodes, leftChild);
-	SplitBVHNodeSAH(triangles, outNodes, rightChild);
+	int first = child.triangleStartIndex;
+	for (int i = 0; i < child.triangleCount; i++)
+	{
+		const Triangle& tri = triangles[first + i];
+		child.aabb.Grow(tri.bounds.min);
+		child.aabb.Grow(tri.bounds.max);
+	}
 }
 
-float EvaluateSplitCost(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, BVHNode& node, int axis, float pos)
+//Pre-splitting
+
+struct PreSplitPiece
+{
+	int triangleIndex;
+	int depth;
+	AABB bounds;
+};
+
+//Bounds of the part of the triangle inside the box, found by clipping it against each of the box's planes in turn.
+static AABB ClipTriangleToBox(const Triangle& tri, const AABB& box)
 {
-	BVHNode& leftChild = outNodes[node.leftChild];
-	BVHNode& rightChild = outNodes[node.rightChild];
+	//Every plane adds at most one vertex to the polygon.
+	glm::vec3 polygon[9] = { tri.v0, tri.v1, tri.v2 };
+	glm::vec3 clipped[9];
+	int vertexCount = 3;
 
-	AABB& leftAABB = leftChild.aabb;
-	AABB& rightAABB = rightChild.aabb;
-	int leftCount = 0, rightCount = 0;
-	for (int i = 3; i < node.triangleCount; i++)
+	for (int plane = 0; plane < 6 && vertexCount > 0; plane++)
 	{
-		Triangle& tri = triangles[node.triangleStartIndex + i];
-		if (tri.triCentroid[axis] < pos)
+		int axis = plane % 3;
+		bool keepAbove = plane < 3;
+		float position = keepAbove ? box.min[axis] : box.max[axis];
+
+		auto isInside = [axis, keepAbove, position](const glm::vec3& p) { return keepAbove ? p[axis] >= position : p[axis] <= position; };
+
+		int clippedCount = 0;
+		for (int i = 0; i < vertexCount; i++)
 		{
-			leftCount++;
-			leftAABB.Grow(tri.v0);
-			leftAABB.Grow(tri.v1);
-			leftAABB.Grow(tri.v2);
+			const glm::vec3& a = polygon[i];
+			const glm::vec3& b = polygon[(i + 1) % vertexCount];
+
+			if (isInside(a))
+				clipped[clippedCount++] = a;
+
+			if (isInside(a) != isInside(b))
+			{
+				float t = (position - a[axis]) / (b[axis] - a[axis]);
+				glm::vec3 point = a + (b - a) * t;
+				point[axis] = position;
+				clipped[clippedCount++] = point;
+			}
 		}
-		else
+
+		std::copy(clipped, clipped + clippedCount, polygon);
+		vertexCount = clippedCount;
+	}
+
+	AABB bounds = EmptyAABB();
+	for (int i = 0; i < vertexCount; i++)
+		bounds.Grow(polygon[i]);
+
+	return bounds;
+}
+
+//Halves the piece's bounds on their longest axis and clips the triangle to each half. Returns how much surface area the split removes.
+static float SplitPreSplitPiece(const Triangle& tri, const AABB& bounds, AABB& outLeft, AABB& outRight)
+{
+	int axis = bounds.GetLongestAxis();
+	float middle = (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+
+	AABB leftBox = bounds;
+	leftBox.max[axis] = middle;
+	AABB rightBox = bounds;
+	rightBox.min[axis] = middle;
+
+	outLeft = ClipTriangleToBox(tri, leftBox);
+	outRight = ClipTriangleToBox(tri, rightBox);
+
+	if (outLeft.min.x > outLeft.max.x || outRight.min.x > outRight.max.x)
+		return 0.0f;
+
+	return bounds.GetArea() - outLeft.GetArea() - outRight.GetArea();
+}
+
+void PreSplitTriangles(std::vector<Triangle>& triangles, const BVHBuildSettings& settings, BVHBuildStats* outStats)
+{
+	std::vector<PreSplitPiece> pieces(triangles.size());
+	std::priority_queue<std::pair<float, int>> splitQueue;
+
+	for (int i = 0; i < static_cast<int>(triangles.size()); i++)
+	{
+		const Triangle& tri = triangles[i];
+		pieces[i] = { i, 0, tri.bounds };
+
+		//GetArea returns half the surface area, compare it against the triangle's area on the same scale.
+		float triangleArea = glm::length(glm::cross(tri.v1 - tri.v0, tri.v2 - tri.v0)) * 0.5f;
+		if (tri.bounds.GetArea() <= settings.preSplitThreshold * triangleArea)
+			continue;
+
+		AABB left, right;
+		float benefit = SplitPreSplitPiece(tri, tri.bounds, left, right);
+		if (benefit > 0.0f)
+			splitQueue.push({ benefit, i });
+	}
+
+	//Greedily split whichever piece loses the most area until the budget runs out.
+	int maxSplits = static_cast<int>(settings.preSplitBudget * triangles.size());
+	int splitCount = 0;
+	while (!splitQueue.empty() && splitCount < maxSplits)
+	{
+		int pieceIndex = splitQueue.top().second;
+		splitQueue.pop();
+
+		PreSplitPiece piece = pieces[pieceIndex];
+		const Triangle& tri = triangles[piece.triangleIndex];
+
+		AABB left, right;
+		SplitPreSplitPiece(tri, piece.bounds, left, right);
+
+		pieces[pieceIndex].bounds = left;
+		pieces[pieceIndex].depth = piece.depth + 1;
+		pieces.push_back({ piece.triangleIndex, piece.depth + 1, right });
+		splitCount++;
+
+		if (piece.depth + 1 >= PRE_SPLIT_MAX_DEPTH)
+			continue;
+
+		int newPieces[2] = { pieceIndex, static_cast<int>(pieces.size()) - 1 };
+		for (int newPiece : newPieces)
 		{
-			rightCount++;
-			rightAABB.Grow(tri.v0);
-			rightAABB.Grow(tri.v1);
-			rightAABB.Grow(tri.v2);
+			AABB childLeft, childRight;
+			float benefit = SplitPreSplitPiece(tri, pieces[newPiece].bounds, childLeft, childRight);
+			if (benefit > 0.0f)
+				splitQueue.push({ benefit, newPiece });
 		}
 	}
 
-	leftChild.triangleStartIndex = node.triangleStartIndex;
-	leftChild.triangleCount = leftCount;
+	if (outStats)
+		outStats->preSplitReferences = splitCount;
 
-	rightChild.triangleStartIndex = node.triangleStartIndex + leftCount;
-	rightChild.triangleCount = rightCount;
+	if (splitCount == 0)
+		return;
+
+	//Keep the pieces of each triangle next to each other, every piece is a full copy of the triangle with its own bounds.
+	std::stable_sort(pieces.begin(), pieces.end(), [](const PreSplitPiece& a, const PreSplitPiece& b) { return a.triangleIndex < b.triangleIndex; });
+
+	std::vector<Triangle> splitTriangles;
+	splitTriangles.reserve(pieces.size());
+	for (const PreSplitPiece& piece : pieces)
+	{
+		Triangle tri = triangles[piece.triangleIndex];
+		if (piece.depth > 0)
+		{
+			tri.bounds = piece.bounds;
+			tri.triCentroid = (piece.bounds.min + piece.bounds.max) * 0.5f;
+		}
+		splitTriangles.push_back(tri);
+	}
 
-	float cost = leftCount * leftAABB.GetArea() + rightCount * rightAABB.GetArea();
-	return cost > 0 ? cost : 1e30f;
+	triangles.swap(splitTriangles);
 }
 
-void ExpandNodeAABB(std::vector<Triangle>& triangles, BVHNode& child)
+void PadFlatAABB(AABB& aabb)
 {
-	child.aabb.min = glm::vec3(FLT_MAX);
-	child.aabb.max = glm::vec3(-FLT_MAX);
+	glm::vec3 extents = aabb.max - aabb.min;
+	float thickness = std::max(std::max(std::max(extents.x, extents.y), extents.z) * FLAT_AABB_THICKNESS, FLAT_AABB_THICKNESS);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (extents[axis] > 0.0f)
+			continue;
 
-	int first = child.triangleStartIndex;
-	for (int i = 0; i < child.triangleCount; i++)
+		aabb.min[axis] -= 0.5f * thickness;
+		aabb.max[axis] += 0.5f * thickness;
+	}
+}
+
+void BuildModelTriangles(const std::vector<Vertex>& vertices, std::vector<Triangle>& outTriangles, AABB& outBounds)
+{
+	outBounds = EmptyAABB();
+
+	for (int i = 0; i < (int)vertices.size(); i += 3)
 	{
-		Triangle& tri = triangles[first + i];
-		if (tri.v0.x < child.aabb.min.x) child.aabb.min.x = tri.v0.x;
-		if (tri.v0.y < child.aabb.min.y) child.aabb.min.y = tri.v0.y;
-		if (tri.v0.z < child.aabb.min.z) child.aabb.min.z = tri.v0.z;
-		if (tri.v0.x > child.aabb.max.x) child.aabb.max.x = tri.v0.x;
-		if (tri.v0.y > child.aabb.max.y) child.aabb.max.y = tri.v0.y;
-		if (tri.v0.z > child.aabb.max.z) child.aabb.max.z = tri.v0.z;
-		if (tri.v1.x < child.aabb.min.x) child.aabb.min.x = tri.v1.x;
-		if (tri.v1.y < child.aabb.min.y) child.aabb.min.y = tri.v1.y;
-		if (tri.v1.z < child.aabb.min.z) child.aabb.min.z = tri.v1.z;
-		if (tri.v1.x > child.aabb.max.x) child.aabb.max.x = tri.v1.x;
-		if (tri.v1.y > child.aabb.max.y) child.aabb.max.y = tri.v1.y;
-		if (tri.v1.z > child.aabb.max.z) child.aabb.max.z = tri.v1.z;
-		if (tri.v2.x < child.aabb.min.x) child.aabb.min.x = tri.v2.x;
-		if (tri.v2.y < child.aabb.min.y) child.aabb.min.y = tri.v2.y;
-		if (tri.v2.z < child.aabb.min.z) child.aabb.min.z = tri.v2.z;
-		if (tri.v2.x > child.aabb.max.x) child.aabb.max.x = tri.v2.x;
-		if (tri.v2.y > child.aabb.max.y) child.aabb.max.y = tri.v2.y;
-		if (tri.v2.z > child.aabb.max.z) child.aabb.max.z = tri.v2.z;
+		Triangle newTriangle;
+		newTriangle.sourceIndex = i / 3;
+		newTriangle.v0 = vertices[i].m_position;
+		newTriangle.v1 = vertices[i + 1].m_position;
+		newTriangle.v2 = vertices[i + 2].m_position;
+
+		newTriangle.triCentroid = (newTriangle.v0 + newTriangle.v1 + newTriangle.v2) * 0.33f;
+
+		newTriangle.bounds = EmptyAABB();
+		newTriangle.bounds.Grow(newTriangle.v0);
+		newTriangle.bounds.Grow(newTriangle.v1);
+		newTriangle.bounds.Grow(newTriangle.v2);
+
+		if (vertices[i].m_normal != glm::vec3(0.0f) &&
+			vertices[i + 1].m_normal != glm::vec3(0.0f) &&
+			vertices[i + 2].m_normal != glm::vec3(0.0f))
+		{
+			newTriangle.n0 = glm::normalize(vertices[i].m_normal);
+			newTriangle.n1 = glm::normalize(vertices[i + 1].m_normal);
+			newTriangle.n2 = glm::normalize(vertices[i + 2].m_normal);
+		}
+		else
+		{
+			glm::vec3 edge1 = newTriangle.v1 - newTriangle.v0;
+			glm::vec3 edge2 = newTriangle.v2 - newTriangle.v0;
+			glm::vec3 faceNormal = glm::normalize(glm::cross(edge1, edge2));
+			newTriangle.n0 = faceNormal;
+			newTriangle.n1 = faceNormal;
+			newTriangle.n2 = faceNormal;
+		}
+
+		outBounds.Grow(newTriangle.bounds.min);
+		outBounds.Grow(newTriangle.bounds.max);
+
+		outTriangles.push_back(newTriangle);
 	}
+
+	PadFlatAABB(outBounds);
 }
 
 void LoadObjFile(const std::string& filePath, std::vector<Vertex>& vertices)
@@ -3,15 +3,40 @@
 #include <vector>
 #include <string>
 
-#include "Hardware/Vulkan/VulkanTypes.h"
 #include "Hardware/RaytracerTypes.h"
 
-void BuildBVH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize);
-void SplitBVHNode(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, int& currentNodeIndex);
+void BuildBVH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings);
+void SplitBVHNode(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, int& currentNodeIndex, const BVHBuildSettings& settings);
 
-void BuildBVHSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize);
-float EvaluateSplitCost(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, BVHNode& node, int axis, float pos);
-void SplitBVHNodeSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, BVHNode& node);
+struct SAHBin
+{
+	AABB bounds;
+	int triangleCount = 0;
+};
+
+void BuildModelBVH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings, BVHBuildStats* outStats = nullptr);
+
+void BuildBVHSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings);
+void SplitBVHNodeSAH(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, int currentNodeIndex, const BVHBuildSettings& settings);
+float FindBestSplitPlane(const std::vector<Triangle>& triangles, const BVHNode& node, const BVHBuildSettings& settings, int& outAxis, int& outSplitBin, glm::vec3& outCentroidMin, glm::vec3& outBinScale);
+int PartitionNodeSAH(std::vector<Triangle>& triangles, const BVHNode& node, const BVHBuildSettings& settings);
+
+AABB EmptyAABB();
+int GetSAHBinIndex(float centroid, float centroidMin, float binScale, int binCount);
+float EvaluateSAHBins(const std::vector<SAHBin>& bins, int& outSplitBin);
+
+/**
+* Early split clipping. Triangles whose bounds are over settings.preSplitThreshold times larger than the triangle are halved repeatedly,
+* each piece becoming a copy of the triangle with the tight bounds of its part. Copies keep their sourceIndex so leaves still find the
+* original triangle. Runs before the builder, so it works with every build method.
+*/
+void PreSplitTriangles(std::vector<Triangle>& triangles, const BVHBuildSettings& settings, BVHBuildStats* outStats = nullptr);
 
 void ExpandNodeAABB(std::vector<Triangle>& triangles, BVHNode& child);
-void LoadObjFile(const std::string& filePath, std::vector<Vertex>& vertices);
\ No newline at end of file
+void LoadObjFile(const std::string& filePath, std::vector<Vertex>& vertices);
+/**
+* Gives axes with no extent a small thickness. The shader's slab test misses boxes that are flat along any axis, such as a single quad's.
+*/
+void PadFlatAABB(AABB& aabb);
+
+void BuildModelTriangles(const std::vector<Vertex>& vertices, std::vector<Triangle>& outTriangles, AABB& outBounds);
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "PLOCBVHBuilder.h"
+
+#include <algorithm>
+
+#include "ModelLoader.h"
+#include "LinearBVHBuilder.h"
+#include "../Useful/ThreadPool.h"
+
+static const int PLOC_GRAIN_SIZE = 4096;
+
+struct PLOCTree
+{
+	//Leaves are [0, n) and hold the triangle with the same index, merged nodes follow in the order the passes create them.
+	std::vector<int> leftChildren;
+	std::vector<int> rightChildren;
+	std::vector<int> triangleCounts;
+	std::vector<AABB> bounds;
+	int nodeCount = 0;
+};
+
+static AABB MergeAABB(const AABB& a, const AABB& b)
+{
+	AABB merged;
+	merged.min = glm::min(a.min, b.min);
+	merged.max = glm::max(a.max, b.max);
+	return merged;
+}
+
+//Surface area of the union of two boxes, the distance between two clusters. Called 2 * plocSearchRadius times per cluster every pass.
+static float GetMergedArea(const AABB& a, const AABB& b)
+{
+	float x = std::max(a.max.x, b.max.x) - std::min(a.min.x, b.min.x);
+	float y = std::max(a.max.y, b.max.y) - std::min(a.min.y, b.min.y);
+	float z = std::max(a.max.z, b.max.z) - std::min(a.min.z, b.min.z);
+	return x * y + y * z + z * x;
+}
+
+static void FindNearestNeighbours(ThreadPool& pool, const std::vector<AABB>& clusterBounds, int clusterCount, int searchRadius, std::vector<int>& outNeighbours)
+{
+	ParallelFor(pool, clusterCount, PLOC_GRAIN_SIZE, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				float bestDistance = FLT_MAX;
+				int bestNeighbour = -1;
+
+				//Ties go to the lowest index. Both clusters of a pair then agree on it, which guarantees every pass merges at least one pair.
+				int last = std::min(i + searchRadius, clusterCount - 1);
+				for (int j = std::max(i - searchRadius, 0); j <= last; j++)
+				{
+					if (j == i)
+						continue;
+
+					float distance = GetMergedArea(clusterBounds[i], clusterBounds[j]);
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						bestNeighbour = j;
+					}
+				}
+
+				outNeighbours[i] = bestNeighbour;
+			}
+		});
+}
+
+//Merges mutual nearest neighbours and compacts the cluster list. Per chunk counts are turned into offsets first, so node indices
+//and the new cluster order only depend on the input and not on the number of threads.
+static void MergeClusters(ThreadPool& pool, PLOCTree& tree, const std::vector<int>& neighbours, std::vector<int>& clusters, std::vector<AABB>& clusterBounds,
+	int& clusterCount, std::vector<int>& scratchClusters, std::vector<AABB>& scratchBounds)
+{
+	const int chunkCount = (clusterCount + PLOC_GRAIN_SIZE - 1) / PLOC_GRAIN_SIZE;
+	std::vector<int> chunkClusterOffsets(chunkCount);
+	std::vector<int> chunkNodeOffsets(chunkCount);
+
+	ParallelFor(pool, clusterCount, PLOC_GRAIN_SIZE, [&](int begin, int end)
+		{
+			int survivors = 0;
+			int merges = 0;
+			for (int i = begin; i < end; i++)
+			{
+				int neighbour = neighbours[i];
+				bool mutual = neighbours[neighbour] == i;
+				if (!mutual || i < neighbour)
+					survivors++;
+				if (mutual && i < neighbour)
+					merges++;
+			}
+
+			chunkClusterOffsets[begin / PLOC_GRAIN_SIZE] = survivors;
+			chunkNodeOffsets[begin / PLOC_GRAIN_SIZE] = merges;
+		});
+
+	int clusterOffset = 0;
+	int nodeOffset = tree.nodeCount;
+	for (int chunk = 0; chunk < chunkCount; chunk++)
+	{
+		int survivors = chunkClusterOffsets[chunk];
+		int merges = chunkNodeOffsets[chunk];
+		chunkClusterOffsets[chunk] = clusterOffset;
+		chunkNodeOffsets[chunk] = nodeOffset;
+		clusterOffset += survivors;
+		nodeOffset += merges;
+	}
+
+	ParallelFor(pool, clusterCount, PLOC_GRAIN_SIZE, [&](int begin, int end)
+		{
+			int nextCluster = chunkClusterOffsets[begin / PLOC_GRAIN_SIZE];
+			int nextNode = chunkNodeOffsets[begin / PLOC_GRAIN_SIZE];
+			for (int i = begin; i < end; i++)
+			{
+				int neighbour = neighbours[i];
+				bool mutual = neighbours[neighbour] == i;
+
+				//The lower cluster of a pair creates the merged node, the higher one is dropped.
+				if (mutual && i > neighbour)
+					continue;
+
+				int slot = nextCluster++;
+				if (!mutual)
+				{
+					scratchClusters[slot] = clusters[i];
+					scratchBounds[slot] = clusterBounds[i];
+					continue;
+				}
+
+				int node = nextNode++;
+				tree.leftChildren[node] = clusters[i];
+				tree.rightChildren[node] = clusters[neighbour];
+				tree.triangleCounts[node] = tree.triangleCounts[clusters[i]] + tree.triangleCounts[clusters[neighbour]];
+				tree.bounds[node] = MergeAABB(clusterBounds[i], clusterBounds[neighbour]);
+
+				scratchClusters[slot] = node;
+				scratchBounds[slot] = tree.bounds[node];
+			}
+		});
+
+	clusters.swap(scratchClusters);
+	clusterBounds.swap(scratchBounds);
+	clusterCount = clusterOffset;
+	tree.nodeCount = nodeOffset;
+}
+
+//Writes the triangles under a cluster tree node to outTriangles from outStart, left subtree first.
+static void GatherPLOCTriangles(const PLOCTree& tree, const std::vector<Triangle>& triangles, int treeIndex, std::vector<Triangle>& outTriangles, int& outStart)
+{
+	if (tree.leftChildren[treeIndex] == -1)
+	{
+		outTriangles[outStart++] = triangles[treeIndex];
+		return;
+	}
+
+	GatherPLOCTriangles(tree, triangles, tree.leftChildren[treeIndex], outTriangles, outStart);
+	GatherPLOCTriangles(tree, triangles, tree.rightChildren[treeIndex], outTriangles, outStart);
+}
+
+//Converts a cluster tree node into the renderer layout. Subtrees of maxLeafTriangles or fewer become leaves like the other builders.
+//Children cover consecutive ranges of the node's range, so every subtree still owns one contiguous run of the reordered triangles.
+static void EmitPLOCNode(const PLOCTree& tree, const std::vector<Triangle>& triangles, std::vector<Triangle>& outTriangles, std::vector<BVHNode>& outNodes,
+	int treeIndex, int outIndex, int maxLeafTriangles)
+{
+	outNodes[outIndex].leftChild = -1;
+	outNodes[outIndex].rightChild = -1;
+
+	if (tree.leftChildren[treeIndex] == -1 || tree.triangleCounts[treeIndex] <= maxLeafTriangles)
+	{
+		int start = outNodes[outIndex].triangleStartIndex;
+		GatherPLOCTriangles(tree, triangles, treeIndex, outTriangles, start);
+		return;
+	}
+
+	int children[2] = { tree.leftChildren[treeIndex], tree.rightChildren[treeIndex] };
+	int childIndices[2];
+	int childStart = outNodes[outIndex].triangleStartIndex;
+	for (int c = 0; c < 2; c++)
+	{
+		BVHNode child;
+		child.aabb = tree.bounds[children[c]];
+		child.triangleStartIndex = childStart;
+		child.triangleCount = tree.triangleCounts[children[c]];
+		childStart += child.triangleCount;
+
+		childIndices[c] = static_cast<int>(outNodes.size());
+		outNodes.push_back(child);
+	}
+
+	outNodes[outIndex].leftChild = childIndices[0];
+	outNodes[outIndex].rightChild = childIndices[1];
+
+	EmitPLOCNode(tree, triangles, outTriangles, outNodes, children[0], childIndices[0], maxLeafTriangles);
+	EmitPLOCNode(tree, triangles, outTriangles, outNodes, children[1], childIndices[1], maxLeafTriangles);
+}
+
+void BuildBVHPLOC(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings)
+{
+	//No need to split further
+	if (static_cast<int>(triangles.size()) <= settings.maxLeafTriangles)
+		return;
+
+	ThreadPool pool(settings.parallelBuild ? settings.threadCount : 1);
+
+	std::vector<uint64_t> codes;
+	std::vector<int> order;
+	SortTrianglesByMortonCode(pool, triangles, settings.mortonCodeBits, codes, order);
+
+	const int count = static_cast<int>(triangles.size());
+	const int searchRadius = std::max(settings.plocSearchRadius, 1);
+
+	PLOCTree tree;
+	tree.leftChildren.assign(2 * count - 1, -1);
+	tree.rightChildren.assign(2 * count - 1, -1);
+	tree.triangleCounts.resize(2 * count - 1);
+	tree.bounds.resize(2 * count - 1);
+	tree.nodeCount = count;
+
+	//One cluster per triangle to start with, in Morton order so nearby clusters are close in the list.
+	std::vector<int> clusters(count);
+	std::vector<AABB> clusterBounds(count);
+	ParallelFor(pool, count, PLOC_GRAIN_SIZE, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				tree.triangleCounts[i] = 1;
+				tree.bounds[i] = triangles[i].bounds;
+
+				clusters[i] = order[i];
+				clusterBounds[i] = triangles[order[i]].bounds;
+			}
+		});
+
+	std::vector<int> neighbours(count);
+	std::vector<int> scratchClusters(count);
+	std::vector<AABB> scratchBounds(count);
+
+	int clusterCount = count;
+	while (clusterCount > 1)
+	{
+		FindNearestNeighbours(pool, clusterBounds, clusterCount, searchRadius, neighbours);
+		MergeClusters(pool, tree, neighbours, clusters, clusterBounds, clusterCount, scratchClusters, scratchBounds);
+	}
+
+	//Node 0 is the root, its children become the first pair just like BuildBVH.
+	BVHNode root = parentNode.node;
+	root.triangleStartIndex = 0;
+	root.triangleCount = count;
+
+	std::vector<Triangle> sortedTriangles(count);
+	std::vector<BVHNode> nodes;
+	nodes.reserve(2 * count);
+	nodes.push_back(root);
+	EmitPLOCNode(tree, triangles, sortedTriangles, nodes, clusters[0], 0, std::max(settings.maxLeafTriangles, 1));
+	triangles.swap(sortedTriangles);
+
+	if (nodes[0].leftChild == -1)
+		return;
+
+	for (size_t i = 1; i < nodes.size(); i++)
+	{
+		BVHNode node = nodes[i];
+		if (node.leftChild != -1)
+		{
+			node.leftChild -= 1;
+			node.rightChild -= 1;
+		}
+		outNodes.push_back(node);
+	}
+
+	parentNode.node.leftChild = currentBVHSize;
+	parentNode.node.rightChild = currentBVHSize + 1;
+}
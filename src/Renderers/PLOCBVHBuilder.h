@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Parallel locally-ordered clustering builder (Meister and Bittner 2018). Starts with one cluster per triangle in Morton order and repeatedly
+* merges every pair of clusters that are each other's nearest neighbour, searching settings.plocSearchRadius clusters either side and measuring
+* distance as the surface area of the merged bounds. Every pass runs on the thread pool, so it builds close to LBVH speed with SAH-like quality.
+*/
+void BuildBVHPLOC(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings);
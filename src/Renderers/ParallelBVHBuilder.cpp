@@ -0,0 +1,307 @@
+#include "ParallelBVHBuilder.h"
+
+#include <algorithm>
+
+#include "ModelLoader.h"
+#include "../Useful/ThreadPool.h"
+
+//Chunk size for the parallel passes. Fixed so chunk boundaries never depend on the thread count.
+static const int PARALLEL_GRAIN_SIZE = 16384;
+
+struct ParallelBuildContext
+{
+	std::vector<Triangle>& triangles;
+	std::vector<Triangle> scratch;
+	const BVHBuildSettings& settings;
+	ThreadPool& pool;
+};
+
+//Returns the number of triangles moved to the left of the node, 0 if the node should stay a leaf.
+static int PartitionNodeSAHParallel(ParallelBuildContext& context, const BVHNode& node, AABB& outLeftBounds, AABB& outRightBounds)
+{
+	const int binCount = std::max(context.settings.binCount, 2);
+	const int first = node.triangleStartIndex;
+	const int count = node.triangleCount;
+	const int chunkCount = (count + PARALLEL_GRAIN_SIZE - 1) / PARALLEL_GRAIN_SIZE;
+
+	//Centroid bounds pass
+	std::vector<AABB> chunkCentroidBounds(chunkCount, EmptyAABB());
+	ParallelFor(context.pool, count, PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+		{
+			AABB& bounds = chunkCentroidBounds[begin / PARALLEL_GRAIN_SIZE];
+			for (int i = begin; i < end; i++)
+				bounds.Grow(context.triangles[first + i].triCentroid);
+		});
+
+	AABB centroidBounds = EmptyAABB();
+	for (const AABB& bounds : chunkCentroidBounds)
+	{
+		centroidBounds.Grow(bounds.min);
+		centroidBounds.Grow(bounds.max);
+	}
+
+	glm::vec3 binScale;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		binScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+	}
+
+	//Binning pass, every chunk fills its own bins for all three axes.
+	std::vector<SAHBin> chunkBins(static_cast<size_t>(chunkCount) * 3 * binCount);
+	ParallelFor(context.pool, count, PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+		{
+			SAHBin* bins = &chunkBins[static_cast<size_t>(begin / PARALLEL_GRAIN_SIZE) * 3 * binCount];
+			for (int b = 0; b < 3 * binCount; b++)
+				bins[b].bounds = EmptyAABB();
+
+			for (int i = begin; i < end; i++)
+			{
+				const Triangle& tri = context.triangles[first + i];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					if (binScale[axis] == 0.0f)
+						continue;
+
+					SAHBin& bin = bins[axis * binCount + GetSAHBinIndex(tri.triCentroid[axis], centroidBounds.min[axis], binScale[axis], binCount)];
+					bin.triangleCount++;
+					bin.bounds.Grow(tri.bounds.min);
+					bin.bounds.Grow(tri.bounds.max);
+				}
+			}
+		});
+
+	int bestAxis = -1, bestSplitBin = -1;
+	float bestCost = FLT_MAX;
+	std::vector<std::vector<SAHBin>> axisBins(3, std::vector<SAHBin>(binCount));
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (binScale[axis] == 0.0f)
+			continue;
+
+		std::vector<SAHBin>& bins = axisBins[axis];
+		for (int b = 0; b < binCount; b++)
+		{
+			bins[b].bounds = EmptyAABB();
+			for (int chunk = 0; chunk < chunkCount; chunk++)
+			{
+				const SAHBin& chunkBin = chunkBins[(static_cast<size_t>(chunk) * 3 + axis) * binCount + b];
+				if (chunkBin.triangleCount == 0)
+					continue;
+
+				bins[b].triangleCount += chunkBin.triangleCount;
+				bins[b].bounds.Grow(chunkBin.bounds.min);
+				bins[b].bounds.Grow(chunkBin.bounds.max);
+			}
+		}
+
+		int splitBin;
+		float cost = EvaluateSAHBins(bins, splitBin);
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			bestAxis = axis;
+			bestSplitBin = splitBin;
+		}
+	}
+
+	if (bestAxis == -1)
+		return 0;
+
+	float splitCost = context.settings.traversalCost * node.aabb.GetArea() + context.settings.intersectionCost * bestCost;
+	float leafCost = context.settings.intersectionCost * count * node.aabb.GetArea();
+	if (splitCost >= leafCost)
+		return 0;
+
+	//The chosen bins already hold the exact child bounds.
+	outLeftBounds = EmptyAABB();
+	outRightBounds = EmptyAABB();
+	for (int b = 0; b < binCount; b++)
+	{
+		const SAHBin& bin = axisBins[bestAxis][b];
+		if (bin.triangleCount == 0)
+			continue;
+
+		AABB& target = b <= bestSplitBin ? outLeftBounds : outRightBounds;
+		target.Grow(bin.bounds.min);
+		target.Grow(bin.bounds.max);
+	}
+
+	auto goesLeft = [&](const Triangle& tri)
+		{
+			return GetSAHBinIndex(tri.triCentroid[bestAxis], centroidBounds.min[bestAxis], binScale[bestAxis], binCount) <= bestSplitBin;
+		};
+
+	//Stable partition: count per chunk, prefix sum, then scatter through the scratch buffer.
+	std::vector<int> chunkLeftCounts(chunkCount, 0);
+	ParallelFor(context.pool, count, PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+		{
+			int leftCount = 0;
+			for (int i = begin; i < end; i++)
+			{
+				if (goesLeft(context.triangles[first + i]))
+					leftCount++;
+			}
+			chunkLeftCounts[begin / PARALLEL_GRAIN_SIZE] = leftCount;
+		});
+
+	std::vector<int> chunkLeftOffsets(chunkCount), chunkRightOffsets(chunkCount);
+	int totalLeft = 0;
+	for (int chunk = 0; chunk < chunkCount; chunk++)
+	{
+		chunkLeftOffsets[chunk] = totalLeft;
+		totalLeft += chunkLeftCounts[chunk];
+	}
+
+	if (totalLeft == 0 || totalLeft == count)
+		return 0;
+
+	for (int chunk = 0; chunk < chunkCount; chunk++)
+		chunkRightOffsets[chunk] = totalLeft + chunk * PARALLEL_GRAIN_SIZE - chunkLeftOffsets[chunk];
+
+	ParallelFor(context.pool, count, PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+		{
+			int chunk = begin / PARALLEL_GRAIN_SIZE;
+			int left = first + chunkLeftOffsets[chunk];
+			int right = first + chunkRightOffsets[chunk];
+			for (int i = begin; i < end; i++)
+			{
+				const Triangle& tri = context.triangles[first + i];
+				if (goesLeft(tri))
+					context.scratch[left++] = tri;
+				else
+					context.scratch[right++] = tri;
+			}
+		});
+
+	ParallelFor(context.pool, count, PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+		{
+			std::copy(context.scratch.begin() + first + begin, context.scratch.begin() + first + end, context.triangles.begin() + first + begin);
+		});
+
+	return totalLeft;
+}
+
+//Builds every node below the given node. Descendants are laid out exactly like the serial builder would append them,
+//[left, right, left subtree..., right subtree...], with child indices relative to the start of outDescendants.
+static void BuildDescendants(ParallelBuildContext& context, BVHNode& node, std::vector<BVHNode>& outDescendants)
+{
+	node.leftChild = -1;
+	node.rightChild = -1;
+
+	//No need to split further
+	if (node.triangleCount <= context.settings.maxLeafTriangles)
+		return;
+
+	if (node.triangleCount < context.settings.parallelTaskCutoff)
+	{
+		std::vector<BVHNode> subtree;
+		subtree.push_back(node);
+		SplitBVHNodeSAH(context.triangles, subtree, 0, context.settings);
+
+		node = subtree[0];
+		if (node.leftChild == -1)
+			return;
+
+		node.leftChild -= 1;
+		node.rightChild -= 1;
+
+		outDescendants.reserve(subtree.size() - 1);
+		for (size_t i = 1; i < subtree.size(); i++)
+		{
+			BVHNode descendant = subtree[i];
+			if (descendant.leftChild != -1)
+			{
+				descendant.leftChild -= 1;
+				descendant.rightChild -= 1;
+			}
+			outDescendants.push_back(descendant);
+		}
+		return;
+	}
+
+	BVHNode leftChild;
+	BVHNode rightChild;
+
+	int leftCount;
+	if (node.triangleCount >= context.settings.parallelPassCutoff)
+	{
+		leftCount = PartitionNodeSAHParallel(context, node, leftChild.aabb, rightChild.aabb);
+	}
+	else
+	{
+		leftCount = PartitionNodeSAH(context.triangles, node, context.settings);
+		leftChild.aabb = AABB();
+		rightChild.aabb = AABB();
+	}
+
+	if (leftCount == 0)
+		return;
+
+	leftChild.triangleStartIndex = node.triangleStartIndex;
+	leftChild.triangleCount = leftCount;
+
+	rightChild.triangleStartIndex = node.triangleStartIndex + leftCount;
+	rightChild.triangleCount = node.triangleCount - leftCount;
+
+	if (node.triangleCount < context.settings.parallelPassCutoff)
+	{
+		ExpandNodeAABB(context.triangles, leftChild);
+		ExpandNodeAABB(context.triangles, rightChild);
+	}
+
+	std::vector<BVHNode> leftDescendants, rightDescendants;
+	{
+		TaskGroup group(context.pool);
+		group.Run([&]() { BuildDescendants(context, leftChild, leftDescendants); });
+		BuildDescendants(context, rightChild, rightDescendants);
+		group.Wait();
+	}
+
+	node.leftChild = 0;
+	node.rightChild = 1;
+
+	int leftOffset = 2;
+	int rightOffset = 2 + static_cast<int>(leftDescendants.size());
+
+	outDescendants.reserve(2 + leftDescendants.size() + rightDescendants.size());
+	outDescendants.push_back(leftChild);
+	outDescendants.push_back(rightChild);
+	outDescendants.insert(outDescendants.end(), leftDescendants.begin(), leftDescendants.end());
+	outDescendants.insert(outDescendants.end(), rightDescendants.begin(), rightDescendants.end());
+
+	for (int i = 0; i < static_cast<int>(outDescendants.size()); i++)
+	{
+		BVHNode& descendant = outDescendants[i];
+		if (descendant.leftChild == -1)
+			continue;
+
+		int offset = i < 2 ? (i == 0 ? leftOffset : rightOffset) : (i < rightOffset ? leftOffset : rightOffset);
+		descendant.leftChild += offset;
+		descendant.rightChild += offset;
+	}
+}
+
+void BuildBVHSAHParallel(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings)
+{
+	//No need to split further
+	if (static_cast<int>(triangles.size()) <= settings.maxLeafTriangles)
+		return;
+
+	ThreadPool pool(settings.threadCount);
+	ParallelBuildContext context{ triangles, {}, settings, pool };
+	if (static_cast<int>(triangles.size()) >= settings.parallelPassCutoff)
+		context.scratch.resize(triangles.size());
+
+	BVHNode root = parentNode.node;
+	std::vector<BVHNode> descendants;
+	BuildDescendants(context, root, descendants);
+
+	if (root.leftChild == -1)
+		return;
+
+	outNodes.insert(outNodes.end(), descendants.begin(), descendants.end());
+
+	parentNode.node.leftChild = currentBVHSize;
+	parentNode.node.rightChild = currentBVHSize + 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Binned SAH builder that forks subtrees onto a work stealing thread pool. Nodes near the root also bin, partition and compute their bounds in parallel.
+* The node and triangle order only depend on the input and the settings, so the output is identical for any thread count.
+*/
+void BuildBVHSAHParallel(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings);
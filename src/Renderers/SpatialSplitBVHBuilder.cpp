@@ -0,0 +1,454 @@
+#include "SpatialSplitBVHBuilder.h"
+
+#include <algorithm>
+
+#include "ModelLoader.h"
+
+struct SpatialSplitReference
+{
+	int triangleIndex;
+	AABB bounds;
+};
+
+struct SpatialSplitBin
+{
+	AABB bounds;
+	int entries = 0;
+	int exits = 0;
+};
+
+struct SpatialSplitContext
+{
+	const std::vector<Triangle>& sourceTriangles;
+	std::vector<Triangle>& outTriangles;
+	std::vector<BVHNode>& outNodes;
+	const BVHBuildSettings& settings;
+
+	float rootArea;
+	int maxDuplicates;
+	int duplicatedReferences = 0;
+};
+
+struct SpatialSplitCandidate
+{
+	float cost = FLT_MAX;
+	int axis = -1;
+	int splitBin = -1;
+	float splitPosition = 0.0f;
+	AABB leftBounds;
+	AABB rightBounds;
+};
+
+static glm::vec3 GetCentre(const AABB& aabb)
+{
+	return (aabb.min + aabb.max) * 0.5f;
+}
+
+static AABB Intersect(const AABB& a, const AABB& b)
+{
+	AABB result;
+	result.min = glm::max(a.min, b.min);
+	result.max = glm::min(a.max, b.max);
+	return result;
+}
+
+static AABB Union(const AABB& a, const AABB& b)
+{
+	AABB result;
+	result.min = glm::min(a.min, b.min);
+	result.max = glm::max(a.max, b.max);
+	return result;
+}
+
+static bool IsValid(const AABB& aabb)
+{
+	return aabb.min.x <= aabb.max.x && aabb.min.y <= aabb.max.y && aabb.min.z <= aabb.max.z;
+}
+
+//Bounds of the part of the triangle that lies between two planes on an axis, clipped to the reference bounds.
+static AABB ClipTriangleBounds(const Triangle& tri, const AABB& referenceBounds, int axis, float planeMin, float planeMax)
+{
+	AABB clipped = EmptyAABB();
+	glm::vec3 vertices[3] = { tri.v0, tri.v1, tri.v2 };
+
+	for (int i = 0; i < 3; i++)
+	{
+		const glm::vec3& a = vertices[i];
+		const glm::vec3& b = vertices[(i + 1) % 3];
+
+		if (a[axis] >= planeMin && a[axis] <= planeMax)
+			clipped.Grow(a);
+
+		//Add the points where the edge crosses either plane.
+		float planes[2] = { planeMin, planeMax };
+		for (float plane : planes)
+		{
+			if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
+			{
+				float t = (plane - a[axis]) / (b[axis] - a[axis]);
+				glm::vec3 point = a + (b - a) * t;
+				point[axis] = plane;
+				clipped.Grow(point);
+			}
+		}
+	}
+
+	return Intersect(clipped, referenceBounds);
+}
+
+static void FindObjectSplit(const std::vector<SpatialSplitReference>& references, const BVHBuildSettings& settings, SpatialSplitCandidate& outSplit)
+{
+	const int binCount = std::max(settings.binCount, 2);
+
+	AABB centroidBounds = EmptyAABB();
+	for (const SpatialSplitReference& reference : references)
+		centroidBounds.Grow(GetCentre(reference.bounds));
+
+	std::vector<SAHBin> bins(binCount);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		float binScale = binCount / extent;
+		for (SAHBin& bin : bins)
+		{
+			bin.bounds = EmptyAABB();
+			bin.triangleCount = 0;
+		}
+
+		for (const SpatialSplitReference& reference : references)
+		{
+			SAHBin& bin = bins[GetSAHBinIndex(GetCentre(reference.bounds)[axis], centroidBounds.min[axis], binScale, binCount)];
+			bin.triangleCount++;
+			bin.bounds = Union(bin.bounds, reference.bounds);
+		}
+
+		int splitBin;
+		float cost = EvaluateSAHBins(bins, splitBin);
+		if (cost >= outSplit.cost)
+			continue;
+
+		outSplit.cost = cost;
+		outSplit.axis = axis;
+		outSplit.splitBin = splitBin;
+		outSplit.splitPosition = centroidBounds.min[axis] + (splitBin + 1) / binScale;
+		outSplit.leftBounds = EmptyAABB();
+		outSplit.rightBounds = EmptyAABB();
+		for (int b = 0; b < binCount; b++)
+		{
+			if (bins[b].triangleCount == 0)
+				continue;
+
+			AABB& target = b <= splitBin ? outSplit.leftBounds : outSplit.rightBounds;
+			target = Union(target, bins[b].bounds);
+		}
+	}
+}
+
+static void FindSpatialSplit(const SpatialSplitContext& context, const std::vector<SpatialSplitReference>& references, const AABB& nodeBounds, SpatialSplitCandidate& outSplit)
+{
+	const int binCount = std::max(context.settings.binCount, 2);
+	std::vector<SpatialSplitBin> bins(binCount);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = nodeBounds.max[axis] - nodeBounds.min[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		float binWidth = extent / binCount;
+		float binScale = binCount / extent;
+		for (SpatialSplitBin& bin : bins)
+		{
+			bin.bounds = EmptyAABB();
+			bin.entries = 0;
+			bin.exits = 0;
+		}
+
+		//Chop every reference into the bins it overlaps.
+		for (const SpatialSplitReference& reference : references)
+		{
+			const Triangle& tri = context.sourceTriangles[reference.triangleIndex];
+			int firstBin = GetSAHBinIndex(reference.bounds.min[axis], nodeBounds.min[axis], binScale, binCount);
+			int lastBin = GetSAHBinIndex(reference.bounds.max[axis], nodeBounds.min[axis], binScale, binCount);
+
+			for (int b = firstBin; b <= lastBin; b++)
+			{
+				float planeMin = nodeBounds.min[axis] + b * binWidth;
+				float planeMax = b == binCount - 1 ? nodeBounds.max[axis] : planeMin + binWidth;
+				AABB clipped = firstBin == lastBin ? reference.bounds : ClipTriangleBounds(tri, reference.bounds, axis, planeMin, planeMax);
+				if (IsValid(clipped))
+					bins[b].bounds = Union(bins[b].bounds, clipped);
+			}
+
+			bins[firstBin].entries++;
+			bins[lastBin].exits++;
+		}
+
+		std::vector<AABB> rightBounds(binCount);
+		std::vector<int> rightCounts(binCount);
+		AABB rightBox = EmptyAABB();
+		int rightCount = 0;
+		for (int b = binCount - 1; b > 0; b--)
+		{
+			rightBox = Union(rightBox, bins[b].bounds);
+			rightCount += bins[b].exits;
+			rightBounds[b] = rightBox;
+			rightCounts[b] = rightCount;
+		}
+
+		AABB leftBox = EmptyAABB();
+		int leftCount = 0;
+		for (int b = 0; b < binCount - 1; b++)
+		{
+			leftBox = Union(leftBox, bins[b].bounds);
+			leftCount += bins[b].entries;
+
+			if (leftCount == 0 || rightCounts[b + 1] == 0)
+				continue;
+
+			float cost = leftCount * leftBox.GetArea() + rightCounts[b + 1] * rightBounds[b + 1].GetArea();
+			if (cost >= outSplit.cost)
+				continue;
+
+			outSplit.cost = cost;
+			outSplit.axis = axis;
+			outSplit.splitBin = b;
+			outSplit.splitPosition = nodeBounds.min[axis] + (b + 1) * binWidth;
+			outSplit.leftBounds = leftBox;
+			outSplit.rightBounds = rightBounds[b + 1];
+		}
+	}
+}
+
+static void PartitionObjectSplit(const std::vector<SpatialSplitReference>& references, const SpatialSplitCandidate& split, std::vector<SpatialSplitReference>& outLeft, std::vector<SpatialSplitReference>& outRight)
+{
+	for (const SpatialSplitReference& reference : references)
+	{
+		if (GetCentre(reference.bounds)[split.axis] < split.splitPosition)
+			outLeft.push_back(reference);
+		else
+			outRight.push_back(reference);
+	}
+
+	//Guard against floating point disagreement with the binning leaving one side empty.
+	if (outLeft.empty() || outRight.empty())
+	{
+		outLeft.clear();
+		outRight.clear();
+		size_t half = references.size() / 2;
+		outLeft.assign(references.begin(), references.begin() + half);
+		outRight.assign(references.begin() + half, references.end());
+	}
+}
+
+static void PartitionSpatialSplit(SpatialSplitContext& context, const std::vector<SpatialSplitReference>& references, const SpatialSplitCandidate& split, std::vector<SpatialSplitReference>& outLeft, std::vector<SpatialSplitReference>& outRight)
+{
+	const int axis = split.axis;
+	const float position = split.splitPosition;
+
+	std::vector<const SpatialSplitReference*> straddling;
+	AABB leftBounds = EmptyAABB(), rightBounds = EmptyAABB();
+	for (const SpatialSplitReference& reference : references)
+	{
+		if (reference.bounds.max[axis] <= position)
+		{
+			outLeft.push_back(reference);
+			leftBounds = Union(leftBounds, reference.bounds);
+		}
+		else if (reference.bounds.min[axis] >= position)
+		{
+			outRight.push_back(reference);
+			rightBounds = Union(rightBounds, reference.bounds);
+		}
+		else
+		{
+			straddling.push_back(&reference);
+		}
+	}
+
+	for (const SpatialSplitReference* reference : straddling)
+	{
+		const Triangle& tri = context.sourceTriangles[reference->triangleIndex];
+		AABB leftPart = ClipTriangleBounds(tri, reference->bounds, axis, reference->bounds.min[axis], position);
+		AABB rightPart = ClipTriangleBounds(tri, reference->bounds, axis, position, reference->bounds.max[axis]);
+
+		int leftCount = static_cast<int>(outLeft.size());
+		int rightCount = static_cast<int>(outRight.size());
+
+		//Reference unsplitting, keep the whole triangle on one side when that is no more expensive than duplicating it.
+		float splitCost = Union(leftBounds, leftPart).GetArea() * (leftCount + 1) + Union(rightBounds, rightPart).GetArea() * (rightCount + 1);
+		float leftOnlyCost = Union(leftBounds, reference->bounds).GetArea() * (leftCount + 1) + rightBounds.GetArea() * rightCount;
+		float rightOnlyCost = leftBounds.GetArea() * leftCount + Union(rightBounds, reference->bounds).GetArea() * (rightCount + 1);
+
+		bool canDuplicate = context.duplicatedReferences < context.maxDuplicates && IsValid(leftPart) && IsValid(rightPart);
+		if (canDuplicate && splitCost < leftOnlyCost && splitCost < rightOnlyCost)
+		{
+			outLeft.push_back({ reference->triangleIndex, leftPart });
+			outRight.push_back({ reference->triangleIndex, rightPart });
+			leftBounds = Union(leftBounds, leftPart);
+			rightBounds = Union(rightBounds, rightPart);
+			context.duplicatedReferences++;
+		}
+		else if (leftOnlyCost <= rightOnlyCost)
+		{
+			outLeft.push_back(*reference);
+			leftBounds = Union(leftBounds, reference->bounds);
+		}
+		else
+		{
+			outRight.push_back(*reference);
+			rightBounds = Union(rightBounds, reference->bounds);
+		}
+	}
+}
+
+static AABB GetReferenceBounds(const std::vector<SpatialSplitReference>& references)
+{
+	AABB bounds = EmptyAABB();
+	for (const SpatialSplitReference& reference : references)
+		bounds = Union(bounds, reference.bounds);
+	return bounds;
+}
+
+static void EmitLeaf(SpatialSplitContext& context, const std::vector<SpatialSplitReference>& references, int nodeIndex)
+{
+	BVHNode& node = context.outNodes[nodeIndex];
+	node.leftChild = -1;
+	node.rightChild = -1;
+	node.triangleStartIndex = static_cast<int>(context.outTriangles.size());
+	node.triangleCount = static_cast<int>(references.size());
+
+	for (const SpatialSplitReference& reference : references)
+		context.outTriangles.push_back(context.sourceTriangles[reference.triangleIndex]);
+}
+
+static void SplitSpatialSplitNode(SpatialSplitContext& context, std::vector<SpatialSplitReference>& references, int nodeIndex)
+{
+	//No need to split further
+	if (static_cast<int>(references.size()) <= context.settings.maxLeafTriangles)
+	{
+		EmitLeaf(context, references, nodeIndex);
+		return;
+	}
+
+	AABB nodeBounds = context.outNodes[nodeIndex].aabb;
+	float nodeArea = nodeBounds.GetArea();
+
+	SpatialSplitCandidate objectSplit;
+	FindObjectSplit(references, context.settings, objectSplit);
+
+	//Spatial splits are only worth trying when the object split children overlap noticeably.
+	SpatialSplitCandidate spatialSplit;
+	if (objectSplit.axis != -1 && context.duplicatedReferences < context.maxDuplicates)
+	{
+		AABB overlap = Intersect(objectSplit.leftBounds, objectSplit.rightBounds);
+		float overlapArea = IsValid(overlap) ? overlap.GetArea() : 0.0f;
+		if (overlapArea / context.rootArea > context.settings.spatialSplitAlpha)
+			FindSpatialSplit(context, references, nodeBounds, spatialSplit);
+	}
+
+	bool useSpatialSplit = spatialSplit.axis != -1 && spatialSplit.cost < objectSplit.cost;
+	const SpatialSplitCandidate& bestSplit = useSpatialSplit ? spatialSplit : objectSplit;
+
+	float splitCost = context.settings.traversalCost * nodeArea + context.settings.intersectionCost * bestSplit.cost;
+	float leafCost = context.settings.intersectionCost * references.size() * nodeArea;
+	if (bestSplit.axis == -1 || splitCost >= leafCost)
+	{
+		EmitLeaf(context, references, nodeIndex);
+		return;
+	}
+
+	std::vector<SpatialSplitReference> leftReferences, rightReferences;
+	if (useSpatialSplit)
+		PartitionSpatialSplit(context, references, bestSplit, leftReferences, rightReferences);
+	else
+		PartitionObjectSplit(references, bestSplit, leftReferences, rightReferences);
+
+	if (leftReferences.empty() || rightReferences.empty())
+	{
+		EmitLeaf(context, references, nodeIndex);
+		return;
+	}
+
+	//The parent's references are no longer needed once they have been distributed.
+	std::vector<SpatialSplitReference>().swap(references);
+
+	int leftChildIndex = static_cast<int>(context.outNodes.size());
+	int rightChildIndex = leftChildIndex + 1;
+
+	context.outNodes[nodeIndex].leftChild = leftChildIndex;
+	context.outNodes[nodeIndex].rightChild = rightChildIndex;
+
+	BVHNode leftChild;
+	leftChild.aabb = GetReferenceBounds(leftReferences);
+
+	BVHNode rightChild;
+	rightChild.aabb = GetReferenceBounds(rightReferences);
+
+	context.outNodes.push_back(leftChild);
+	context.outNodes.push_back(rightChild);
+
+	SplitSpatialSplitNode(context, leftReferences, leftChildIndex);
+	SplitSpatialSplitNode(context, rightReferences, rightChildIndex);
+
+	//Triangles are appended in depth first order, so a subtree covers one contiguous range.
+	BVHNode& node = context.outNodes[nodeIndex];
+	node.triangleStartIndex = context.outNodes[leftChildIndex].triangleStartIndex;
+	node.triangleCount = context.outNodes[leftChildIndex].triangleCount + context.outNodes[rightChildIndex].triangleCount;
+}
+
+void BuildBVHSpatialSplits(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings, BVHBuildStats* outStats)
+{
+	//No need to split further
+	if (static_cast<int>(triangles.size()) <= settings.maxLeafTriangles)
+		return;
+
+	std::vector<SpatialSplitReference> references(triangles.size());
+	for (int i = 0; i < static_cast<int>(triangles.size()); i++)
+	{
+		references[i].triangleIndex = i;
+		references[i].bounds = triangles[i].bounds;
+	}
+
+	std::vector<Triangle> outTriangles;
+	outTriangles.reserve(triangles.size());
+
+	//The root is built as node 0 and moved into the parent node afterwards.
+	std::vector<BVHNode> nodes;
+	BVHNode root;
+	root.aabb = GetReferenceBounds(references);
+	nodes.push_back(root);
+
+	SpatialSplitContext context{ triangles, outTriangles, nodes, settings };
+	context.rootArea = std::max(root.aabb.GetArea(), FLT_MIN);
+	context.maxDuplicates = static_cast<int>(settings.spatialSplitBudget * triangles.size());
+
+	SplitSpatialSplitNode(context, references, 0);
+
+	triangles.swap(outTriangles);
+	parentNode.node.triangleStartIndex = 0;
+	parentNode.node.triangleCount = static_cast<int>(triangles.size());
+
+	if (outStats)
+		outStats->duplicatedReferences = context.duplicatedReferences;
+
+	if (nodes[0].leftChild == -1)
+		return;
+
+	for (size_t i = 1; i < nodes.size(); i++)
+	{
+		BVHNode node = nodes[i];
+		if (node.leftChild != -1)
+		{
+			node.leftChild -= 1;
+			node.rightChild -= 1;
+		}
+		outNodes.push_back(node);
+	}
+
+	parentNode.node.leftChild = currentBVHSize;
+	parentNode.node.rightChild = currentBVHSize + 1;
+}
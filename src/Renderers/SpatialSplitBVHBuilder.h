@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Spatial split BVH builder (Stich et al. 2009). Alongside object splits it considers splitting space itself and lets a triangle that
+* straddles the plane be referenced from both children, with each reference clipped to its side.
+* Duplicated references are copied into the triangle list, up to settings.spatialSplitBudget times the input triangle count.
+*/
+void BuildBVHSpatialSplits(std::vector<Triangle>& triangles, std::vector<BVHNode>& outNodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings, BVHBuildStats* outStats);
@@ -0,0 +1,422 @@
+#include "TopLevelBVHBuilder.h"
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+
+#include "ModelLoader.h"
+
+static const int TOP_LEVEL_BIN_COUNT = 16;
+
+static glm::vec3 GetAABBCentre(const AABB& aabb)
+{
+	return (aabb.min + aabb.max) * 0.5f;
+}
+
+//Returns the number of instances moved to the front of the range. Never leaves a side empty, so every range splits down to single instances.
+static int PartitionTopLevelInstances(const std::vector<AABB>& instanceBounds, std::vector<int>& instances, int first, int count)
+{
+	glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+	for (int i = first; i < first + count; i++)
+	{
+		glm::vec3 centre = GetAABBCentre(instanceBounds[instances[i]]);
+		centroidMin = glm::min(centroidMin, centre);
+		centroidMax = glm::max(centroidMax, centre);
+	}
+
+	std::vector<SAHBin> bins(TOP_LEVEL_BIN_COUNT);
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplitBin = -1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		float binScale = TOP_LEVEL_BIN_COUNT / extent;
+		for (SAHBin& bin : bins)
+		{
+			bin.bounds = EmptyAABB();
+			bin.triangleCount = 0;
+		}
+
+		for (int i = first; i < first + count; i++)
+		{
+			const AABB& bounds = instanceBounds[instances[i]];
+			SAHBin& bin = bins[GetSAHBinIndex(GetAABBCentre(bounds)[axis], centroidMin[axis], binScale, TOP_LEVEL_BIN_COUNT)];
+			bin.triangleCount++;
+			bin.bounds.Grow(bounds.min);
+			bin.bounds.Grow(bounds.max);
+		}
+
+		int splitBin;
+		float cost = EvaluateSAHBins(bins, splitBin);
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			bestAxis = axis;
+			bestSplitBin = splitBin;
+		}
+	}
+
+	auto begin = instances.begin() + first;
+	auto end = begin + count;
+	int leftCount = 0;
+	if (bestAxis != -1)
+	{
+		float binScale = TOP_LEVEL_BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		auto middle = std::partition(begin, end, [&](int instance)
+			{
+				return GetSAHBinIndex(GetAABBCentre(instanceBounds[instance])[bestAxis], centroidMin[bestAxis], binScale, TOP_LEVEL_BIN_COUNT) <= bestSplitBin;
+			});
+		leftCount = static_cast<int>(middle - begin);
+	}
+
+	//Stacked or identical objects give no usable plane, split them down the middle instead.
+	if (leftCount == 0 || leftCount == count)
+		leftCount = count / 2;
+
+	return leftCount;
+}
+
+//Depth a range of count instances reaches when every split below it halves the range.
+static int GetBalancedDepth(int count)
+{
+	int depth = 0;
+	while ((1 << depth) < count)
+		depth++;
+
+	return depth;
+}
+
+//Splits a range in half at the median centroid along the axis the centroids spread furthest on.
+static int SplitTopLevelInstancesAtMedian(const std::vector<AABB>& instanceBounds, std::vector<int>& instances, int first, int count)
+{
+	AABB centroidBounds = EmptyAABB();
+	for (int i = first; i < first + count; i++)
+		centroidBounds.Grow(GetAABBCentre(instanceBounds[instances[i]]));
+
+	int axis = centroidBounds.GetLongestAxis();
+	auto begin = instances.begin() + first;
+	std::nth_element(begin, begin + count / 2, begin + count, [&](int a, int b)
+		{
+			return GetAABBCentre(instanceBounds[a])[axis] < GetAABBCentre(instanceBounds[b])[axis];
+		});
+
+	return count / 2;
+}
+
+void BuildTopLevelBVH(const std::vector<AABB>& instanceBounds, std::vector<BVHNode>& outNodes)
+{
+	outNodes.clear();
+	if (instanceBounds.empty())
+		return;
+
+	const int instanceCount = static_cast<int>(instanceBounds.size());
+	std::vector<int> instances(instanceCount);
+	std::iota(instances.begin(), instances.end(), 0);
+
+	struct PendingNode
+	{
+		int nodeIndex;
+		int first;
+		int count;
+		int depth;
+	};
+
+	//Every range keeps depth + GetBalancedDepth(count) within the limit, SAH splits that would break it are replaced by a median split.
+	const int maxDepth = std::max(TOP_LEVEL_TRAVERSAL_STACK_SIZE - 1, GetBalancedDepth(instanceCount));
+
+	outNodes.reserve(instanceCount * 2 - 1);
+	outNodes.emplace_back();
+
+	std::vector<PendingNode> stack;
+	stack.push_back({ 0, 0, instanceCount, 0 });
+	while (!stack.empty())
+	{
+		PendingNode pending = stack.back();
+		stack.pop_back();
+
+		BVHNode node;
+		node.aabb = EmptyAABB();
+		for (int i = pending.first; i < pending.first + pending.count; i++)
+		{
+			node.aabb.Grow(instanceBounds[instances[i]].min);
+			node.aabb.Grow(instanceBounds[instances[i]].max);
+		}
+
+		if (pending.count == 1)
+		{
+			node.leftChild = -1;
+			node.rightChild = -1;
+			node.triangleStartIndex = instances[pending.first];
+			node.triangleCount = -1;
+			outNodes[pending.nodeIndex] = node;
+			continue;
+		}
+
+		int leftCount = PartitionTopLevelInstances(instanceBounds, instances, pending.first, pending.count);
+		int childDepth = pending.depth + 1;
+		if (childDepth + GetBalancedDepth(std::max(leftCount, pending.count - leftCount)) > maxDepth)
+			leftCount = SplitTopLevelInstancesAtMedian(instanceBounds, instances, pending.first, pending.count);
+
+		node.leftChild = static_cast<int>(outNodes.size());
+		node.rightChild = node.leftChild + 1;
+		node.triangleStartIndex = -1;
+		node.triangleCount = 0;
+		outNodes[pending.nodeIndex] = node;
+		outNodes.emplace_back();
+		outNodes.emplace_back();
+
+		stack.push_back({ node.rightChild, pending.first + leftCount, pending.count - leftCount, childDepth });
+		stack.push_back({ node.leftChild, pending.first, leftCount, childDepth });
+	}
+}
+
+AABB TransformAABB(const AABB& aabb, const glm::mat4& transform)
+{
+	AABB transformed = EmptyAABB();
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 point(corner & 1 ? aabb.max.x : aabb.min.x, corner & 2 ? aabb.max.y : aabb.min.y, corner & 4 ? aabb.max.z : aabb.min.z);
+		transformed.Grow(glm::vec3(transform * glm::vec4(point, 1.0f)));
+	}
+
+	return transformed;
+}
+
+int GetRebraidReferenceLimit(int instanceCount, float budget)
+{
+	return std::max(instanceCount, static_cast<int>(instanceCount * budget));
+}
+
+static bool BoundsOverlap(const AABB& a, const AABB& b)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (std::min(a.max[axis], b.max[axis]) <= std::max(a.min[axis], b.min[axis]))
+			return false;
+	}
+
+	return true;
+}
+
+void RebraidTopLevelInstances(const std::vector<ParentBVHNode>& instances, const std::vector<glm::mat4>& instanceTransforms,
+	const std::vector<PackedBVHNode>& nodes,
+	float budget, std::vector<TopLevelReference>& outReferences, std::vector<AABB>& outReferenceBounds)
+{
+	outReferences.clear();
+	outReferenceBounds.clear();
+
+	const int instanceCount = static_cast<int>(instances.size());
+	const int referenceLimit = GetRebraidReferenceLimit(instanceCount, budget);
+
+	auto getChildren = [&](const TopLevelReference& reference, int& outLeft, int& outRight)
+		{
+			if (reference.node == -1)
+			{
+				outLeft = instances[reference.instance].node.leftChild;
+				outRight = instances[reference.instance].node.rightChild;
+			}
+			else
+			{
+				outLeft = nodes[reference.node].IsLeaf() ? -1 : nodes[reference.node].leftChildOrFirstTriangle;
+				outRight = nodes[reference.node].IsLeaf() ? -1 : nodes[reference.node].rightChildOrTriangleCount;
+			}
+		};
+
+	//A child's world box lies inside its parent's, so every reference an instance can be opened into lies inside the instance's bounds
+	//grown by its root's children. Only instances whose reach overlaps can have overlapping references, the pairs are found once by
+	//sweeping along x and each opening then only checks the references of its instance's neighbours.
+	std::vector<AABB> instanceReach(instanceCount);
+	for (int i = 0; i < instanceCount; i++)
+	{
+		instanceReach[i] = instances[i].node.aabb;
+
+		int left, right;
+		getChildren({ i, -1 }, left, right);
+		for (int child : { left, right })
+		{
+			if (child == -1)
+				continue;
+
+			AABB childBounds;
+			childBounds.min = nodes[child].min;
+			childBounds.max = nodes[child].max;
+			AABB transformed = TransformAABB(childBounds, instanceTransforms[i]);
+			instanceReach[i].Grow(transformed.min);
+			instanceReach[i].Grow(transformed.max);
+		}
+	}
+
+	std::vector<int> sweepOrder(instanceCount);
+	std::iota(sweepOrder.begin(), sweepOrder.end(), 0);
+	std::sort(sweepOrder.begin(), sweepOrder.end(), [&](int a, int b) { return instanceReach[a].min.x < instanceReach[b].min.x; });
+
+	std::vector<std::vector<int>> neighbourInstances(instanceCount);
+	for (int i = 0; i < instanceCount; i++)
+	{
+		int instance = sweepOrder[i];
+		for (int j = i + 1; j < instanceCount && instanceReach[sweepOrder[j]].min.x < instanceReach[instance].max.x; j++)
+		{
+			if (!BoundsOverlap(instanceReach[instance], instanceReach[sweepOrder[j]]))
+				continue;
+
+			neighbourInstances[instance].push_back(sweepOrder[j]);
+			neighbourInstances[sweepOrder[j]].push_back(instance);
+		}
+	}
+
+	//Largest references are opened first, they are the ones most rays enter without hitting anything.
+	std::priority_queue<std::pair<float, int>> openable;
+	std::vector<std::vector<int>> instanceReferences(instanceCount);
+	auto addReference = [&](const TopLevelReference& reference, const AABB& bounds, int index)
+		{
+			if (index == static_cast<int>(outReferences.size()))
+			{
+				outReferences.push_back(reference);
+				outReferenceBounds.push_back(bounds);
+				instanceReferences[reference.instance].push_back(index);
+			}
+			else
+			{
+				outReferences[index] = reference;
+				outReferenceBounds[index] = bounds;
+			}
+
+			int left, right;
+			getChildren(reference, left, right);
+			if (left != -1)
+				openable.push({ bounds.GetArea(), index });
+		};
+
+	for (int i = 0; i < instanceCount; i++)
+		addReference({ i, -1 }, instances[i].node.aabb, i);
+
+	while (!openable.empty() && static_cast<int>(outReferences.size()) < referenceLimit)
+	{
+		int index = openable.top().second;
+		openable.pop();
+
+		//Subtrees of the same instance are already separated by its own BLAS, only overlap with other instances is worth opening for.
+		const TopLevelReference reference = outReferences[index];
+		bool overlapsOtherInstance = false;
+		for (size_t n = 0; n < neighbourInstances[reference.instance].size() && !overlapsOtherInstance; n++)
+		{
+			for (int other : instanceReferences[neighbourInstances[reference.instance][n]])
+			{
+				if (BoundsOverlap(outReferenceBounds[index], outReferenceBounds[other]))
+				{
+					overlapsOtherInstance = true;
+					break;
+				}
+			}
+		}
+
+		if (!overlapsOtherInstance)
+			continue;
+
+		int left, right;
+		getChildren(reference, left, right);
+
+		const glm::mat4& transform = instanceTransforms[reference.instance];
+		AABB leftBounds, rightBounds;
+		leftBounds.min = nodes[left].min;
+		leftBounds.max = nodes[left].max;
+		rightBounds.min = nodes[right].min;
+		rightBounds.max = nodes[right].max;
+
+		//The left child takes the opened reference's slot and the right child is appended.
+		addReference({ reference.instance, left }, TransformAABB(leftBounds, transform), index);
+		addReference({ reference.instance, right }, TransformAABB(rightBounds, transform), static_cast<int>(outReferences.size()));
+	}
+}
+
+void BuildRebraidedTopLevelBVH(const std::vector<TopLevelReference>& references, const std::vector<AABB>& referenceBounds, std::vector<BVHNode>& outNodes)
+{
+	BuildTopLevelBVH(referenceBounds, outNodes);
+
+	for (BVHNode& node : outNodes)
+	{
+		if (node.leftChild != -1)
+			continue;
+
+		const TopLevelReference& reference = references[node.triangleStartIndex];
+		node.triangleStartIndex = reference.instance;
+		node.triangleCount = reference.node;
+	}
+}
+
+void RefitTopLevelBVH(const std::vector<AABB>& instanceBounds, std::vector<BVHNode>& nodes)
+{
+	//Children always come after their parent, so a reverse walk sees both children before the node itself.
+	for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--)
+	{
+		BVHNode& node = nodes[i];
+		if (node.leftChild == -1)
+		{
+			node.aabb.min = instanceBounds[node.triangleStartIndex].min;
+			node.aabb.max = instanceBounds[node.triangleStartIndex].max;
+			continue;
+		}
+
+		node.aabb.min = glm::min(nodes[node.leftChild].aabb.min, nodes[node.rightChild].aabb.min);
+		node.aabb.max = glm::max(nodes[node.leftChild].aabb.max, nodes[node.rightChild].aabb.max);
+	}
+}
+
+void LinkTopLevelBVH(const std::vector<BVHNode>& nodes, int instanceCount, std::vector<int>& outParents, std::vector<int>& outInstanceLeaves)
+{
+	outParents.assign(nodes.size(), -1);
+	outInstanceLeaves.assign(instanceCount, -1);
+
+	for (int i = 0; i < static_cast<int>(nodes.size()); i++)
+	{
+		const BVHNode& node = nodes[i];
+		if (node.leftChild == -1)
+		{
+			outInstanceLeaves[node.triangleStartIndex] = i;
+			continue;
+		}
+
+		outParents[node.leftChild] = i;
+		outParents[node.rightChild] = i;
+	}
+}
+
+void UpdateTopLevelBVHLeaf(std::vector<BVHNode>& nodes, const std::vector<int>& parents, int leaf, const AABB& bounds, std::vector<int>& outChangedNodes)
+{
+	nodes[leaf].aabb.min = bounds.min;
+	nodes[leaf].aabb.max = bounds.max;
+	outChangedNodes.push_back(leaf);
+
+	for (int nodeIndex = parents[leaf]; nodeIndex != -1; nodeIndex = parents[nodeIndex])
+	{
+		BVHNode& node = nodes[nodeIndex];
+		glm::vec3 newMin = glm::min(nodes[node.leftChild].aabb.min, nodes[node.rightChild].aabb.min);
+		glm::vec3 newMax = glm::max(nodes[node.leftChild].aabb.max, nodes[node.rightChild].aabb.max);
+		if (newMin == node.aabb.min && newMax == node.aabb.max)
+			break;
+
+		node.aabb.min = newMin;
+		node.aabb.max = newMax;
+		outChangedNodes.push_back(nodeIndex);
+	}
+}
+
+float GetTopLevelBVHCost(const std::vector<BVHNode>& nodes)
+{
+	if (nodes.empty() || nodes[0].aabb.GetArea() <= 0.0f)
+		return 0.0f;
+
+	float internalArea = 0.0f;
+	for (const BVHNode& node : nodes)
+	{
+		if (node.leftChild != -1)
+			internalArea += node.aabb.GetArea();
+	}
+
+	return internalArea / nodes[0].aabb.GetArea();
+}
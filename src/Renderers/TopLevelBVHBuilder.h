@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Builds the top level BVH over the world space bounds of every scene object, with a binned SAH over the bounds' centroids.
+* Node 0 is the root and children are stored as adjacent pairs after their parent. Each leaf holds one object, the index of its
+* ParentBVHNode is stored in triangleStartIndex. triangleCount is the BLAS node the object is entered at, -1 for its root.
+* Internal nodes have a triangleStartIndex of -1. The tree is kept shallow enough for TOP_LEVEL_TRAVERSAL_STACK_SIZE, ranges that would
+* otherwise go deeper are split at their median instead.
+*/
+void BuildTopLevelBVH(const std::vector<AABB>& instanceBounds, std::vector<BVHNode>& outNodes);
+
+/**
+* An instance, or one subtree of its BLAS, placed in the top level. node is a BLAS node index, -1 for the whole instance.
+*/
+struct TopLevelReference
+{
+	int instance;
+	int node;
+};
+
+/**
+* Partial rebraiding. Starts with one reference per instance and repeatedly opens the largest reference that overlaps another
+* instance's references, replacing it with its BLAS children transformed into world space. Large overlapping instances end up
+* split into subtrees the top level can separate, while small or isolated ones stay whole. Opening stops at BLAS leaves or once
+* there are GetRebraidReferenceLimit references. Node bounds and children come from the renderer's global BLAS nodes.
+*/
+void RebraidTopLevelInstances(const std::vector<ParentBVHNode>& instances, const std::vector<glm::mat4>& instanceTransforms,
+	const std::vector<PackedBVHNode>& nodes,
+	float budget, std::vector<TopLevelReference>& outReferences, std::vector<AABB>& outReferenceBounds);
+
+/**
+* Most references rebraiding creates for instanceCount instances, the top level has at most twice this many nodes.
+*/
+int GetRebraidReferenceLimit(int instanceCount, float budget);
+
+/**
+* BuildTopLevelBVH over rebraided references, each leaf stores its reference's instance and BLAS node.
+*/
+void BuildRebraidedTopLevelBVH(const std::vector<TopLevelReference>& references, const std::vector<AABB>& referenceBounds, std::vector<BVHNode>& outNodes);
+
+/**
+* World space bounds of a box after transforming its eight corners.
+*/
+AABB TransformAABB(const AABB& aabb, const glm::mat4& transform);
+
+/**
+* Recomputes the node bounds of a top level BVH after objects have moved, keeping its topology.
+*/
+void RefitTopLevelBVH(const std::vector<AABB>& instanceBounds, std::vector<BVHNode>& nodes);
+
+/**
+* Maps each node to its parent, -1 for the root, and each instance to the leaf that holds it. Used to update single instances.
+*/
+void LinkTopLevelBVH(const std::vector<BVHNode>& nodes, int instanceCount, std::vector<int>& outParents, std::vector<int>& outInstanceLeaves);
+
+/**
+* Sets the bounds of one leaf and refits its ancestors, stopping at the first node whose bounds do not change.
+* The indices of every node that changed are appended to outChangedNodes.
+*/
+void UpdateTopLevelBVHLeaf(std::vector<BVHNode>& nodes, const std::vector<int>& parents, int leaf, const AABB& bounds, std::vector<int>& outChangedNodes);
+
+/**
+* SAH cost of the tree relative to its root, the sum of internal node areas divided by the root's area. Refitting lets this
+* grow as objects move, comparing it with the cost at build time shows when the tree is worth rebuilding.
+*/
+float GetTopLevelBVHCost(const std::vector<BVHNode>& nodes);
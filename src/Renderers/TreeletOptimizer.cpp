@@ -0,0 +1,311 @@
+#include "TreeletOptimizer.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "ModelLoader.h"
+#include "../Useful/ThreadPool.h"
+
+const int MAX_TREELET_LEAVES = 8;
+const int TREELET_GRAIN_SIZE = 64;
+
+struct TreeletContext
+{
+	//Node 0 is the model root, every other node is offset by one from the builder output.
+	std::vector<BVHNode>& tree;
+	std::vector<float>& costs;
+	const BVHBuildSettings& settings;
+	int leafCount;
+};
+
+struct Treelet
+{
+	int leaves[MAX_TREELET_LEAVES];
+	int internalNodes[MAX_TREELET_LEAVES - 1];
+	int leafCount = 0;
+	int internalCount = 0;
+
+	AABB subsetBounds[1 << MAX_TREELET_LEAVES];
+	float subsetCosts[1 << MAX_TREELET_LEAVES];
+	int subsetSplits[1 << MAX_TREELET_LEAVES];
+};
+
+static AABB Union(const AABB& a, const AABB& b)
+{
+	AABB result;
+	result.min = glm::min(a.min, b.min);
+	result.max = glm::max(a.max, b.max);
+	return result;
+}
+
+static float GetNodeCost(const TreeletContext& context, int nodeIndex)
+{
+	const BVHNode& node = context.tree[nodeIndex];
+	if (node.leftChild == -1)
+		return context.settings.intersectionCost * node.aabb.GetArea() * node.triangleCount;
+
+	return context.settings.traversalCost * node.aabb.GetArea() + context.costs[node.leftChild] + context.costs[node.rightChild];
+}
+
+static int GetTreeletNode(const Treelet& treelet, int subset, int& nextInternal)
+{
+	//Single leaf subsets map straight back to their node.
+	if ((subset & (subset - 1)) == 0)
+	{
+		int leaf = 0;
+		while ((subset >> leaf) != 1)
+			leaf++;
+		return treelet.leaves[leaf];
+	}
+
+	return treelet.internalNodes[nextInternal++];
+}
+
+static void RebuildTreelet(TreeletContext& context, const Treelet& treelet, int subset, int nodeIndex, int& nextInternal)
+{
+	int leftSubset = treelet.subsetSplits[subset];
+	int rightSubset = subset ^ leftSubset;
+
+	int leftChild = GetTreeletNode(treelet, leftSubset, nextInternal);
+	if (leftSubset & (leftSubset - 1))
+		RebuildTreelet(context, treelet, leftSubset, leftChild, nextInternal);
+
+	int rightChild = GetTreeletNode(treelet, rightSubset, nextInternal);
+	if (rightSubset & (rightSubset - 1))
+		RebuildTreelet(context, treelet, rightSubset, rightChild, nextInternal);
+
+	BVHNode& node = context.tree[nodeIndex];
+	node.leftChild = leftChild;
+	node.rightChild = rightChild;
+	node.aabb = treelet.subsetBounds[subset];
+	context.costs[nodeIndex] = treelet.subsetCosts[subset];
+}
+
+static bool RestructureTreelet(TreeletContext& context, int rootIndex)
+{
+	const BVHNode& root = context.tree[rootIndex];
+	if (root.leftChild == -1)
+		return false;
+
+	//Children were handled on the previous level, so the root's cost only needs refreshing.
+	context.costs[rootIndex] = GetNodeCost(context, rootIndex);
+
+	Treelet treelet;
+	treelet.leaves[treelet.leafCount++] = root.leftChild;
+	treelet.leaves[treelet.leafCount++] = root.rightChild;
+	treelet.internalNodes[treelet.internalCount++] = rootIndex;
+
+	//Grow the treelet by opening up the leaf with the largest surface area.
+	while (treelet.leafCount < context.leafCount)
+	{
+		int bestLeaf = -1;
+		float bestArea = -1.0f;
+		for (int i = 0; i < treelet.leafCount; i++)
+		{
+			const BVHNode& leaf = context.tree[treelet.leaves[i]];
+			if (leaf.leftChild != -1 && leaf.aabb.GetArea() > bestArea)
+			{
+				bestLeaf = i;
+				bestArea = leaf.aabb.GetArea();
+			}
+		}
+
+		if (bestLeaf == -1)
+			break;
+
+		const BVHNode& opened = context.tree[treelet.leaves[bestLeaf]];
+		treelet.internalNodes[treelet.internalCount++] = treelet.leaves[bestLeaf];
+		treelet.leaves[bestLeaf] = opened.leftChild;
+		treelet.leaves[treelet.leafCount++] = opened.rightChild;
+	}
+
+	//Two or three leaves have no alternative topology worth searching.
+	if (treelet.leafCount < 4)
+		return false;
+
+	const int subsetCount = 1 << treelet.leafCount;
+	for (int subset = 1; subset < subsetCount; subset++)
+	{
+		int lowestLeaf = 0;
+		while (((subset >> lowestLeaf) & 1) == 0)
+			lowestLeaf++;
+
+		int rest = subset & (subset - 1);
+		const AABB& leafBounds = context.tree[treelet.leaves[lowestLeaf]].aabb;
+		treelet.subsetBounds[subset] = rest == 0 ? leafBounds : Union(leafBounds, treelet.subsetBounds[rest]);
+
+		if (rest == 0)
+		{
+			treelet.subsetCosts[subset] = context.costs[treelet.leaves[lowestLeaf]];
+			continue;
+		}
+
+		//Every partition is visited once by requiring the left side to hold the lowest leaf.
+		int lowestBit = subset & -subset;
+		float bestCost = FLT_MAX;
+		int bestSplit = 0;
+		for (int part = (subset - 1) & subset; part > 0; part = (part - 1) & subset)
+		{
+			if ((part & lowestBit) == 0)
+				continue;
+
+			float cost = treelet.subsetCosts[part] + treelet.subsetCosts[subset ^ part];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = part;
+			}
+		}
+
+		treelet.subsetCosts[subset] = context.settings.traversalCost * treelet.subsetBounds[subset].GetArea() + bestCost;
+		treelet.subsetSplits[subset] = bestSplit;
+	}
+
+	const int fullSet = subsetCount - 1;
+	if (treelet.subsetCosts[fullSet] >= context.costs[rootIndex] * 0.9999f)
+		return false;
+
+	int nextInternal = 1;
+	RebuildTreelet(context, treelet, fullSet, rootIndex, nextInternal);
+	return true;
+}
+
+static void EmitOptimizedNode(const std::vector<BVHNode>& tree, const std::vector<Triangle>& triangles, std::vector<Triangle>& outTriangles, std::vector<BVHNode>& outNodes, int treeIndex, BVHNode& outNode)
+{
+	const BVHNode& node = tree[treeIndex];
+	outNode.aabb = node.aabb;
+
+	if (node.leftChild == -1)
+	{
+		outNode.leftChild = -1;
+		outNode.rightChild = -1;
+		outNode.triangleStartIndex = static_cast<int>(outTriangles.size());
+		outNode.triangleCount = node.triangleCount;
+		outTriangles.insert(outTriangles.end(), triangles.begin() + node.triangleStartIndex, triangles.begin() + node.triangleStartIndex + node.triangleCount);
+		return;
+	}
+
+	int leftChildIndex = static_cast<int>(outNodes.size());
+	int rightChildIndex = leftChildIndex + 1;
+	outNodes.emplace_back();
+	outNodes.emplace_back();
+
+	//outNodes grows while the children are emitted, so the node is filled in through copies.
+	BVHNode leftChild, rightChild;
+	EmitOptimizedNode(tree, triangles, outTriangles, outNodes, node.leftChild, leftChild);
+	outNodes[leftChildIndex] = leftChild;
+	EmitOptimizedNode(tree, triangles, outTriangles, outNodes, node.rightChild, rightChild);
+	outNodes[rightChildIndex] = rightChild;
+
+	outNode.leftChild = leftChildIndex;
+	outNode.rightChild = rightChildIndex;
+	outNode.triangleStartIndex = leftChild.triangleStartIndex;
+	outNode.triangleCount = leftChild.triangleCount + rightChild.triangleCount;
+}
+
+void OptimizeBVHTreelets(std::vector<Triangle>& triangles, std::vector<BVHNode>& nodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings, BVHBuildStats* outStats)
+{
+	if (parentNode.node.leftChild == -1)
+		return;
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::vector<BVHNode> tree(nodes.size() + 1);
+	tree[0] = parentNode.node;
+	tree[0].leftChild = parentNode.node.leftChild - currentBVHSize + 1;
+	tree[0].rightChild = parentNode.node.rightChild - currentBVHSize + 1;
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		tree[i + 1] = nodes[i];
+		if (nodes[i].leftChild != -1)
+		{
+			tree[i + 1].leftChild++;
+			tree[i + 1].rightChild++;
+		}
+	}
+
+	std::vector<float> costs(tree.size());
+	TreeletContext context{ tree, costs, settings, std::clamp(settings.treeletLeafCount, 2, MAX_TREELET_LEAVES) };
+
+	ThreadPool pool(settings.parallelBuild ? settings.threadCount : 1);
+	std::atomic<int> restructuredTreelets = 0;
+	bool outOfTime = false;
+
+	for (int pass = 0; pass < settings.treeletPasses && !outOfTime; pass++)
+	{
+		//Nodes on one level root disjoint subtrees, so a level can be restructured in parallel once the level below it is done.
+		std::vector<std::vector<int>> levels;
+		levels.push_back({ 0 });
+		while (true)
+		{
+			std::vector<int> nextLevel;
+			for (int nodeIndex : levels.back())
+			{
+				if (tree[nodeIndex].leftChild == -1)
+					continue;
+
+				nextLevel.push_back(tree[nodeIndex].leftChild);
+				nextLevel.push_back(tree[nodeIndex].rightChild);
+			}
+
+			if (nextLevel.empty())
+				break;
+
+			levels.push_back(std::move(nextLevel));
+		}
+
+		for (auto level = levels.rbegin(); level != levels.rend(); level++)
+		{
+			for (int nodeIndex : *level)
+			{
+				if (tree[nodeIndex].leftChild == -1)
+					costs[nodeIndex] = GetNodeCost(context, nodeIndex);
+			}
+		}
+
+		for (auto level = levels.rbegin(); level != levels.rend(); level++)
+		{
+			if (settings.treeletTimeBudget > 0.0f)
+			{
+				std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+				if (elapsed.count() > settings.treeletTimeBudget)
+				{
+					outOfTime = true;
+					break;
+				}
+			}
+
+			const std::vector<int>& levelNodes = *level;
+			ParallelFor(pool, static_cast<int>(levelNodes.size()), TREELET_GRAIN_SIZE, [&](int begin, int end)
+				{
+					int restructured = 0;
+					for (int i = begin; i < end; i++)
+					{
+						if (RestructureTreelet(context, levelNodes[i]))
+							restructured++;
+					}
+					restructuredTreelets += restructured;
+				});
+		}
+	}
+
+	//Restructuring moves subtrees around, so write the tree back out depth first to keep each subtree's triangles contiguous.
+	std::vector<Triangle> outTriangles;
+	outTriangles.reserve(triangles.size());
+	std::vector<BVHNode> outNodes;
+	outNodes.reserve(nodes.size());
+
+	BVHNode root;
+	EmitOptimizedNode(tree, triangles, outTriangles, outNodes, 0, root);
+
+	triangles.swap(outTriangles);
+	nodes.swap(outNodes);
+
+	parentNode.node.leftChild = currentBVHSize;
+	parentNode.node.rightChild = currentBVHSize + 1;
+	parentNode.node.triangleStartIndex = 0;
+	parentNode.node.triangleCount = root.triangleCount;
+
+	if (outStats)
+		outStats->restructuredTreelets = restructuredTreelets;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Treelet restructuring (Karras and Aila 2013). Walks a built BVH bottom up and, for each node, finds the SAH optimal topology of the treelet
+* formed by its largest descendants, up to settings.treeletLeafCount leaves. Nodes on the same depth level are processed in parallel.
+* Stops early once settings.treeletTimeBudget milliseconds have passed. The tree is written back in depth first order with triangles
+* reordered so every subtree still covers one contiguous range.
+*/
+void OptimizeBVHTreelets(std::vector<Triangle>& triangles, std::vector<BVHNode>& nodes, ParentBVHNode& parentNode, int currentBVHSize, const BVHBuildSettings& settings, BVHBuildStats* outStats);
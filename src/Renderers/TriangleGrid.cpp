@@ -0,0 +1,284 @@
+#include "TriangleGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ModelLoader.h"
+
+//Axes thinner than this fraction of the longest one are padded, so flat meshes still get a volume to size their cells from.
+static const float MIN_GRID_THICKNESS = 1e-3f;
+
+static glm::ivec3 GetGridResolution(glm::vec3 extent, int triangleCount, float cellDensity, int maxResolution)
+{
+	float volume = extent.x * extent.y * extent.z;
+	if (volume <= 0.0f || triangleCount == 0)
+		return glm::ivec3(1);
+
+	float cellsPerUnit = std::cbrt(cellDensity * triangleCount / volume);
+
+	glm::ivec3 resolution;
+	for (int axis = 0; axis < 3; axis++)
+		resolution[axis] = std::clamp(static_cast<int>(std::ceil(extent[axis] * cellsPerUnit)), 1, maxResolution);
+
+	return resolution;
+}
+
+//Range of cells the box overlaps, clamped to the grid.
+static void GetCellRange(const AABB& box, glm::vec3 gridMin, glm::vec3 cellSize, glm::ivec3 resolution, glm::ivec3& outMin, glm::ivec3& outMax)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		outMin[axis] = std::clamp(static_cast<int>(std::floor((box.min[axis] - gridMin[axis]) / cellSize[axis])), 0, resolution[axis] - 1);
+		outMax[axis] = std::clamp(static_cast<int>(std::floor((box.max[axis] - gridMin[axis]) / cellSize[axis])), 0, resolution[axis] - 1);
+	}
+}
+
+static int GetCellIndex(int x, int y, int z, glm::ivec3 resolution)
+{
+	return (z * resolution.y + y) * resolution.x + x;
+}
+
+//Turns per cell counts stored at starts[cell + 1] into offsets, and returns where each cell's next reference should be written.
+static std::vector<int> PrefixSumCellStarts(std::vector<int>& starts)
+{
+	for (size_t i = 1; i < starts.size(); i++)
+		starts[i] += starts[i - 1];
+
+	return std::vector<int>(starts.begin(), starts.end() - 1);
+}
+
+void BuildTriangleGrid(const std::vector<Triangle>& triangles, const GridBuildSettings& settings, TriangleGrid& outGrid)
+{
+	outGrid = TriangleGrid();
+
+	const int triangleCount = static_cast<int>(triangles.size());
+	if (triangleCount == 0)
+		return;
+
+	AABB bounds = EmptyAABB();
+	for (const Triangle& triangle : triangles)
+	{
+		bounds.Grow(triangle.bounds.min);
+		bounds.Grow(triangle.bounds.max);
+	}
+
+	glm::vec3 extent = bounds.max - bounds.min;
+	float thickness = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) * MIN_GRID_THICKNESS;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (extent[axis] >= thickness)
+			continue;
+
+		bounds.min[axis] -= 0.5f * thickness;
+		bounds.max[axis] += 0.5f * thickness;
+	}
+	extent = bounds.max - bounds.min;
+
+	outGrid.bounds = bounds;
+	outGrid.resolution = GetGridResolution(extent, triangleCount, settings.topCellDensity, settings.maxResolution);
+	outGrid.cellSize = extent / glm::vec3(outGrid.resolution);
+
+	const glm::ivec3 topResolution = outGrid.resolution;
+	const int topCellCount = topResolution.x * topResolution.y * topResolution.z;
+
+	//Top level, count the triangles overlapping each cell then write their indices.
+	std::vector<int> topCellStarts(topCellCount + 1, 0);
+	for (const Triangle& triangle : triangles)
+	{
+		glm::ivec3 cellMin, cellMax;
+		GetCellRange(triangle.bounds, bounds.min, outGrid.cellSize, topResolution, cellMin, cellMax);
+		for (int z = cellMin.z; z <= cellMax.z; z++)
+			for (int y = cellMin.y; y <= cellMax.y; y++)
+				for (int x = cellMin.x; x <= cellMax.x; x++)
+					topCellStarts[GetCellIndex(x, y, z, topResolution) + 1]++;
+	}
+
+	std::vector<int> topWritePositions = PrefixSumCellStarts(topCellStarts);
+	std::vector<int> topReferences(topCellStarts.back());
+	for (int i = 0; i < triangleCount; i++)
+	{
+		glm::ivec3 cellMin, cellMax;
+		GetCellRange(triangles[i].bounds, bounds.min, outGrid.cellSize, topResolution, cellMin, cellMax);
+		for (int z = cellMin.z; z <= cellMax.z; z++)
+			for (int y = cellMin.y; y <= cellMax.y; y++)
+				for (int x = cellMin.x; x <= cellMax.x; x++)
+					topReferences[topWritePositions[GetCellIndex(x, y, z, topResolution)]++] = i;
+	}
+
+	//Size each occupied top cell's sub grid from the number of triangles in it.
+	outGrid.topCells.resize(topCellCount);
+	int leafCellCount = 0;
+	for (int cell = 0; cell < topCellCount; cell++)
+	{
+		int cellTriangleCount = topCellStarts[cell + 1] - topCellStarts[cell];
+		if (cellTriangleCount == 0)
+			continue;
+
+		GridTopCell& topCell = outGrid.topCells[cell];
+		topCell.firstLeafCell = leafCellCount;
+		topCell.resolution = GetGridResolution(outGrid.cellSize, cellTriangleCount, settings.leafCellDensity, settings.maxResolution);
+		leafCellCount += topCell.resolution.x * topCell.resolution.y * topCell.resolution.z;
+	}
+
+	//Leaf level, the same count and write passes over the top level references.
+	auto forEachLeafReference = [&](auto&& visit)
+		{
+			for (int z = 0; z < topResolution.z; z++)
+				for (int y = 0; y < topResolution.y; y++)
+					for (int x = 0; x < topResolution.x; x++)
+					{
+						int cell = GetCellIndex(x, y, z, topResolution);
+						const GridTopCell& topCell = outGrid.topCells[cell];
+						if (topCell.firstLeafCell == -1)
+							continue;
+
+						glm::vec3 cellMin = bounds.min + glm::vec3(glm::ivec3(x, y, z)) * outGrid.cellSize;
+						glm::vec3 leafSize = outGrid.cellSize / glm::vec3(topCell.resolution);
+
+						for (int r = topCellStarts[cell]; r < topCellStarts[cell + 1]; r++)
+						{
+							glm::ivec3 leafMin, leafMax;
+							GetCellRange(triangles[topReferences[r]].bounds, cellMin, leafSize, topCell.resolution, leafMin, leafMax);
+							for (int lz = leafMin.z; lz <= leafMax.z; lz++)
+								for (int ly = leafMin.y; ly <= leafMax.y; ly++)
+									for (int lx = leafMin.x; lx <= leafMax.x; lx++)
+										visit(topCell.firstLeafCell + GetCellIndex(lx, ly, lz, topCell.resolution), topReferences[r]);
+						}
+					}
+		};
+
+	outGrid.leafCellStarts.assign(leafCellCount + 1, 0);
+	forEachLeafReference([&](int leafCell, int triangleIndex) { outGrid.leafCellStarts[leafCell + 1]++; });
+
+	std::vector<int> leafWritePositions = PrefixSumCellStarts(outGrid.leafCellStarts);
+	outGrid.triangleIndices.resize(outGrid.leafCellStarts.back());
+	forEachLeafReference([&](int leafCell, int triangleIndex) { outGrid.triangleIndices[leafWritePositions[leafCell]++] = triangleIndex; });
+}
+
+//Entry and exit distances of the ray through the box, clamped to [0, tMax]. Returns false if the ray misses it.
+static bool ClipRayToBox(const AABB& box, const BVHRay& ray, glm::vec3 inverseDirection, float tMax, float& outEnter, float& outExit)
+{
+	glm::vec3 t0 = (box.min - ray.origin) * inverseDirection;
+	glm::vec3 t1 = (box.max - ray.origin) * inverseDirection;
+
+	outEnter = std::max(std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)), std::min(t0.z, t1.z)), 0.0f);
+	outExit = std::min(std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::max(t0.z, t1.z)), tMax);
+
+	return outEnter <= outExit;
+}
+
+//3D-DDA through the cells of a grid between tEnter and tExit. visitCell(cell, cellExit) is called in order along the ray, returning true stops the walk.
+template<typename CellVisitor>
+static void WalkGrid(glm::vec3 gridMin, glm::vec3 cellSize, glm::ivec3 resolution, const BVHRay& ray, float tEnter, float tExit, CellVisitor&& visitCell)
+{
+	glm::vec3 entry = ray.origin + ray.direction * tEnter;
+
+	glm::ivec3 cell, step, stop;
+	glm::vec3 tNext, tDelta;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		cell[axis] = std::clamp(static_cast<int>(std::floor((entry[axis] - gridMin[axis]) / cellSize[axis])), 0, resolution[axis] - 1);
+
+		if (ray.direction[axis] > 0.0f)
+		{
+			step[axis] = 1;
+			stop[axis] = resolution[axis];
+			tNext[axis] = (gridMin[axis] + (cell[axis] + 1) * cellSize[axis] - ray.origin[axis]) / ray.direction[axis];
+			tDelta[axis] = cellSize[axis] / ray.direction[axis];
+		}
+		else if (ray.direction[axis] < 0.0f)
+		{
+			step[axis] = -1;
+			stop[axis] = -1;
+			tNext[axis] = (gridMin[axis] + cell[axis] * cellSize[axis] - ray.origin[axis]) / ray.direction[axis];
+			tDelta[axis] = -cellSize[axis] / ray.direction[axis];
+		}
+		else
+		{
+			step[axis] = 0;
+			stop[axis] = -1;
+			tNext[axis] = FLT_MAX;
+			tDelta[axis] = FLT_MAX;
+		}
+	}
+
+	while (true)
+	{
+		int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+		if (visitCell(cell, std::min(tNext[axis], tExit)))
+			return;
+
+		if (tNext[axis] > tExit)
+			return;
+
+		cell[axis] += step[axis];
+		if (cell[axis] == stop[axis])
+			return;
+
+		tNext[axis] += tDelta[axis];
+	}
+}
+
+float WalkTriangleGrid(const TriangleGrid& grid, const BVHRay& ray, float tMax, const std::function<float(const int* triangleIndices, int count)>& intersectCell)
+{
+	if (grid.topCells.empty())
+		return tMax;
+
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+
+	float tEnter, tExit;
+	if (!ClipRayToBox(grid.bounds, ray, inverseDirection, tMax, tEnter, tExit))
+		return tMax;
+
+	float closest = tMax;
+	WalkGrid(grid.bounds.min, grid.cellSize, grid.resolution, ray, tEnter, tExit, [&](glm::ivec3 cell, float cellExit)
+		{
+			const GridTopCell& topCell = grid.topCells[GetCellIndex(cell.x, cell.y, cell.z, grid.resolution)];
+			if (topCell.firstLeafCell == -1)
+				return false;
+
+			AABB cellBounds;
+			cellBounds.min = grid.bounds.min + glm::vec3(cell) * grid.cellSize;
+			cellBounds.max = cellBounds.min + grid.cellSize;
+
+			float cellEnter, clippedExit;
+			if (!ClipRayToBox(cellBounds, ray, inverseDirection, cellExit, cellEnter, clippedExit))
+				return false;
+
+			glm::vec3 leafSize = grid.cellSize / glm::vec3(topCell.resolution);
+			WalkGrid(cellBounds.min, leafSize, topCell.resolution, ray, cellEnter, clippedExit, [&](glm::ivec3 leaf, float leafExit)
+				{
+					int leafCell = topCell.firstLeafCell + GetCellIndex(leaf.x, leaf.y, leaf.z, topCell.resolution);
+					int firstReference = grid.leafCellStarts[leafCell];
+					int referenceCount = grid.leafCellStarts[leafCell + 1] - firstReference;
+					if (referenceCount > 0)
+						closest = intersectCell(grid.triangleIndices.data() + firstReference, referenceCount);
+
+					//Triangles reach outside the cells they are listed in, so a hit beyond this cell could still be beaten by one in a later cell.
+					return closest < tMax && closest <= leafExit;
+				});
+
+			return closest < tMax && closest <= cellExit;
+		});
+
+	return closest;
+}
+
+bool TraceTriangleGrid(const std::vector<Triangle>& triangles, const TriangleGrid& grid, const BVHRay& ray, float tMax, BVHRayHit& outHit)
+{
+	outHit.t = tMax;
+	outHit.triangleIndex = -1;
+
+	WalkTriangleGrid(grid, ray, tMax, [&](const int* triangleIndices, int count)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				if (IntersectTriangle(triangles[triangleIndices[i]], ray, outHit.t, outHit))
+					outHit.triangleIndex = triangleIndices[i];
+			}
+
+			return outHit.t;
+		});
+
+	return outHit.triangleIndex != -1;
+}
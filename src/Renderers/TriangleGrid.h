@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+#include "BVHTraversal.h"
+
+struct GridTopCell
+{
+	//First of the cell's leaf cells in TriangleGrid::leafCellStarts, -1 if no triangle touches the cell.
+	int firstLeafCell = -1;
+	glm::ivec3 resolution = glm::ivec3(0);
+};
+
+/**
+* Two level uniform grid over a model's triangles. The top level is coarse, and every top cell that any triangle touches is split again
+* into a sub grid sized for the number of triangles in it, so dense areas get small cells without the whole grid paying for them.
+* Triangles are referenced by index and never reordered, so the same triangle list can be used by a BVH as well.
+*/
+struct TriangleGrid
+{
+	AABB bounds;
+	glm::ivec3 resolution = glm::ivec3(0);
+	glm::vec3 cellSize = glm::vec3(0.0f);
+
+	std::vector<GridTopCell> topCells;
+
+	//Triangles of leaf cell i are triangleIndices[leafCellStarts[i]] to triangleIndices[leafCellStarts[i + 1]].
+	std::vector<int> leafCellStarts;
+	std::vector<int> triangleIndices;
+};
+
+struct GridBuildSettings
+{
+	//Target cells per triangle for each level. The top level stays coarse, the sub grids aim for a couple of cells per triangle.
+	float topCellDensity = 1.0f / 16.0f;
+	float leafCellDensity = 2.0f;
+
+	//Upper bound on the resolution of either level along any axis.
+	int maxResolution = 128;
+};
+
+/**
+* Builds the grid with a counting sort per level, two passes over the triangle references each, and no sorting or recursion.
+* Much faster to build than any of the BVHs, which suits geometry that is regenerated every frame.
+*/
+void BuildTriangleGrid(const std::vector<Triangle>& triangles, const GridBuildSettings& settings, TriangleGrid& outGrid);
+
+/**
+* Finds the closest triangle a ray hits by walking both levels of the grid with a 3D-DDA, stopping at the first cell that contains a hit
+* closer than the cell's far side. outHit.triangleIndex indexes the triangle list the grid was built from.
+*/
+bool TraceTriangleGrid(const std::vector<Triangle>& triangles, const TriangleGrid& grid, const BVHRay& ray, float tMax, BVHRayHit& outHit);
+
+/**
+* The cell walk behind TraceTriangleGrid, for triangles that aren't kept in a Triangle list. intersectCell is given the triangle indices of each
+* leaf cell the ray passes through, in order, and returns the distance of the closest hit found so far, tMax while there is none.
+* Returns that distance once no later cell can hold a closer hit.
+*/
+float WalkTriangleGrid(const TriangleGrid& grid, const BVHRay& ray, float tMax, const std::function<float(const int* triangleIndices, int count)>& intersectCell);
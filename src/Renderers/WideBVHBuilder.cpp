@@ -0,0 +1,242 @@
+#include "WideBVHBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+int GetEffectiveBVHWidth(const BVHBuildSettings& settings)
+{
+	if (settings.bvhWidth == 4 || settings.bvhWidth == 8)
+		return settings.bvhWidth;
+
+	return 2;
+}
+
+//Stack entries needed below a wide node that has just been popped.
+static int GetWideSubtreeStackSize(const std::vector<WideBVHChild>& children, int width, int nodeIndex)
+{
+	int stackSize = 0;
+	int internalChildren = 0;
+	for (int c = 0; c < width; c++)
+	{
+		const WideBVHChild& child = children[nodeIndex * width + c];
+		if (child.index == -1)
+			break;
+
+		if (child.triangleCount > 0)
+			continue;
+
+		//The internal children pushed before this one stay on the stack while its subtree is walked.
+		stackSize = std::max(stackSize, internalChildren + GetWideSubtreeStackSize(children, width, child.index));
+		internalChildren++;
+	}
+
+	return std::max(stackSize, internalChildren);
+}
+
+int GetWideBVHStackSize(const std::vector<WideBVHChild>& children, int width, int rootIndex)
+{
+	if (rootIndex == -1)
+		return 0;
+
+	return std::max(1, GetWideSubtreeStackSize(children, width, rootIndex));
+}
+
+int GetEffectiveBVHQuantizationBits(const BVHBuildSettings& settings)
+{
+	if (GetEffectiveBVHWidth(settings) == 2)
+		return 0;
+
+	if (settings.bvhQuantizationBits == 8 || settings.bvhQuantizationBits == 16)
+		return settings.bvhQuantizationBits;
+
+	return 0;
+}
+
+const int QUANTIZED_HEADER_WORDS = 8;
+
+int GetQuantizedWideNodeWords(int width, int bits)
+{
+	int wordsPerComponent = width * bits / 32;
+	return QUANTIZED_HEADER_WORDS + 6 * wordsPerComponent + width + width / 2;
+}
+
+void QuantizeWideBVHNode(const WideBVHChild* children, int width, int bits, uint32_t* outWords)
+{
+	const int valuesPerWord = 32 / bits;
+	const int wordsPerComponent = width / valuesPerWord;
+	const int indexOffset = QUANTIZED_HEADER_WORDS + 6 * wordsPerComponent;
+	const int countOffset = indexOffset + width;
+	const uint32_t maxValue = (1u << bits) - 1u;
+
+	memset(outWords, 0, sizeof(uint32_t) * GetQuantizedWideNodeWords(width, bits));
+
+	glm::vec3 nodeMin(FLT_MAX), nodeMax(-FLT_MAX);
+	for (int c = 0; c < width && children[c].index != -1; c++)
+	{
+		nodeMin = glm::min(nodeMin, children[c].min);
+		nodeMax = glm::max(nodeMax, children[c].max);
+	}
+
+	//Power of two scales keep value * scale exact, so the GPU decodes to exactly the bounds checked here.
+	glm::vec3 origin = nodeMin;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = std::max(nodeMax[axis] - nodeMin[axis], FLT_MIN);
+		int exponent = static_cast<int>(std::ceil(std::log2(extent / maxValue)));
+		while (origin[axis] + maxValue * std::ldexp(1.0f, exponent) < nodeMax[axis])
+			exponent++;
+		scale[axis] = std::ldexp(1.0f, exponent);
+	}
+
+	memcpy(&outWords[0], &origin, sizeof(glm::vec3));
+	memcpy(&outWords[3], &scale, sizeof(glm::vec3));
+
+	for (int c = 0; c < width; c++)
+	{
+		const WideBVHChild& child = children[c];
+		outWords[indexOffset + c] = static_cast<uint32_t>(child.index);
+		if (child.index == -1)
+			continue;
+
+		if (child.triangleCount > 0xFFFF)
+			throw std::exception("BVH leaf has too many triangles to quantize.");
+
+		outWords[countOffset + c / 2] |= static_cast<uint32_t>(child.triangleCount) << ((c % 2) * 16);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			//Round outwards, then step further out if float error still leaves the decoded box inside the original.
+			float low = std::floor((child.min[axis] - origin[axis]) / scale[axis]);
+			float high = std::ceil((child.max[axis] - origin[axis]) / scale[axis]);
+			uint32_t quantizedMin = static_cast<uint32_t>(std::clamp(low, 0.0f, static_cast<float>(maxValue)));
+			uint32_t quantizedMax = static_cast<uint32_t>(std::clamp(high, 0.0f, static_cast<float>(maxValue)));
+
+			while (quantizedMin > 0 && origin[axis] + quantizedMin * scale[axis] > child.min[axis])
+				quantizedMin--;
+			while (quantizedMax < maxValue && origin[axis] + quantizedMax * scale[axis] < child.max[axis])
+				quantizedMax++;
+
+			int shift = (c % valuesPerWord) * bits;
+			outWords[QUANTIZED_HEADER_WORDS + axis * wordsPerComponent + c / valuesPerWord] |= quantizedMin << shift;
+			outWords[QUANTIZED_HEADER_WORDS + (axis + 3) * wordsPerComponent + c / valuesPerWord] |= quantizedMax << shift;
+		}
+	}
+}
+
+WideBVHChild DecodeQuantizedWideBVHChild(const uint32_t* nodeWords, int width, int bits, int c)
+{
+	const int valuesPerWord = 32 / bits;
+	const int wordsPerComponent = width / valuesPerWord;
+	const int indexOffset = QUANTIZED_HEADER_WORDS + 6 * wordsPerComponent;
+	const int countOffset = indexOffset + width;
+	const uint32_t mask = (1u << bits) - 1u;
+
+	glm::vec3 origin, scale;
+	memcpy(&origin, &nodeWords[0], sizeof(glm::vec3));
+	memcpy(&scale, &nodeWords[3], sizeof(glm::vec3));
+
+	int shift = (c % valuesPerWord) * bits;
+	WideBVHChild child;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		child.min[axis] = origin[axis] + static_cast<float>((nodeWords[QUANTIZED_HEADER_WORDS + axis * wordsPerComponent + c / valuesPerWord] >> shift) & mask) * scale[axis];
+		child.max[axis] = origin[axis] + static_cast<float>((nodeWords[QUANTIZED_HEADER_WORDS + (axis + 3) * wordsPerComponent + c / valuesPerWord] >> shift) & mask) * scale[axis];
+	}
+
+	child.index = static_cast<int>(nodeWords[indexOffset + c]);
+	child.triangleCount = static_cast<int>((nodeWords[countOffset + c / 2] >> ((c % 2) * 16)) & 0xFFFFu);
+	return child;
+}
+
+int CollapseToWideBVH(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize, int width, std::vector<WideBVHChild>& outChildren, std::vector<int>& outSourceNodes)
+{
+	if (parentNode.node.leftChild == -1)
+		return -1;
+
+	WideBVHChild emptySlot;
+	emptySlot.min = glm::vec3(FLT_MAX);
+	emptySlot.max = glm::vec3(-FLT_MAX);
+	emptySlot.index = -1;
+	emptySlot.triangleCount = 0;
+
+	auto allocateWideNode = [&]()
+		{
+			int wideIndex = static_cast<int>(outChildren.size()) / width;
+			outChildren.insert(outChildren.end(), width, emptySlot);
+			outSourceNodes.insert(outSourceNodes.end(), width, -1);
+			return wideIndex;
+		};
+
+	struct PendingNode
+	{
+		int leftChild;
+		int rightChild;
+		int wideIndex;
+	};
+
+	int rootIndex = allocateWideNode();
+	std::vector<PendingNode> stack;
+	stack.push_back({ parentNode.node.leftChild - currentBVHSize, parentNode.node.rightChild - currentBVHSize, rootIndex });
+
+	std::vector<int> children;
+	while (!stack.empty())
+	{
+		PendingNode pending = stack.back();
+		stack.pop_back();
+
+		children.clear();
+		children.push_back(pending.leftChild);
+		children.push_back(pending.rightChild);
+
+		//Open up the largest internal child until the wide node is full.
+		while (static_cast<int>(children.size()) < width)
+		{
+			int bestChild = -1;
+			float bestArea = -1.0f;
+			for (int c = 0; c < static_cast<int>(children.size()); c++)
+			{
+				const BVHNode& child = nodes[children[c]];
+				if (child.leftChild != -1 && child.aabb.GetArea() > bestArea)
+				{
+					bestChild = c;
+					bestArea = child.aabb.GetArea();
+				}
+			}
+
+			if (bestChild == -1)
+				break;
+
+			const BVHNode& opened = nodes[children[bestChild]];
+			children[bestChild] = opened.leftChild;
+			children.push_back(opened.rightChild);
+		}
+
+		for (int c = 0; c < static_cast<int>(children.size()); c++)
+		{
+			const BVHNode& child = nodes[children[c]];
+
+			WideBVHChild slot;
+			slot.min = child.aabb.min;
+			slot.max = child.aabb.max;
+
+			if (child.leftChild == -1)
+			{
+				slot.index = child.triangleStartIndex;
+				slot.triangleCount = child.triangleCount;
+			}
+			else
+			{
+				slot.index = allocateWideNode();
+				slot.triangleCount = 0;
+				stack.push_back({ child.leftChild, child.rightChild, slot.index });
+			}
+
+			outChildren[pending.wideIndex * width + c] = slot;
+			outSourceNodes[pending.wideIndex * width + c] = children[c];
+		}
+	}
+
+	return rootIndex;
+}
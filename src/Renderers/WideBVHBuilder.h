@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Hardware/RaytracerTypes.h"
+
+/**
+* Returns the BVH width the renderer uses for the settings, 4 or 8 for wide trees and 2 for the binary layout.
+*/
+int GetEffectiveBVHWidth(const BVHBuildSettings& settings);
+
+/**
+* Collapses a model's binary BVH into a wide BVH. Each wide node pulls up the largest of its binary descendants until it has width children.
+* Child indices, triangle starts and outSourceNodes (the binary node each slot mirrors, used to refit) are local to the model.
+* Returns the local index of the wide root, or -1 if the model's root is a leaf.
+*/
+int CollapseToWideBVH(const std::vector<BVHNode>& nodes, const ParentBVHNode& parentNode, int currentBVHSize, int width, std::vector<WideBVHChild>& outChildren, std::vector<int>& outSourceNodes);
+
+/**
+* Most entries the shader's wide traversal holds on its stack for a tree from CollapseToWideBVH, reached by a ray that hits every child.
+* The traversal pushes a node's internal children in slot order and pops the last one first, every earlier sibling waits on the stack
+* while the popped child's subtree is walked. Bounded by (width - 1) * depth + 1.
+*/
+int GetWideBVHStackSize(const std::vector<WideBVHChild>& children, int width, int rootIndex);
+
+/**
+* Returns the quantization used for wide nodes, 8 or 16 bits, or 0 if bounds are stored as floats or the BVH is binary.
+*/
+int GetEffectiveBVHQuantizationBits(const BVHBuildSettings& settings);
+
+/**
+* Number of 32 bit words one quantized wide node takes. Nodes are stored back to back, so node i starts at word i * GetQuantizedWideNodeWords().
+* Layout: origin and power of two scale per axis, padded to 8 words, then each bound component of every child packed bits to a value,
+* then the child indices and finally 16 bit triangle counts.
+*/
+int GetQuantizedWideNodeWords(int width, int bits);
+
+/**
+* Quantizes one wide node. Child bounds are rounded outwards so the decoded box always contains the original.
+*/
+void QuantizeWideBVHNode(const WideBVHChild* children, int width, int bits, uint32_t* outWords);
+
+/**
+* Decodes child slot c of a node written by QuantizeWideBVHNode, the same way the compute shader reads it.
+*/
+WideBVHChild DecodeQuantizedWideBVHChild(const uint32_t* nodeWords, int width, int bits, int c);
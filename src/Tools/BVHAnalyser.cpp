@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Renderers/ModelLoader.h"
+#include "../Renderers/BVHAnalysis.h"
+#include "../Renderers/BVHLayout.h"
+#include "../Renderers/BVHTraversal.h"
+#include "../Renderers/TriangleGrid.h"
+#include "../Renderers/BVHTuner.h"
+#include "../Useful/Useful.h"
+
+//Builds every model with each builder and prints the quality of the resulting trees as JSON, without needing a window or a GPU.
+//Each tree is also traced on the CPU in every node layout, with and without a stack and in the packed GPU node format, to show how the memory
+//order, node format and traversal affect timing.
+//A two level grid is built and traced with the same rays for comparison. --tune also runs the build auto-tuner on each model with the default settings.
+//Usage: BVHAnalyser [--threads N] [--rays N] [--tune] model.obj [model.obj ...]
+
+static const int DEFAULT_BENCHMARK_RAY_COUNT = 200000;
+static const int BENCHMARK_REPEATS = 3;
+static const unsigned int BENCHMARK_RAY_SEED = 1234;
+
+struct AnalysedBuilder
+{
+	std::string name;
+	BVHBuildSettings settings;
+};
+
+struct AnalysedLayout
+{
+	std::string name;
+	BVHNodeLayout layout;
+};
+
+static const AnalysedLayout ANALYSED_LAYOUTS[] =
+{
+	{ "Build", BVHNodeLayout::Build },
+	{ "DepthFirst", BVHNodeLayout::DepthFirst },
+	{ "VanEmdeBoas", BVHNodeLayout::VanEmdeBoas }
+};
+
+static std::vector<AnalysedBuilder> GetAnalysedBuilders(int threadCount)
+{
+	BVHBuildSettings defaults;
+	defaults.threadCount = threadCount;
+
+	//Every layout is applied to the same tree afterwards, so keep the order each builder produces.
+	defaults.nodeLayout = BVHNodeLayout::Build;
+
+	std::vector<AnalysedBuilder> builders;
+
+	AnalysedBuilder midpoint{ "Midpoint", defaults };
+	midpoint.settings.method = BVHBuildMethod::Midpoint;
+	builders.push_back(midpoint);
+
+	AnalysedBuilder sah{ "SAH", defaults };
+	sah.settings.method = BVHBuildMethod::SAH;
+	builders.push_back(sah);
+
+	AnalysedBuilder indexedSAH{ "IndexedSAH", defaults };
+	indexedSAH.settings.method = BVHBuildMethod::IndexedSAH;
+	builders.push_back(indexedSAH);
+
+	AnalysedBuilder lbvh{ "LBVH", defaults };
+	lbvh.settings.method = BVHBuildMethod::LBVH;
+	builders.push_back(lbvh);
+
+	AnalysedBuilder ploc{ "PLOC", defaults };
+	ploc.settings.method = BVHBuildMethod::PLOC;
+	builders.push_back(ploc);
+
+	AnalysedBuilder sbvh{ "SBVH", defaults };
+	sbvh.settings.method = BVHBuildMethod::SBVH;
+	builders.push_back(sbvh);
+
+	AnalysedBuilder sahPreSplit{ "SAH+PreSplit", sah.settings };
+	sahPreSplit.settings.preSplitTriangles = true;
+	builders.push_back(sahPreSplit);
+
+	AnalysedBuilder sahTreelets{ "SAH+Treelets", sah.settings };
+	sahTreelets.settings.optimizeTreelets = true;
+	sahTreelets.settings.treeletTimeBudget = 0.0f;
+	builders.push_back(sahTreelets);
+
+	AnalysedBuilder lbvhTreelets{ "LBVH+Treelets", lbvh.settings };
+	lbvhTreelets.settings.optimizeTreelets = true;
+	lbvhTreelets.settings.treeletTimeBudget = 0.0f;
+	builders.push_back(lbvhTreelets);
+
+	return builders;
+}
+
+static std::string EscapeJSONString(const std::string& string)
+{
+	std::string escaped;
+	for (char c : string)
+	{
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+static std::string ToJSONArray(const std::vector<int>& values)
+{
+	std::stringstream stream;
+	stream << "[";
+	for (size_t i = 0; i < values.size(); i++)
+		stream << (i > 0 ? ", " : "") << values[i];
+	stream << "]";
+	return stream.str();
+}
+
+//Returns the fastest of a few passes in nanoseconds per ray, and the number of rays that hit something.
+static double BenchmarkTraversal(const std::function<bool(const BVHRay&, BVHRayHit&)>& trace, const std::vector<BVHRay>& rays, int& outHitCount)
+{
+	double bestTime = DBL_MAX;
+	for (int repeat = 0; repeat < BENCHMARK_REPEATS; repeat++)
+	{
+		int hitCount = 0;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (const BVHRay& ray : rays)
+		{
+			BVHRayHit hit;
+			if (trace(ray, hit))
+				hitCount++;
+		}
+		std::chrono::duration<double, std::nano> traceTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		bestTime = std::min(bestTime, traceTime.count() / std::max<size_t>(rays.size(), 1));
+		outHitCount = hitCount;
+	}
+
+	return bestTime;
+}
+
+static void AnalyseModel(const std::string& filePath, const std::vector<AnalysedBuilder>& builders, int rayCount, bool tune, std::ostream& out)
+{
+	std::vector<Vertex> vertices;
+	LoadObjFile(filePath, vertices);
+
+	std::vector<Triangle> sourceTriangles;
+	AABB modelAABB;
+	BuildModelTriangles(vertices, sourceTriangles, modelAABB);
+
+	out << "\t\t{\n";
+	out << "\t\t\t\"path\": \"" << EscapeJSONString(filePath) << "\",\n";
+	out << "\t\t\t\"triangles\": " << sourceTriangles.size() << ",\n";
+
+	//The same seed is used for every build.
+	std::vector<BVHRay> rays = GenerateSampleRays(modelAABB, rayCount, BENCHMARK_RAY_SEED);
+
+	//The grid is traced with the same rays, so it can be compared directly with the BVHs below.
+	TriangleGrid grid;
+	auto gridStartTime = std::chrono::high_resolution_clock::now();
+	BuildTriangleGrid(sourceTriangles, GridBuildSettings(), grid);
+	std::chrono::duration<double, std::milli> gridBuildTime = std::chrono::high_resolution_clock::now() - gridStartTime;
+
+	int gridHitCount = 0;
+	double gridNanosecondsPerRay = BenchmarkTraversal([&](const BVHRay& ray, BVHRayHit& hit)
+		{
+			return TraceTriangleGrid(sourceTriangles, grid, ray, FLT_MAX, hit);
+		}, rays, gridHitCount);
+
+	out << "\t\t\t\"grid\": { \"buildTimeMs\": " << gridBuildTime.count()
+		<< ", \"topResolution\": [" << grid.resolution.x << ", " << grid.resolution.y << ", " << grid.resolution.z << "]"
+		<< ", \"leafCells\": " << std::max<int>(static_cast<int>(grid.leafCellStarts.size()) - 1, 0)
+		<< ", \"triangleReferences\": " << grid.triangleIndices.size()
+		<< ", \"nsPerRay\": " << gridNanosecondsPerRay << ", \"hits\": " << gridHitCount << " },\n";
+
+	if (tune)
+	{
+		BVHBuildSettings tuningSettings = builders[0].settings;
+		tuningSettings.method = BVHBuildMethod::SAH;
+
+		auto tuneStartTime = std::chrono::high_resolution_clock::now();
+		BVHTuningResult tuning = TuneBVHBuildSettings(sourceTriangles, modelAABB, tuningSettings);
+		std::chrono::duration<double, std::milli> tuneTime = std::chrono::high_resolution_clock::now() - tuneStartTime;
+
+		out << "\t\t\t\"tuned\": { \"tuneTimeMs\": " << tuneTime.count() << ", \"candidates\": " << tuning.candidateCount
+			<< ", \"maxLeafTriangles\": " << tuning.maxLeafTriangles << ", \"traversalCost\": " << tuning.traversalCost
+			<< ", \"intersectionCost\": " << tuning.intersectionCost << ", \"binCount\": " << tuning.binCount
+			<< ", \"nsPerRay\": " << tuning.nanosecondsPerRay << " },\n";
+	}
+
+	out << "\t\t\t\"builds\": [\n";
+
+	for (size_t b = 0; b < builders.size(); b++)
+	{
+		const AnalysedBuilder& builder = builders[b];
+
+		std::vector<Triangle> triangles = sourceTriangles;
+		std::vector<BVHNode> nodes;
+
+		ParentBVHNode parentNode;
+		parentNode.node.aabb = modelAABB;
+		parentNode.objectIndex = -1;
+		parentNode.node.leftChild = -1;
+		parentNode.node.rightChild = -1;
+		parentNode.node.triangleStartIndex = 0;
+		parentNode.node.triangleCount = static_cast<int>(triangles.size());
+
+		BVHBuildStats buildStats;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		if (!triangles.empty())
+			BuildModelBVH(triangles, nodes, parentNode, 0, builder.settings, &buildStats);
+		std::chrono::duration<double, std::milli> buildTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		BVHQualityStats stats = AnalyseBVH(nodes, parentNode, 0, builder.settings);
+
+		out << "\t\t\t\t{\n";
+		out << "\t\t\t\t\t\"builder\": \"" << builder.name << "\",\n";
+		out << "\t\t\t\t\t\"buildTimeMs\": " << buildTime.count() << ",\n";
+		out << "\t\t\t\t\t\"sahCost\": " << stats.sahCost << ",\n";
+		out << "\t\t\t\t\t\"nodeCount\": " << stats.nodeCount << ",\n";
+		out << "\t\t\t\t\t\"leafCount\": " << stats.leafCount << ",\n";
+		out << "\t\t\t\t\t\"maxDepth\": " << stats.maxDepth << ",\n";
+		out << "\t\t\t\t\t\"triangleReferences\": " << stats.triangleReferences << ",\n";
+		out << "\t\t\t\t\t\"siblingOverlap\": " << stats.siblingOverlap << ",\n";
+		out << "\t\t\t\t\t\"preSplitReferences\": " << buildStats.preSplitReferences << ",\n";
+		out << "\t\t\t\t\t\"restructuredTreelets\": " << buildStats.restructuredTreelets << ",\n";
+		out << "\t\t\t\t\t\"depthHistogram\": " << ToJSONArray(stats.depthHistogram) << ",\n";
+		out << "\t\t\t\t\t\"leafSizeHistogram\": " << ToJSONArray(stats.leafSizeHistogram) << ",\n";
+		out << "\t\t\t\t\t\"layouts\": [\n";
+
+		for (size_t l = 0; l < std::size(ANALYSED_LAYOUTS); l++)
+		{
+			std::vector<BVHNode> layoutNodes = nodes;
+			ParentBVHNode layoutParentNode = parentNode;
+			ReorderBVHNodes(layoutNodes, layoutParentNode, 0, ANALYSED_LAYOUTS[l].layout);
+
+			std::vector<int> missLinks;
+			BuildBVHMissLinks(layoutNodes, layoutParentNode, 0, missLinks);
+
+			std::vector<PackedBVHNode> packedNodes;
+			PackBVHNodes(layoutNodes, packedNodes);
+
+			int hitCount = 0;
+			double nanosecondsPerRay = BenchmarkTraversal([&](const BVHRay& ray, BVHRayHit& hit)
+				{
+					return TraceBVH(triangles, layoutNodes, layoutParentNode, 0, ray, FLT_MAX, hit);
+				}, rays, hitCount);
+
+			int stacklessHitCount = 0;
+			double stacklessNanosecondsPerRay = BenchmarkTraversal([&](const BVHRay& ray, BVHRayHit& hit)
+				{
+					return TraceBVHStackless(triangles, layoutNodes, missLinks, layoutParentNode, 0, ray, FLT_MAX, hit);
+				}, rays, stacklessHitCount);
+
+			int packedHitCount = 0;
+			double packedNanosecondsPerRay = BenchmarkTraversal([&](const BVHRay& ray, BVHRayHit& hit)
+				{
+					return TracePackedBVH(triangles, packedNodes, layoutParentNode, 0, ray, FLT_MAX, hit);
+				}, rays, packedHitCount);
+
+			out << "\t\t\t\t\t\t{ \"layout\": \"" << ANALYSED_LAYOUTS[l].name << "\", \"nsPerRay\": " << nanosecondsPerRay << ", \"hits\": " << hitCount
+				<< ", \"stacklessNsPerRay\": " << stacklessNanosecondsPerRay << ", \"stacklessHits\": " << stacklessHitCount
+				<< ", \"packedNsPerRay\": " << packedNanosecondsPerRay << ", \"packedHits\": " << packedHitCount << " }"
+				<< (l + 1 < std::size(ANALYSED_LAYOUTS) ? "," : "") << "\n";
+		}
+
+		out << "\t\t\t\t\t]\n";
+		out << "\t\t\t\t}" << (b + 1 < builders.size() ? "," : "") << "\n";
+	}
+
+	out << "\t\t\t]\n";
+	out << "\t\t}";
+}
+
+int main(int argc, char* argv[])
+{
+	int threadCount = 0;
+	int rayCount = DEFAULT_BENCHMARK_RAY_COUNT;
+	bool tune = false;
+	std::vector<std::string> modelPaths;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		if (argument == "--threads" && i + 1 < argc)
+			threadCount = std::atoi(argv[++i]);
+		else if (argument == "--rays" && i + 1 < argc)
+			rayCount = std::max(0, std::atoi(argv[++i]));
+		else if (argument == "--tune")
+			tune = true;
+		else
+			modelPaths.push_back(argument);
+	}
+
+	if (modelPaths.empty())
+	{
+		std::cerr << "Usage: BVHAnalyser [--threads N] [--rays N] [--tune] model.obj [model.obj ...]" << std::endl;
+		return 1;
+	}
+
+	std::vector<AnalysedBuilder> builders = GetAnalysedBuilders(threadCount);
+
+	std::cout << "{\n\t\"models\": [\n";
+	for (size_t i = 0; i < modelPaths.size(); i++)
+	{
+		if (!FileExists(modelPaths[i]))
+		{
+			std::cerr << modelPaths[i] << " does not exist." << std::endl;
+			return 1;
+		}
+
+		AnalyseModel(modelPaths[i], builders, rayCount, tune, std::cout);
+		std::cout << (i + 1 < modelPaths.size() ? "," : "") << "\n";
+	}
+	std::cout << "\t]\n}" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filePath)
+{
+	HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	m_fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return;
+	}
+
+	m_mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mappingHandle == nullptr)
+	{
+		Close();
+		return;
+	}
+
+	m_pData = MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (m_pData == nullptr)
+	{
+		Close();
+		return;
+	}
+
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+}
+
+void MappedFile::Close()
+{
+	if (m_pData != nullptr)
+		UnmapViewOfFile(m_pData);
+	if (m_mappingHandle != nullptr)
+		CloseHandle(m_mappingHandle);
+	if (m_fileHandle != nullptr)
+		CloseHandle(m_fileHandle);
+
+	m_pData = nullptr;
+	m_mappingHandle = nullptr;
+	m_fileHandle = nullptr;
+	m_size = 0;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filePath)
+{
+	m_fileDescriptor = open(filePath.c_str(), O_RDONLY);
+	if (m_fileDescriptor == -1)
+		return;
+
+	struct stat fileStats;
+	if (fstat(m_fileDescriptor, &fileStats) != 0 || fileStats.st_size == 0)
+	{
+		Close();
+		return;
+	}
+
+	void* data = mmap(nullptr, static_cast<size_t>(fileStats.st_size), PROT_READ, MAP_PRIVATE, m_fileDescriptor, 0);
+	if (data == MAP_FAILED)
+	{
+		Close();
+		return;
+	}
+
+	m_pData = data;
+	m_size = static_cast<size_t>(fileStats.st_size);
+}
+
+void MappedFile::Close()
+{
+	if (m_pData != nullptr)
+		munmap(const_cast<void*>(m_pData), m_size);
+	if (m_fileDescriptor != -1)
+		close(m_fileDescriptor);
+
+	m_pData = nullptr;
+	m_fileDescriptor = -1;
+	m_size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
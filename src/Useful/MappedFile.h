@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+* Read only memory mapping of a whole file. The contents are paged in by the OS as they are read instead of being copied up front.
+* GetData() returns null if the file could not be opened or mapped.
+*/
+class MappedFile
+{
+private:
+
+	const void* m_pData = nullptr;
+	size_t m_size = 0;
+
+#ifdef _WIN32
+	void* m_fileHandle = nullptr;
+	void* m_mappingHandle = nullptr;
+#else
+	int m_fileDescriptor = -1;
+#endif
+
+	void Close();
+
+public:
+
+	MappedFile(const std::string& filePath);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const void* GetData() const { return m_pData; }
+	size_t GetSize() const { return m_size; }
+};
@@ -0,0 +1,153 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+static thread_local const ThreadPool* t_pCurrentPool = nullptr;
+static thread_local int t_iCurrentQueue = 0;
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+	//Queue 0 is shared by threads outside of the pool, workers own the rest.
+	for (int i = 0; i < threadCount; i++)
+		m_queues.push_back(std::make_unique<WorkQueue>());
+
+	for (int i = 1; i < threadCount; i++)
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_bRunning = false;
+	}
+	m_wakeCondition.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::WorkerLoop(int workerIndex)
+{
+	t_pCurrentPool = this;
+	t_iCurrentQueue = workerIndex;
+
+	while (m_bRunning)
+	{
+		if (RunPendingTask())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wakeCondition.wait(lock, [this]() { return !m_bRunning || m_iQueuedTasks > 0; });
+	}
+}
+
+int ThreadPool::GetCurrentQueueIndex() const
+{
+	return t_pCurrentPool == this ? t_iCurrentQueue : 0;
+}
+
+bool ThreadPool::PopTask(int queueIndex, std::function<void()>& outTask)
+{
+	WorkQueue& queue = *m_queues[queueIndex];
+	std::lock_guard<std::mutex> lock(queue.m_mutex);
+	if (queue.m_tasks.empty())
+		return false;
+
+	outTask = std::move(queue.m_tasks.back());
+	queue.m_tasks.pop_back();
+	m_iQueuedTasks--;
+	return true;
+}
+
+bool ThreadPool::StealTask(int thiefIndex, std::function<void()>& outTask)
+{
+	int queueCount = static_cast<int>(m_queues.size());
+	for (int i = 1; i < queueCount; i++)
+	{
+		WorkQueue& queue = *m_queues[(thiefIndex + i) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		if (queue.m_tasks.empty())
+			continue;
+
+		//Steal the oldest task, it is usually the largest piece of work.
+		outTask = std::move(queue.m_tasks.front());
+		queue.m_tasks.pop_front();
+		m_iQueuedTasks--;
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::Submit(std::function<void()>&& task)
+{
+	WorkQueue& queue = *m_queues[GetCurrentQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		queue.m_tasks.push_back(std::move(task));
+		m_iQueuedTasks++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+	}
+	m_wakeCondition.notify_one();
+}
+
+bool ThreadPool::RunPendingTask()
+{
+	int queueIndex = GetCurrentQueueIndex();
+
+	std::function<void()> task;
+	if (!PopTask(queueIndex, task) && !StealTask(queueIndex, task))
+		return false;
+
+	task();
+	return true;
+}
+
+void TaskGroup::Run(std::function<void()>&& task)
+{
+	m_iRemainingTasks++;
+	m_pool.Submit([this, task = std::move(task)]()
+		{
+			task();
+			m_iRemainingTasks.fetch_sub(1, std::memory_order_release);
+		});
+}
+
+void TaskGroup::Wait()
+{
+	while (m_iRemainingTasks.load(std::memory_order_acquire) > 0)
+	{
+		if (!m_pool.RunPendingTask())
+			std::this_thread::yield();
+	}
+}
+
+void ParallelFor(ThreadPool& pool, int count, int grainSize, const std::function<void(int begin, int end)>& body)
+{
+	grainSize = std::max(grainSize, 1);
+	int chunkCount = (count + grainSize - 1) / grainSize;
+	if (chunkCount <= 1)
+	{
+		if (count > 0)
+			body(0, count);
+		return;
+	}
+
+	TaskGroup group(pool);
+	for (int chunk = 1; chunk < chunkCount; chunk++)
+	{
+		int begin = chunk * grainSize;
+		int end = std::min(begin + grainSize, count);
+		group.Run([&body, begin, end]() { body(begin, end); });
+	}
+
+	body(0, std::min(grainSize, count));
+	group.Wait();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* Work stealing thread pool. Each worker owns a queue, pops its own work from the back and steals from the front of other queues when idle.
+* Threads that are not part of the pool submit into a shared queue and help run tasks while they wait on a TaskGroup.
+*/
+class ThreadPool
+{
+private:
+
+	struct WorkQueue
+	{
+		std::mutex m_mutex;
+		std::deque<std::function<void()>> m_tasks;
+	};
+
+	std::vector<std::thread> m_workers;
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+
+	std::atomic<bool> m_bRunning = true;
+	std::atomic<int> m_iQueuedTasks = 0;
+
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wakeCondition;
+
+	void WorkerLoop(int workerIndex);
+	int GetCurrentQueueIndex() const;
+
+	bool PopTask(int queueIndex, std::function<void()>& outTask);
+	bool StealTask(int thiefIndex, std::function<void()>& outTask);
+
+public:
+
+	/**
+	* Creates a pool that runs work on threadCount threads including the caller. 0 uses every hardware thread.
+	*/
+	ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/**
+	* Queues a task. Tasks submitted from a worker go onto that worker's own queue.
+	*/
+	void Submit(std::function<void()>&& task);
+
+	/**
+	* Runs one queued task on the calling thread if any are available. Returns false if there was nothing to run.
+	*/
+	bool RunPendingTask();
+
+	/**
+	* Number of threads that execute work, including the thread that waits on a TaskGroup.
+	*/
+	int GetThreadCount() const { return static_cast<int>(m_workers.size()) + 1; }
+};
+
+/**
+* Fork/join helper. Tasks run on the pool and Wait() executes queued work until all of them have finished.
+*/
+class TaskGroup
+{
+private:
+
+	ThreadPool& m_pool;
+	std::atomic<int> m_iRemainingTasks = 0;
+
+public:
+
+	TaskGroup(ThreadPool& pool) : m_pool(pool) {}
+	~TaskGroup() { Wait(); }
+
+	void Run(std::function<void()>&& task);
+	void Wait();
+};
+
+/**
+* Splits [0, count) into chunks of grainSize and runs body(begin, end) for each chunk on the pool.
+* Chunk boundaries only depend on count and grainSize so results are the same for any thread count.
+*/
+void ParallelFor(ThreadPool& pool, int count, int grainSize, const std::function<void(int begin, int end)>& body);
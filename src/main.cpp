@@ -1,12 +1,52 @@
+#include <charconv>
+#include <cstring>
 #include <iostream>
+#include <string>
 
 #include "Renderers/Hardware/HardwareRenderer.h"
 #include "Useful/Useful.h"
 
+//Parses the whole argument as an integer no smaller than minimum, so typos and trailing characters are rejected rather than read as 0.
+static bool ParseIntArgument(const char* argument, int minimum, int& outValue)
+{
+	const char* end = argument + std::strlen(argument);
+	auto [parsedEnd, error] = std::from_chars(argument, end, outValue);
+	return error == std::errc() && parsedEnd == end && outValue >= minimum;
+}
+
 int main(int argc, char* argv[])
 {
 	HardwareRenderer renderer;
+
+	//--cpu <width> <height> <frames> [threads] [--grid] renders on the CPU backend and exits, for machines without a GPU.
+	//--grid traces the models through triangle grids instead of their BVHs.
+	if (argc >= 2 && std::string(argv[1]) == "--cpu")
+	{
+		if (std::string(argv[argc - 1]) == "--grid")
+		{
+			BVHBuildSettings settings = renderer.GetBVHBuildSettings();
+			settings.accelerationStructure = ModelAccelerationStructure::TriangleGrid;
+			renderer.SetBVHBuildSettings(settings);
+			argc--;
+		}
+
+		int width = 0;
+		int height = 0;
+		int frames = 0;
+		int threadCount = 0;
+		if (argc < 5 || argc > 6 || !ParseIntArgument(argv[2], 1, width) || !ParseIntArgument(argv[3], 1, height) || !ParseIntArgument(argv[4], 1, frames) ||
+			(argc == 6 && !ParseIntArgument(argv[5], 0, threadCount)))
+		{
+			std::cout << "Usage: " << argv[0] << " --cpu <width> <height> <frames> [threads] [--grid]" << std::endl;
+			std::cout << "Width, height and frames must be at least 1, 0 threads uses every hardware thread." << std::endl;
+			return 1;
+		}
+
+		renderer.RenderOnCPU(width, height, frames, threadCount);
+		return 0;
+	}
+
 	renderer.InitializeRenderer();
 
 	return 0;
-}
\ No newline at end of file
+}